@@ -0,0 +1,27 @@
+# Writes the current git revision into a header, run as a script on every build
+#
+# Expects GIT_EXECUTABLE, SOURCE_DIR & OUTPUT to be defined. The header is only rewritten when the revision
+# changed, so an unchanged tree doesn't rebuild what includes it.
+
+set(PROJECTOR_GIT_REVISION "unknown")
+if(GIT_EXECUTABLE)
+    execute_process(
+        COMMAND ${GIT_EXECUTABLE} rev-parse --short HEAD
+        WORKING_DIRECTORY ${SOURCE_DIR}
+        OUTPUT_VARIABLE GIT_REVISION_OUTPUT
+        OUTPUT_STRIP_TRAILING_WHITESPACE
+        RESULT_VARIABLE GIT_REVISION_RESULT
+        ERROR_QUIET
+    )
+    if(GIT_REVISION_RESULT EQUAL 0 AND GIT_REVISION_OUTPUT)
+        set(PROJECTOR_GIT_REVISION ${GIT_REVISION_OUTPUT})
+    endif()
+endif()
+
+set(GIT_REVISION_HEADER "#pragma once\n\n#define PROJECTOR_GIT_REVISION \"${PROJECTOR_GIT_REVISION}\"\n")
+if(EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} GIT_REVISION_CURRENT)
+endif()
+if(NOT GIT_REVISION_CURRENT STREQUAL GIT_REVISION_HEADER)
+    file(WRITE ${OUTPUT} ${GIT_REVISION_HEADER})
+endif()
@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "git_revision.hpp" // Generated on every build, see cmake/GitRevision.cmake
+#include "jobs.hpp"
+#include "scene.hpp"
+#include "util.hpp"
+
+// Microbenchmarks for the CPU side of model loading & frame setup, reported as JSON so runs
+// can be compared across commits. Progress goes to stderr, results to stdout unless --out is given.
+// Usage: projector_bench [--model F] [--iterations N] [--out F]
+namespace
+{
+    struct Result
+    {
+        std::string name;
+        uint64_t itemsPerIteration;
+        std::vector<double> iterationNs;
+    };
+
+    // Keeps benchmarked results observable so the optimizer can't drop the work
+    volatile uint64_t sink = 0;
+
+    const Result Measure(const std::string& name, uint64_t itemsPerIteration, uint32_t iterations, const std::function<void()>& body)
+    {
+        std::cerr << "Running " << name << std::endl;
+
+        // Warm caches & allocator before timing
+        for (uint32_t i = 0; i < std::max(1u, iterations / 10); i++) body();
+
+        Result result{ name, itemsPerIteration, {} };
+        result.iterationNs.reserve(iterations);
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            body();
+            const auto end = std::chrono::steady_clock::now();
+            result.iterationNs.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+        }
+        return result;
+    }
+
+    void WriteJson(std::ostream& out, const std::string& modelPath, uint32_t iterations, std::vector<Result>& results)
+    {
+        out << "{\n";
+        out << "  \"revision\": \"" << PROJECTOR_GIT_REVISION << "\",\n";
+        out << "  \"model\": \"" << modelPath << "\",\n";
+        out << "  \"iterations\": " << iterations << ",\n";
+        out << "  \"benchmarks\": [\n";
+        for (size_t r = 0; r < results.size(); r++)
+        {
+            Result& result = results[r];
+            std::vector<double>& ns = result.iterationNs;
+            std::sort(ns.begin(), ns.end());
+            double sum = 0;
+            for (double value : ns) sum += value;
+            const double median = ns[ns.size() / 2];
+
+            out << "    {\"name\": \"" << result.name << "\", \"items\": " << result.itemsPerIteration
+                << ", \"min_ns\": " << ns.front() << ", \"median_ns\": " << median << ", \"mean_ns\": " << sum / ns.size()
+                << ", \"p95_ns\": " << ns[std::min(ns.size() - 1, static_cast<size_t>(ns.size() * 0.95))] << ", \"max_ns\": " << ns.back()
+                << ", \"median_ns_per_item\": " << (result.itemsPerIteration ? median / result.itemsPerIteration : 0.0)
+                << "}" << (r + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n";
+        out << "}\n";
+    }
+
+    // Mirrors Model::LoadNode without the device side: transforms only, mesh nodes collected separately
+    Scene::Node* LoadNodeTree(Scene::Node* parent, const tinygltf::Model& model, uint32_t nodeIndex, Scene::TransformHierarchy& hierarchy, std::vector<Scene::Node*>& linearNodes, std::vector<Scene::Node*>& meshNodes)
+    {
+        const tinygltf::Node& node = model.nodes[nodeIndex];
+        Scene::Node* newNode = new Scene::Node
+        {
+            .parent = parent,
+            .index = nodeIndex,
+            .name = node.name,
+            .hierarchyIndex = hierarchy.Add(parent ? static_cast<int32_t>(parent->hierarchyIndex) : -1),
+        };
+        linearNodes.push_back(newNode);
+        if (node.mesh > -1) meshNodes.push_back(newNode);
+        Scene::ReadNodeTransform(node, hierarchy, newNode->hierarchyIndex);
+
+        for (int child : node.children)
+        {
+            newNode->children.push_back(LoadNodeTree(newNode, model, child, hierarchy, linearNodes, meshNodes));
+        }
+        return newNode;
+    }
+
+    const float* AttributeData(const tinygltf::Model& model, const tinygltf::Primitive& primitive, const char* attribute, const tinygltf::Accessor** accessorOut = nullptr)
+    {
+        const auto it = primitive.attributes.find(attribute);
+        if (it == primitive.attributes.end()) return nullptr;
+
+        const tinygltf::Accessor& accessor = model.accessors[it->second];
+        const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+        if (accessorOut) *accessorOut = &accessor;
+        return reinterpret_cast<const float*>(&model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string modelPath = "res/sponza/Sponza.gltf";
+    std::string outPath;
+    uint32_t iterations = 50;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--model" && i + 1 < argc)
+        {
+            modelPath = argv[++i];
+        }
+        else if (arg == "--iterations" && i + 1 < argc)
+        {
+            iterations = static_cast<uint32_t>(std::max(1ul, std::stoul(argv[++i])));
+        }
+        else if (arg == "--out" && i + 1 < argc)
+        {
+            outPath = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Ignoring unknown argument '" << arg << "'" << std::endl;
+        }
+    }
+
+    // Textures are kept encoded like in Model, decoding is benchmarked separately
+    tinygltf::Model gltfModel;
+    tinygltf::TinyGLTF gltfContext;
+    gltfContext.SetImageLoader(Scene::DeferImageDecode, nullptr);
+    std::string error, warning;
+    if (!gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, modelPath))
+    {
+        std::cerr << "Could not load glTF file \"" << modelPath << "\": " << error << std::endl;
+        return 1;
+    }
+
+    struct PrimitiveData
+    {
+        Scene::VertexStreams streams;
+        const void* indices;
+        int indexComponentType;
+        size_t indexCount;
+    };
+    std::vector<PrimitiveData> primitives;
+    uint64_t vertexCount = 0;
+    uint64_t indexCount = 0;
+    for (const tinygltf::Mesh& mesh : gltfModel.meshes)
+    {
+        for (const tinygltf::Primitive& primitive : mesh.primitives)
+        {
+            const tinygltf::Accessor* posAccessor = nullptr;
+            const tinygltf::Accessor* colorAccessor = nullptr;
+            PrimitiveData data{};
+            data.streams.position = AttributeData(gltfModel, primitive, "POSITION", &posAccessor);
+            if (!data.streams.position || primitive.indices < 0) continue;
+
+            data.streams.count = posAccessor->count;
+            data.streams.normal = AttributeData(gltfModel, primitive, "NORMAL");
+            data.streams.uv = AttributeData(gltfModel, primitive, "TEXCOORD_0");
+            data.streams.color = AttributeData(gltfModel, primitive, "COLOR_0", &colorAccessor);
+            data.streams.colorComponents = colorAccessor && colorAccessor->type == TINYGLTF_PARAMETER_TYPE_FLOAT_VEC3 ? 3 : 4;
+            data.streams.tangent = AttributeData(gltfModel, primitive, "TANGENT");
+            data.streams.joints = reinterpret_cast<const uint16_t*>(AttributeData(gltfModel, primitive, "JOINTS_0"));
+            data.streams.weights = AttributeData(gltfModel, primitive, "WEIGHTS_0");
+
+            const tinygltf::Accessor& indexAccessor = gltfModel.accessors[primitive.indices];
+            const tinygltf::BufferView& indexView = gltfModel.bufferViews[indexAccessor.bufferView];
+            data.indices = &gltfModel.buffers[indexView.buffer].data[indexAccessor.byteOffset + indexView.byteOffset];
+            data.indexComponentType = indexAccessor.componentType;
+            data.indexCount = indexAccessor.count;
+
+            vertexCount += data.streams.count;
+            indexCount += data.indexCount;
+            primitives.push_back(data);
+        }
+    }
+
+    std::vector<Scene::Node*> rootNodes;
+    Scene::TransformHierarchy hierarchy;
+    std::vector<Scene::Node*> linearNodes;
+    std::vector<Scene::Node*> meshNodes;
+    const tinygltf::Scene& scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
+    for (int node : scene.nodes)
+    {
+        rootNodes.push_back(LoadNodeTree(nullptr, gltfModel, node, hierarchy, linearNodes, meshNodes));
+    }
+
+    std::vector<Result> results;
+
+    // Model::LoadNode accessor to vertex conversion, into a fresh buffer like a model load
+    results.push_back(Measure("gltf_vertex_conversion", vertexCount, iterations, [&]()
+    {
+        std::vector<Scene::Vertex> vertexBuffer;
+        for (const PrimitiveData& primitive : primitives)
+        {
+            Scene::AppendVertices(primitive.streams, vertexBuffer);
+        }
+        sink = sink + vertexBuffer.size();
+    }));
+
+    // The same into the packed layout's position & attribute streams
+    results.push_back(Measure("gltf_packed_vertex_conversion", vertexCount, iterations, [&]()
+    {
+        std::vector<glm::vec3> positions(vertexCount);
+        std::vector<Scene::PackedVertex> attributes(vertexCount);
+        size_t vertexStart = 0;
+        for (const PrimitiveData& primitive : primitives)
+        {
+            Scene::WritePackedVertices(primitive.streams, positions.data() + vertexStart, attributes.data() + vertexStart, nullptr);
+            vertexStart += primitive.streams.count;
+        }
+        sink = sink + attributes.back().uv;
+    }));
+
+    // Model's index conversion into the 16 & 32-bit regions
+    results.push_back(Measure("gltf_index_conversion", indexCount, iterations, [&]()
+    {
+        std::vector<uint16_t> indexBuffer16;
+        std::vector<uint32_t> indexBuffer32;
+        for (const PrimitiveData& primitive : primitives)
+        {
+            if (Scene::PrimitiveIndexType(primitive.streams.count) == VK_INDEX_TYPE_UINT16)
+            {
+                Scene::AppendIndices(primitive.indices, primitive.indexComponentType, primitive.indexCount, indexBuffer16);
+            }
+            else
+            {
+                Scene::AppendIndices(primitive.indices, primitive.indexComponentType, primitive.indexCount, indexBuffer32);
+            }
+        }
+        sink = sink + indexBuffer16.size() + indexBuffer32.size();
+    }));
+
+    // TransformHierarchy::Propagate with every node dirty, like after loading
+    results.push_back(Measure("hierarchy_propagate", hierarchy.Count(), iterations, [&]()
+    {
+        hierarchy.MarkAllDirty();
+        const Scene::TransformHierarchy::Range changed = hierarchy.Propagate();
+        sink = sink + changed.end + static_cast<uint64_t>(hierarchy.worlds.back()[3][0]);
+    }));
+
+    // TransformHierarchy::Update as Model::UpdateTransforms calls it after a root moved, into host memory standing
+    // in for the mapped transform buffer: mesh slots in hierarchy order at a typical 256 byte offset alignment
+    constexpr size_t transformStride = 256;
+    std::vector<uint8_t> transforms(std::max<size_t>(meshNodes.size(), 1) * transformStride);
+    std::vector<glm::mat4*> nodeTransforms(linearNodes.size(), nullptr);
+    for (size_t i = 0; i < meshNodes.size(); i++)
+    {
+        nodeTransforms[meshNodes[i]->hierarchyIndex] = reinterpret_cast<glm::mat4*>(&transforms[i * transformStride]);
+    }
+    results.push_back(Measure("update_transforms", meshNodes.size(), iterations, [&]()
+    {
+        hierarchy.MarkDirty(0);
+        const Scene::TransformHierarchy::Range changed = hierarchy.Update(nodeTransforms);
+        sink = sink + changed.end + transforms[transforms.size() - transformStride];
+    }));
+
+    // Texture constructor RGB to RGBA expansion, 2048x2048 like the larger Sponza textures
+    const size_t pixelCount = 2048 * 2048;
+    std::vector<unsigned char> rgb(pixelCount * 3);
+    std::vector<unsigned char> rgba(pixelCount * 4);
+    for (size_t i = 0; i < rgb.size(); i++) rgb[i] = static_cast<unsigned char>(i * 31);
+    results.push_back(Measure("texture_rgb_to_rgba", pixelCount, iterations, [&]()
+    {
+        Scene::ExpandRgbToRgba(rgb.data(), pixelCount, rgba.data());
+        sink = sink + rgba[pixelCount / 2];
+    }));
+
+    // CreateRenderImageResources shading rate map, 2560x1440 render extent at 8x8 texels
+    const uint32_t rateWidth = 320;
+    const uint32_t rateHeight = 180;
+    std::vector<uint8_t> rateMap(rateWidth * rateHeight);
+    results.push_back(Measure("shading_rate_map_fill", rateMap.size(), iterations, [&]()
+    {
+        Util::FillShadingRateMap(rateMap.data(), rateWidth, rateHeight, 0.8f, (4 >> 1) | (4 << 1));
+        sink = sink + rateMap[0];
+    }));
+
+    // UpdateUniformBuffer view & projection setup, 1000 distinct poses per iteration
+    const uint32_t poseCount = 1000;
+    results.push_back(Measure("view_projection_setup", poseCount, iterations, [&]()
+    {
+        float checksum = 0;
+        for (uint32_t i = 0; i < poseCount; i++)
+        {
+            const float t = i * 0.001f;
+            const Util::ViewProjection viewProjection = Util::ComputeViewProjection(
+                glm::vec3(t, 1.0f, -t), glm::vec2(0.1f * t, t),
+                glm::vec3(t + 0.01f, 1.0f, -t), glm::vec2(0.1f * t + 0.01f, t + 0.01f),
+                80.0f, 16.0f / 9.0f
+            );
+            checksum += viewProjection.warpView[3][0] + viewProjection.inverseProj[2][3];
+        }
+        sink = sink + static_cast<uint64_t>(checksum);
+    }));
+
+    // Job system scaling of Model's primitive conversion, each primitive into its own slice of shared buffers
+    std::vector<uint32_t> firstVertices;
+    std::vector<uint32_t> firstIndices; // Within the primitive's index region
+    uint32_t indexCount16 = 0;
+    uint32_t indexCount32 = 0;
+    {
+        uint32_t vertexStart = 0;
+        for (const PrimitiveData& primitive : primitives)
+        {
+            uint32_t& regionCount = Scene::PrimitiveIndexType(primitive.streams.count) == VK_INDEX_TYPE_UINT16 ? indexCount16 : indexCount32;
+            firstVertices.push_back(vertexStart);
+            firstIndices.push_back(regionCount);
+            vertexStart += static_cast<uint32_t>(primitive.streams.count);
+            regionCount += static_cast<uint32_t>(primitive.indexCount);
+        }
+    }
+    std::vector<Scene::Vertex> parallelVertices(vertexCount);
+    std::vector<uint16_t> parallelIndices16(indexCount16);
+    std::vector<uint32_t> parallelIndices32(indexCount32);
+
+    const uint32_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t threads = 1; threads < maxThreads; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+    for (uint32_t threads : threadCounts)
+    {
+        Jobs::JobSystem jobs(threads, "bench");
+        results.push_back(Measure("parallel_primitive_conversion_" + std::to_string(threads) + "t", vertexCount, iterations, [&]()
+        {
+            jobs.ParallelFor(static_cast<uint32_t>(primitives.size()), [&](uint32_t begin, uint32_t end, uint32_t chunk)
+            {
+                for (uint32_t i = begin; i < end; i++)
+                {
+                    const PrimitiveData& primitive = primitives[i];
+                    Scene::WriteVertices(primitive.streams, parallelVertices.data() + firstVertices[i]);
+                    if (Scene::PrimitiveIndexType(primitive.streams.count) == VK_INDEX_TYPE_UINT16)
+                    {
+                        Scene::WriteIndices(primitive.indices, primitive.indexComponentType, primitive.indexCount, parallelIndices16.data() + firstIndices[i]);
+                    }
+                    else
+                    {
+                        Scene::WriteIndices(primitive.indices, primitive.indexComponentType, primitive.indexCount, parallelIndices32.data() + firstIndices[i]);
+                    }
+                }
+            });
+            sink = sink + (indexCount16 > 0 ? parallelIndices16.back() : parallelIndices32.back());
+        }));
+    }
+
+    // Model::LoadImages decode of every texture, a tenth of the iterations as each decodes the whole set
+    const uint32_t decodeIterations = std::max(1u, iterations / 10);
+    for (uint32_t threads : threadCounts)
+    {
+        Jobs::JobSystem jobs(threads, "bench");
+        results.push_back(Measure("parallel_image_decode_" + std::to_string(threads) + "t", gltfModel.images.size(), decodeIterations, [&]()
+        {
+            // Decoding is in place, so each iteration starts from a copy of the encoded images
+            std::vector<tinygltf::Image> images = gltfModel.images;
+            jobs.ParallelFor(static_cast<uint32_t>(images.size()), [&](uint32_t begin, uint32_t end, uint32_t chunk)
+            {
+                for (uint32_t i = begin; i < end; i++) Scene::DecodeImage(images[i]);
+            });
+            sink = sink + images.size();
+        }));
+    }
+
+    for (Scene::Node* node : rootNodes) delete node;
+
+    if (outPath.empty())
+    {
+        WriteJson(std::cout, modelPath, iterations, results);
+    }
+    else
+    {
+        std::ofstream out(outPath, std::ios::trunc);
+        if (!out.is_open())
+        {
+            std::cerr << "Failed to open benchmark output file " << outPath << std::endl;
+            return 1;
+        }
+        WriteJson(out, modelPath, iterations, results);
+        std::cerr << "Wrote benchmark results to " << outPath << std::endl;
+    }
+    return 0;
+}
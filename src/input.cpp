@@ -1,14 +1,24 @@
 #include "input.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
+
+#include <glm/gtx/euler_angles.hpp>
+
+#include "profiler.hpp"
 
 namespace Input
 {
 	GLFWwindow* InputHandler::window_ = nullptr;
-	glm::vec2 InputHandler::mouseDelta_ = {};
+	std::atomic<uint32_t> InputHandler::moveKeys_ = 0;
+	std::atomic<glm::vec2> InputHandler::mouseDelta_ = glm::vec2(0);
+	std::atomic<uint64_t> InputHandler::mouseDeltaTimeNs_ = 0;
+	std::atomic<bool> InputHandler::mouseDisabled_ = false;
 	glm::vec2 InputHandler::mousePos_ = {};
 	glm::vec4 InputHandler::windowedSizePos_ = {};
-	bool InputHandler::mouseDisabled_ = false;
 
 	void InputHandler::Init(GLFWwindow* window)
 	{
@@ -29,27 +39,26 @@ namespace Input
 
 	const UserInput InputHandler::GetInput(const float deltaTime)
 	{
+		// The timestamp goes first, a cursor event landing in between is then only attributed a later time
+		const uint64_t eventTimeNs = mouseDeltaTimeNs_.exchange(0);
 		UserInput input =
 		{
-			.mouseDelta = mouseDelta_,
-			.moveDelta = glm::vec3(0, 0, 0)
+			.mouseDelta = mouseDelta_.exchange(glm::vec2(0)),
+			.moveDelta = glm::vec3(0, 0, 0),
+			.eventTimeNs = eventTimeNs,
 		};
 
-		mouseDisabled_ = glfwGetKey(window_, GLFW_KEY_LEFT_ALT);
-		glfwSetInputMode(
-			window_,
-			GLFW_CURSOR,
-			mouseDisabled_ ? GLFW_CURSOR_NORMAL : GLFW_CURSOR_DISABLED
-		);
+		// Headless runs have no window to poll
+		if (!window_) return input;
 
 		if (!mouseDisabled_)
 		{
-			if (glfwGetKey(window_, GLFW_KEY_A) == GLFW_PRESS) input.moveDelta.x -= 3.0f * deltaTime;
-			if (glfwGetKey(window_, GLFW_KEY_D) == GLFW_PRESS) input.moveDelta.x += 3.0f * deltaTime;
-			if (glfwGetKey(window_, GLFW_KEY_W) == GLFW_PRESS) input.moveDelta.z -= 3.0f * deltaTime;
-			if (glfwGetKey(window_, GLFW_KEY_S) == GLFW_PRESS) input.moveDelta.z += 3.0f * deltaTime;
+			const uint32_t keys = moveKeys_;
+			if (keys & Left) input.moveDelta.x -= 3.0f * deltaTime;
+			if (keys & Right) input.moveDelta.x += 3.0f * deltaTime;
+			if (keys & Forward) input.moveDelta.z -= 3.0f * deltaTime;
+			if (keys & Back) input.moveDelta.z += 3.0f * deltaTime;
 		}
-		mouseDelta_ = {};
 
 		return input;
 	}
@@ -59,8 +68,12 @@ namespace Input
 		if (window != window_) return;
 		if (!mouseDisabled_)
 		{
-			mouseDelta_.x += 0.001f * (xpos - mousePos_.x);
-			mouseDelta_.y += 0.001f * (ypos - mousePos_.y);
+			uint64_t noEvent = 0;
+			mouseDeltaTimeNs_.compare_exchange_strong(noEvent, Profiler::CpuProfiler::Now());
+
+			const glm::vec2 delta(0.001f * (xpos - mousePos_.x), 0.001f * (ypos - mousePos_.y));
+			glm::vec2 accumulated = mouseDelta_.load();
+			while (!mouseDelta_.compare_exchange_weak(accumulated, accumulated + delta));
 		}
 		mousePos_.x = xpos;
 		mousePos_.y = ypos;
@@ -68,7 +81,30 @@ namespace Input
 
 	void InputHandler::OnKey(GLFWwindow* window, int key, int scancode, int action, int mods)
 	{
-		if (window != window_ || action != GLFW_PRESS) return;
+		if (window != window_) return;
+
+		if (action != GLFW_REPEAT)
+		{
+			const bool pressed = action == GLFW_PRESS;
+			uint32_t moveKey = 0;
+			switch (key)
+			{
+			case GLFW_KEY_W: moveKey = Forward; break;
+			case GLFW_KEY_S: moveKey = Back; break;
+			case GLFW_KEY_A: moveKey = Left; break;
+			case GLFW_KEY_D: moveKey = Right; break;
+			}
+			if (pressed) moveKeys_ |= moveKey;
+			else moveKeys_ &= ~moveKey;
+
+			// Holding alt frees the cursor for the UI
+			if (key == GLFW_KEY_LEFT_ALT)
+			{
+				mouseDisabled_ = pressed;
+				glfwSetInputMode(window_, GLFW_CURSOR, pressed ? GLFW_CURSOR_NORMAL : GLFW_CURSOR_DISABLED);
+			}
+		}
+		if (action != GLFW_PRESS) return;
 
 		if (key == GLFW_KEY_ESCAPE)
 		{
@@ -102,4 +138,216 @@ namespace Input
 			}
 		}
 	}
+
+	void PoseRing::Push(const TimedPose& pose)
+	{
+		// Single producer, no need to claim the index atomically; publish by writing the sequence last
+		const uint64_t index = writeIndex_.load(std::memory_order_relaxed);
+		Slot& slot = slots_[index % CAPACITY];
+		slot.sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.pose.Store(pose);
+		slot.sequence.store(index + 1, std::memory_order_release);
+		writeIndex_.store(index + 1, std::memory_order_release);
+	}
+
+	const bool PoseRing::Read(uint64_t index, TimedPose& pose) const
+	{
+		const Slot& slot = slots_[index % CAPACITY];
+		if (slot.sequence.load(std::memory_order_acquire) != index + 1) return false;
+		pose = slot.pose.Load();
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return slot.sequence.load(std::memory_order_relaxed) == index + 1;
+	}
+
+	const bool PoseRing::Sample(uint64_t timeNs, TimedPose& pose) const
+	{
+		const uint64_t written = writeIndex_.load(std::memory_order_acquire);
+		if (written == 0) return false;
+
+		// Walk back from the newest pose, targets are usually within a few samples of it
+		TimedPose after;
+		uint64_t index = written - 1;
+		while (!Read(index, after))
+		{
+			// Only the slot being rewritten can fail, so a newer pose exists
+			index = writeIndex_.load(std::memory_order_acquire) - 1;
+		}
+		if (after.timeNs <= timeNs)
+		{
+			pose = after;
+			return true;
+		}
+
+		const uint64_t oldest = written > CAPACITY ? written - CAPACITY + 1 : 0;
+		while (index > oldest)
+		{
+			TimedPose before;
+			if (!Read(--index, before)) break; // Overwritten under us, i.e. older than anything still retained
+			if (before.timeNs <= timeNs)
+			{
+				const float t = static_cast<float>(timeNs - before.timeNs) / static_cast<float>(after.timeNs - before.timeNs);
+				pose = TimedPose
+				{
+					.timeNs = timeNs,
+					.position = glm::mix(before.position, after.position, t),
+					.rotation = glm::mix(before.rotation, after.rotation, t),
+					.inputNs = before.inputNs,
+				};
+				return true;
+			}
+			after = before;
+		}
+		pose = after;
+		return true;
+	}
+
+	PoseTracker::PoseTracker(const glm::vec3& position, const glm::vec2& rotation, uint32_t rate)
+		: position_(position)
+		, rotation_(rotation)
+		, periodNs_(1'000'000'000ull / std::max(rate, 1u))
+	{
+		const uint64_t nowNs = Profiler::CpuProfiler::Now();
+		poses_.Push(TimedPose
+		{
+			.timeNs = nowNs,
+			.position = position_,
+			.rotation = rotation_,
+			.inputNs = nowNs,
+		});
+		thread_ = std::thread(&PoseTracker::SampleLoop, this);
+
+		std::cout << "Sampling input at " << rate << " Hz" << std::endl;
+	}
+
+	PoseTracker::~PoseTracker()
+	{
+		stopping_ = true;
+		thread_.join();
+	}
+
+	void PoseTracker::SampleLoop()
+	{
+		Profiler::CpuProfiler::SetThreadName("input");
+
+		uint64_t lastNs = Profiler::CpuProfiler::Now();
+		uint64_t nextNs = lastNs + periodNs_;
+		while (!stopping_)
+		{
+			uint64_t nowNs = Profiler::CpuProfiler::Now();
+			if (nowNs < nextNs)
+			{
+				std::this_thread::sleep_for(std::chrono::nanoseconds(nextNs - nowNs));
+				nowNs = Profiler::CpuProfiler::Now();
+			}
+			// Steps stay on a fixed grid; after a stall, skip the missed ones rather than bursting
+			nextNs += (nowNs > nextNs ? (nowNs - nextNs) / periodNs_ + 1 : 1) * periodNs_;
+
+			const UserInput input = InputHandler::GetInput((nowNs - lastNs) / 1e9f);
+			lastNs = nowNs;
+
+			glm::vec3 relativeMovement =
+				glm::eulerAngleY(rotation_.y) *
+				glm::vec4(input.moveDelta, 0);
+
+			position_ += relativeMovement;
+			rotation_.x -= input.mouseDelta.y;
+			rotation_.y -= input.mouseDelta.x;
+
+			// Without cursor events the pose is as fresh as this poll of the keyboard
+			poses_.Push(TimedPose
+			{
+				.timeNs = nowNs,
+				.position = position_,
+				.rotation = rotation_,
+				.inputNs = input.eventTimeNs ? input.eventTimeNs : nowNs,
+			});
+		}
+	}
+
+	PoseRecorder::PoseRecorder(const std::string& path)
+		: file_(path, std::ios::binary | std::ios::trunc)
+	{
+		if (!file_.is_open())
+		{
+			throw std::runtime_error("failed to open camera path file for recording: " + path);
+		}
+		file_.write(POSE_FILE_MAGIC, sizeof(POSE_FILE_MAGIC));
+		file_.write(reinterpret_cast<const char*>(&POSE_FILE_VERSION), sizeof(POSE_FILE_VERSION));
+
+		std::cout << "Recording camera path to " << path << std::endl;
+	}
+
+	PoseRecorder::~PoseRecorder()
+	{
+		file_.close();
+		std::cout << "Recorded " << sampleCount_ << " camera path samples" << std::endl;
+	}
+
+	void PoseRecorder::Record(float time, const glm::vec3& position, const glm::vec2& rotation)
+	{
+		if (sampleCount_ == 0) startTime_ = time;
+
+		const PoseSample sample
+		{
+			.time = time - startTime_,
+			.position = position,
+			.rotation = rotation,
+		};
+		file_.write(reinterpret_cast<const char*>(&sample), sizeof(sample));
+		sampleCount_++;
+	}
+
+	PosePlayback::PosePlayback(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::ate | std::ios::binary);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("failed to open camera path file: " + path);
+		}
+
+		const size_t fileSize = static_cast<size_t>(file.tellg());
+		const size_t headerSize = sizeof(POSE_FILE_MAGIC) + sizeof(POSE_FILE_VERSION);
+		if (fileSize < headerSize + sizeof(PoseSample))
+		{
+			throw std::runtime_error("camera path file is empty: " + path);
+		}
+		file.seekg(0);
+
+		char magic[sizeof(POSE_FILE_MAGIC)];
+		uint32_t version = 0;
+		file.read(magic, sizeof(magic));
+		file.read(reinterpret_cast<char*>(&version), sizeof(version));
+		if (std::memcmp(magic, POSE_FILE_MAGIC, sizeof(magic)) != 0 || version != POSE_FILE_VERSION)
+		{
+			throw std::runtime_error("unsupported camera path file: " + path);
+		}
+
+		// A truncated trailing record (e.g. from a crash while recording) is dropped
+		samples_.resize((fileSize - headerSize) / sizeof(PoseSample));
+		file.read(reinterpret_cast<char*>(samples_.data()), samples_.size() * sizeof(PoseSample));
+
+		std::cout << "Loaded camera path " << path << " with " << samples_.size() << " samples (" << GetDuration() << " s)" << std::endl;
+	}
+
+	const PoseSample PosePlayback::Sample(float time) const
+	{
+		if (time <= samples_.front().time) return samples_.front();
+		if (time >= samples_.back().time) return samples_.back();
+
+		// First sample strictly after the requested time, interpolate from its predecessor
+		const auto next = std::upper_bound(samples_.begin(), samples_.end(), time,
+			[](float t, const PoseSample& sample) { return t < sample.time; });
+		const auto& b = *next;
+		const auto& a = *(next - 1);
+
+		const float span = b.time - a.time;
+		const float t = span > 0 ? (time - a.time) / span : 1.0f;
+		return PoseSample
+		{
+			.time = time,
+			.position = glm::mix(a.position, b.position, t),
+			.rotation = glm::mix(a.rotation, b.rotation, t),
+		};
+	}
 }
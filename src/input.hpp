@@ -7,7 +7,15 @@
 #include <glm/glm.hpp>
 #include <GLFW/glfw3.h>
 
+#include <array>
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace Input
 {
@@ -15,12 +23,16 @@ namespace Input
 	{
 		glm::vec2 mouseDelta;
 		glm::vec3 moveDelta;
+		uint64_t eventTimeNs; // Host time of the oldest cursor event folded into mouseDelta, 0 if none
 	};
 
+	// GLFW callbacks run on the main thread and only update the atomic state here, so GetInput can be
+	// called from any one thread
 	class InputHandler
 	{
 	public:
 		static void Init(GLFWwindow* window);
+		// Consumes the mouse movement since the previous call
 		static const UserInput GetInput(const float deltaTime);
 
 		static void OnCursor(GLFWwindow* window, double xpos, double ypos);
@@ -28,11 +40,149 @@ namespace Input
 private:
 		InputHandler() {}
 
+		enum MoveKey : uint32_t
+		{
+			Forward = 1 << 0,
+			Back = 1 << 1,
+			Left = 1 << 2,
+			Right = 1 << 3,
+		};
+
 		static GLFWwindow* window_;
-		static glm::vec2 mouseDelta_;
+		static std::atomic<uint32_t> moveKeys_; // MoveKey bits held down
+		static std::atomic<glm::vec2> mouseDelta_;
+		static std::atomic<uint64_t> mouseDeltaTimeNs_;
+		static std::atomic<bool> mouseDisabled_;
 		static glm::vec2 mousePos_;
-		static bool mouseDisabled_;
 
 		static glm::vec4 windowedSizePos_;
 	};
+
+	// Player camera pose at a host time, with the host time of the oldest input folded into it
+	struct TimedPose
+	{
+		uint64_t timeNs;
+		glm::vec3 position;
+		glm::vec2 rotation;
+		uint64_t inputNs;
+	};
+
+	// Plain data kept in relaxed atomic words for seqlocks. A reader racing the writer gets a torn copy that its
+	// sequence check discards, instead of a data race on non-atomic memory.
+	template<typename T>
+	class SeqlockPayload
+	{
+	public:
+		void Store(const T& value)
+		{
+			std::array<uint64_t, WordCount> words = {};
+			std::memcpy(words.data(), &value, sizeof(T));
+			for (size_t i = 0; i < WordCount; i++) words_[i].store(words[i], std::memory_order_relaxed);
+		}
+
+		const T Load() const
+		{
+			std::array<uint64_t, WordCount> words;
+			for (size_t i = 0; i < WordCount; i++) words[i] = words_[i].load(std::memory_order_relaxed);
+			T value;
+			std::memcpy(&value, words.data(), sizeof(T));
+			return value;
+		}
+
+	private:
+		static_assert(std::is_trivially_copyable_v<T>);
+		static constexpr size_t WordCount = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+		std::array<std::atomic<uint64_t>, WordCount> words_ = {};
+	};
+
+	// Single producer, multiple consumer ring of the most recent poses. Readers never hold up the producer;
+	// a slot overwritten while being read is detected by its sequence and the read retried or skipped.
+	class PoseRing
+	{
+	public:
+		void Push(const TimedPose& pose);
+
+		// Pose at timeNs, interpolated between the samples around it. Times past the newest sample get the
+		// newest, times before the oldest retained one the oldest. False if nothing has been pushed yet.
+		const bool Sample(uint64_t timeNs, TimedPose& pose) const;
+
+	private:
+		struct Slot
+		{
+			SeqlockPayload<TimedPose> pose;
+			std::atomic<uint64_t> sequence = 0; // Write index + 1 once the pose is complete, 0 while being written
+		};
+
+		// False if the slot no longer holds the pose with this write index
+		const bool Read(uint64_t index, TimedPose& pose) const;
+
+		static constexpr uint32_t CAPACITY = 256; // A quarter second at 1 kHz
+		std::array<Slot, CAPACITY> slots_;
+		std::atomic<uint64_t> writeIndex_ = 0;
+	};
+
+	// Integrates the player pose from keyboard & mouse at a fixed rate on its own thread, publishing each
+	// step to a PoseRing that the render & warp threads sample for their target times
+	class PoseTracker
+	{
+	public:
+		PoseTracker(const glm::vec3& position, const glm::vec2& rotation, uint32_t rate);
+		~PoseTracker();
+
+		PoseTracker(const PoseTracker&) = delete;
+		PoseTracker& operator=(const PoseTracker&) = delete;
+
+		const PoseRing& GetPoses() const { return poses_; }
+
+	private:
+		void SampleLoop();
+
+		glm::vec3 position_;
+		glm::vec2 rotation_;
+		uint64_t periodNs_;
+
+		PoseRing poses_;
+		std::atomic<bool> stopping_ = false;
+		std::thread thread_;
+	};
+
+	// Camera pose sample, time in seconds from the start of the recording
+	struct PoseSample
+	{
+		float time;
+		glm::vec3 position;
+		glm::vec2 rotation;
+	};
+
+	// Appends pose samples to a compact binary camera path file
+	class PoseRecorder
+	{
+	public:
+		PoseRecorder(const std::string& path);
+		~PoseRecorder();
+
+		void Record(float time, const glm::vec3& position, const glm::vec2& rotation);
+		const uint32_t GetSampleCount() const { return sampleCount_; }
+	private:
+		std::ofstream file_;
+		float startTime_ = 0;
+		uint32_t sampleCount_ = 0;
+	};
+
+	// Loads a recorded camera path and samples it at arbitrary times
+	class PosePlayback
+	{
+	public:
+		PosePlayback(const std::string& path);
+
+		const PoseSample Sample(float time) const;
+		const float GetDuration() const { return samples_.back().time; }
+		const bool IsFinished(float time) const { return time > GetDuration(); }
+	private:
+		std::vector<PoseSample> samples_;
+	};
+
+	// Camera path file header, followed by tightly packed PoseSample records
+	constexpr char POSE_FILE_MAGIC[4] = { 'P', 'J', 'C', 'P' };
+	constexpr uint32_t POSE_FILE_VERSION = 1;
 }
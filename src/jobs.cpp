@@ -0,0 +1,198 @@
+#include "jobs.hpp"
+
+#include <algorithm>
+
+#include "profiler.hpp"
+
+namespace Jobs
+{
+    namespace
+    {
+        // Job system & queue of the worker running on this thread
+        thread_local const JobSystem* currentSystem = nullptr;
+        thread_local uint32_t currentQueue = 0;
+    }
+
+    TaskGroup::~TaskGroup()
+    {
+        Join();
+    }
+
+    void TaskGroup::Run(std::function<void()> function, const char* name)
+    {
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        jobs_.Push(JobSystem::Task{ std::move(function), this, name });
+    }
+
+    void TaskGroup::Wait()
+    {
+        Join();
+
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(errorMutex_);
+            std::swap(error, error_);
+        }
+        if (error) std::rethrow_exception(error);
+    }
+
+    void TaskGroup::Join()
+    {
+        while (pending_.load(std::memory_order_acquire) != 0)
+        {
+            // Help rather than block, the tasks this group waits on may be queued behind others
+            if (jobs_.RunOne()) continue;
+
+            std::unique_lock<std::mutex> lock(jobs_.doneMutex_);
+            jobs_.done_.wait(lock, [this]
+            {
+                return pending_.load(std::memory_order_acquire) == 0 || jobs_.queuedCount_.load() > 0;
+            });
+        }
+    }
+
+    JobSystem::JobSystem(uint32_t threadCount, const char* name)
+        : name_(name)
+    {
+        threadCount = std::max(threadCount, 1u);
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+        for (uint32_t queue = 1; queue < threadCount; queue++)
+        {
+            workers_.emplace_back(&JobSystem::WorkerLoop, this, queue);
+        }
+    }
+
+    JobSystem::~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& worker : workers_) worker.join();
+    }
+
+    void JobSystem::ParallelFor(uint32_t count, uint32_t chunkCount, const RangeFunction& body, const char* name)
+    {
+        if (count == 0) return;
+        chunkCount = std::clamp(chunkCount, 1u, count);
+
+        const auto chunkBegin = [&](uint32_t chunk) { return static_cast<uint32_t>(static_cast<uint64_t>(count) * chunk / chunkCount); };
+
+        TaskGroup group(*this);
+        for (uint32_t chunk = 1; chunk < chunkCount; chunk++)
+        {
+            const uint32_t begin = chunkBegin(chunk);
+            const uint32_t end = chunkBegin(chunk + 1);
+            group.Run([&body, begin, end, chunk] { body(begin, end, chunk); }, name);
+        }
+        {
+            Profiler::Zone zone(name);
+            body(0, chunkBegin(1), 0);
+        }
+        group.Wait();
+    }
+
+    void JobSystem::Push(Task&& task)
+    {
+        // Counted first so that the count never drops below what's queued
+        queuedCount_.fetch_add(1);
+        Queue& queue = *queues_[LocalQueue()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+
+        // Taking the lock orders this against a worker checking the count before sleeping
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+        }
+        wake_.notify_one();
+        {
+            std::lock_guard<std::mutex> lock(doneMutex_);
+        }
+        done_.notify_all();
+    }
+
+    const bool JobSystem::RunOne()
+    {
+        const uint32_t local = LocalQueue();
+        const uint32_t queueCount = static_cast<uint32_t>(queues_.size());
+
+        Task task;
+        bool found = false;
+        for (uint32_t i = 0; i < queueCount && !found; i++)
+        {
+            Queue& queue = *queues_[(local + i) % queueCount];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+
+            // Newest of our own for locality, oldest of another's as it's likely the largest remaining work
+            if (i == 0)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            found = true;
+        }
+        if (!found) return false;
+
+        queuedCount_.fetch_sub(1);
+        Execute(task);
+        return true;
+    }
+
+    void JobSystem::Execute(Task& task)
+    {
+        TaskGroup* group = task.group;
+        try
+        {
+            Profiler::Zone zone(task.name);
+            task.function();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(group->errorMutex_);
+            if (!group->error_) group->error_ = std::current_exception();
+        }
+
+        // The group may be destroyed as soon as its count reaches 0, only the job system is touched after
+        if (group->pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            {
+                std::lock_guard<std::mutex> lock(doneMutex_);
+            }
+            done_.notify_all();
+        }
+    }
+
+    const uint32_t JobSystem::LocalQueue() const
+    {
+        return currentSystem == this ? currentQueue : 0;
+    }
+
+    void JobSystem::WorkerLoop(uint32_t queue)
+    {
+        currentSystem = this;
+        currentQueue = queue;
+        const std::string threadName = name_ + " " + std::to_string(queue);
+        Profiler::CpuProfiler::SetThreadName(threadName.c_str());
+
+        while (true)
+        {
+            if (RunOne()) continue;
+
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            wake_.wait(lock, [this] { return stopping_ || queuedCount_.load() > 0; });
+            if (stopping_) return;
+        }
+    }
+}
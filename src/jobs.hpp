@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Jobs
+{
+    class JobSystem;
+
+    // Fork/join scope over a job system. Wait runs queued tasks on the calling thread until every task of the
+    // group is done, so groups can nest: tasks may start groups of their own and wait on them.
+    class TaskGroup
+    {
+    public:
+        TaskGroup(JobSystem& jobs) : jobs_(jobs) {}
+        // Waits for outstanding tasks, dropping their errors
+        ~TaskGroup();
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        // Name is stored by pointer for the profiler zone, in practice a string literal
+        void Run(std::function<void()> function, const char* name = "task");
+        // Rethrows the first exception thrown by one of the group's tasks
+        void Wait();
+
+    private:
+        friend class JobSystem;
+
+        void Join();
+
+        JobSystem& jobs_;
+        std::atomic<uint32_t> pending_ = 0;
+        std::mutex errorMutex_;
+        std::exception_ptr error_;
+    };
+
+    // Work-stealing thread pool. Each worker owns a deque it pushes & pops at the back; idle threads steal the
+    // oldest task from the front of another's. Threads outside the system queue into a shared deque of their
+    // own. Every task runs in a CPU profiler zone.
+    class JobSystem
+    {
+    public:
+        using RangeFunction = std::function<void(uint32_t begin, uint32_t end, uint32_t chunk)>;
+
+        // threadCount includes the thread waiting on a group, so 1 runs everything on the waiting thread
+        JobSystem(uint32_t threadCount, const char* name = "worker");
+        ~JobSystem();
+
+        JobSystem(const JobSystem&) = delete;
+        JobSystem& operator=(const JobSystem&) = delete;
+
+        const uint32_t GetThreadCount() const { return static_cast<uint32_t>(workers_.size()) + 1; }
+
+        // Calls body once per contiguous chunk of [0, count) and returns when all are done, rethrowing the first
+        // exception. Chunk indices run from 0 to chunkCount - 1, the calling thread takes chunk 0.
+        void ParallelFor(uint32_t count, uint32_t chunkCount, const RangeFunction& body, const char* name = "parallel for");
+        // A few chunks per thread, leaving room to balance uneven work by stealing
+        void ParallelFor(uint32_t count, const RangeFunction& body, const char* name = "parallel for") { ParallelFor(count, GetThreadCount() * 4, body, name); }
+
+        // Runs one queued task on the calling thread, false if there was none. For threads that wait on their
+        // tasks by other means than a group; with a thread count of 1 nothing else would run them.
+        const bool RunPending() { return RunOne(); }
+
+    private:
+        friend class TaskGroup;
+
+        struct Task
+        {
+            std::function<void()> function;
+            TaskGroup* group;
+            const char* name;
+        };
+
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void Push(Task&& task);
+        // Runs one queued task: the calling thread's newest, else the oldest of another queue. False if none.
+        const bool RunOne();
+        void Execute(Task& task);
+        const uint32_t LocalQueue() const;
+        void WorkerLoop(uint32_t queue);
+
+        std::string name_;
+        std::vector<std::unique_ptr<Queue>> queues_; // 0 for threads outside the system, then one per worker
+        std::vector<std::thread> workers_;
+
+        std::atomic<uint32_t> queuedCount_ = 0; // Never below the tasks actually queued
+        std::mutex sleepMutex_;
+        std::condition_variable wake_; // Idle workers
+        std::mutex doneMutex_;
+        std::condition_variable done_; // Threads waiting on a group
+        bool stopping_ = false;
+    };
+}
@@ -10,9 +10,58 @@ int main(int argc, char* argv[])
     std::cout << "Running in release mode" << std::endl;
 #endif
 
+    Projector::LaunchOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--headless")
+        {
+            options.headless = true;
+        }
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            options.benchmarkFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            options.recordPath = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            options.replayPath = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            options.tracePath = argv[++i];
+        }
+        else if (arg == "--metrics" && i + 1 < argc)
+        {
+            options.metricsPath = argv[++i];
+        }
+        else if (arg == "--input-rate" && i + 1 < argc)
+        {
+            options.inputRate = static_cast<uint32_t>(std::max(1ul, std::stoul(argv[++i])));
+        }
+        else if (arg == "--stream-textures")
+        {
+            options.streamTextures = true;
+        }
+        else if (arg == "--vertex-layout" && i + 1 < argc)
+        {
+            const std::string layout = argv[++i];
+            if (layout == "full") options.vertexLayout = Scene::VertexLayout::Full;
+            else if (layout == "packed") options.vertexLayout = Scene::VertexLayout::Packed;
+            else std::cout << "Ignoring unknown vertex layout '" << layout << "'" << std::endl;
+        }
+        else
+        {
+            std::cout << "Ignoring unknown argument '" << arg << "'" << std::endl;
+        }
+    }
+
     try
     {
-        Projector::Projector app;
+        Projector::Projector app(options);
         app.Run();
     }
     catch (std::exception& e)
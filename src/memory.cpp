@@ -0,0 +1,336 @@
+#include "memory.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace Memory
+{
+    // Preferred block size, smaller on small heaps. Requests over half a block get a dedicated allocation.
+    constexpr VkDeviceSize BLOCK_SIZE = 64ull << 20;
+    constexpr uint32_t TILING_COUNT = 2;
+
+    struct Range
+    {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+
+    struct Block
+    {
+        uint32_t pool;
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        uint8_t* mapped;
+        uint32_t allocationCount = 0;
+
+        std::vector<Range> free; // Sorted by offset, never adjacent
+    };
+
+    namespace
+    {
+        VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    Allocator::Allocator(const VkPhysicalDevice& physicalDevice, const VkDevice& device)
+        : device_(device)
+    {
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties_);
+
+        VkPhysicalDeviceProperties properties{};
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        bufferImageGranularity_ = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+        maxDeviceAllocations_ = properties.limits.maxMemoryAllocationCount;
+        stats_.maxDeviceAllocations = maxDeviceAllocations_;
+
+        for (uint32_t memoryType = 0; memoryType < memoryProperties_.memoryTypeCount; memoryType++)
+        {
+            for (uint32_t tiling = 0; tiling < TILING_COUNT; tiling++)
+            {
+                pools_.push_back(Pool{ .memoryType = memoryType });
+            }
+        }
+    }
+
+    Allocator::~Allocator()
+    {
+        uint32_t liveCount = 0;
+        for (const CategoryStats& category : stats_.categories) liveCount += category.allocationCount;
+        if (liveCount > 0)
+        {
+            std::cout << "Device memory allocations still live at exit: " << liveCount << std::endl;
+        }
+
+        // Dedicated allocations are only known to their owners, live ones leak
+        for (Pool& pool : pools_)
+        {
+            for (std::unique_ptr<Block>& block : pool.blocks)
+            {
+                vkFreeMemory(device_, block->memory, nullptr);
+            }
+        }
+    }
+
+    const Allocation Allocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, Tiling tiling, Category category)
+    {
+        // Tile based GPUs may never back lazily allocated memory at all, if attachments stay in tile memory
+        uint32_t memoryType = UINT32_MAX;
+        if (category == Transient)
+        {
+            memoryType = FindMemoryType(requirements.memoryTypeBits, properties | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+        }
+        const bool lazilyAllocated = memoryType != UINT32_MAX;
+        if (!lazilyAllocated)
+        {
+            memoryType = FindMemoryType(requirements.memoryTypeBits, properties);
+        }
+        if (memoryType == UINT32_MAX)
+        {
+            throw std::runtime_error("no suitable memory on physical device");
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        Allocation allocation
+        {
+            .size = requirements.size,
+            .allocator = this,
+            .category = category,
+            .lazilyAllocated = lazilyAllocated,
+        };
+
+        // Commitment is per device allocation, so lazily allocated memory isn't shared
+        const VkDeviceSize blockSize = BlockSize(memoryType);
+        if (!lazilyAllocated && requirements.size <= blockSize / 2)
+        {
+            const uint32_t poolIndex = PoolIndex(memoryType, tiling);
+            Pool& pool = pools_[poolIndex];
+
+            Block* found = nullptr;
+            VkDeviceSize offset = 0;
+            for (std::unique_ptr<Block>& block : pool.blocks)
+            {
+                if (AllocateFromBlock(*block, requirements, offset))
+                {
+                    found = block.get();
+                    break;
+                }
+            }
+
+            // A new block may not fit in what's left of the heap, the request alone still might
+            void* mapped = nullptr;
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            if (found == nullptr && AllocateDeviceMemory(memoryType, blockSize, memory, mapped))
+            {
+                pool.blocks.push_back(std::make_unique<Block>(Block
+                {
+                    .pool = poolIndex,
+                    .memory = memory,
+                    .size = blockSize,
+                    .mapped = static_cast<uint8_t*>(mapped),
+                    .free = { Range{ 0, blockSize } },
+                }));
+                found = pool.blocks.back().get();
+                stats_.blockCount++;
+                stats_.reservedBytes += blockSize;
+                AllocateFromBlock(*found, requirements, offset);
+            }
+
+            if (found != nullptr)
+            {
+                allocation.memory = found->memory;
+                allocation.offset = offset;
+                allocation.mapped = found->mapped != nullptr ? found->mapped + offset : nullptr;
+                allocation.block = found;
+            }
+        }
+
+        if (allocation.block == nullptr)
+        {
+            if (!AllocateDeviceMemory(memoryType, requirements.size, allocation.memory, allocation.mapped))
+            {
+                throw std::runtime_error("failed to allocate device memory");
+            }
+            stats_.dedicatedCount++;
+            stats_.reservedBytes += requirements.size;
+            if (lazilyAllocated)
+            {
+                lazyMemory_.push_back(allocation.memory);
+                stats_.lazyBytes += requirements.size;
+            }
+        }
+
+        stats_.categories[category].allocationCount++;
+        stats_.categories[category].bytes += allocation.size;
+        stats_.usedBytes += allocation.size;
+        return allocation;
+    }
+
+    void Allocator::Free(Allocation& allocation)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        stats_.categories[allocation.category].allocationCount--;
+        stats_.categories[allocation.category].bytes -= allocation.size;
+        stats_.usedBytes -= allocation.size;
+
+        if (allocation.block == nullptr)
+        {
+            if (allocation.lazilyAllocated)
+            {
+                lazyMemory_.erase(std::find(lazyMemory_.begin(), lazyMemory_.end(), allocation.memory));
+                stats_.lazyBytes -= allocation.size;
+            }
+            vkFreeMemory(device_, allocation.memory, nullptr);
+            stats_.dedicatedCount--;
+            stats_.reservedBytes -= allocation.size;
+            allocation = {};
+            return;
+        }
+
+        Block& block = *allocation.block;
+        Pool& pool = pools_[block.pool];
+        FreeInBlock(block, allocation.offset, allocation.size);
+        allocation = {};
+
+        // One empty block per pool is kept around, so that a pool emptying & refilling doesn't thrash
+        if (block.allocationCount > 0) return;
+        const bool otherEmpty = std::any_of(pool.blocks.begin(), pool.blocks.end(), [&block](const std::unique_ptr<Block>& other)
+        {
+            return other.get() != &block && other->allocationCount == 0;
+        });
+        if (!otherEmpty) return;
+
+        vkFreeMemory(device_, block.memory, nullptr);
+        stats_.blockCount--;
+        stats_.reservedBytes -= block.size;
+        pool.blocks.erase(std::find_if(pool.blocks.begin(), pool.blocks.end(), [&block](const std::unique_ptr<Block>& other)
+        {
+            return other.get() == &block;
+        }));
+    }
+
+    const Stats Allocator::GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats = stats_;
+        for (VkDeviceMemory memory : lazyMemory_)
+        {
+            VkDeviceSize committed = 0;
+            vkGetDeviceMemoryCommitment(device_, memory, &committed);
+            stats.lazyCommittedBytes += committed;
+        }
+        return stats;
+    }
+
+    const uint32_t Allocator::FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const
+    {
+        for (uint32_t i = 0; i < memoryProperties_.memoryTypeCount; i++)
+        {
+            if ((typeBits & (1 << i)) && (memoryProperties_.memoryTypes[i].propertyFlags & properties) == properties)
+            {
+                return i;
+            }
+        }
+        return UINT32_MAX;
+    }
+
+    const uint32_t Allocator::PoolIndex(uint32_t memoryType, Tiling tiling) const
+    {
+        // Without a granularity to respect, linear & optimal resources can share blocks
+        const uint32_t tilingIndex = bufferImageGranularity_ > 1 && tiling == Tiling::Optimal ? 1 : 0;
+        return memoryType * TILING_COUNT + tilingIndex;
+    }
+
+    const VkDeviceSize Allocator::BlockSize(uint32_t memoryType) const
+    {
+        const VkDeviceSize heapSize = memoryProperties_.memoryHeaps[memoryProperties_.memoryTypes[memoryType].heapIndex].size;
+        return heapSize <= (1ull << 30) ? AlignUp(heapSize / 8, 1ull << 20) : BLOCK_SIZE;
+    }
+
+    const bool Allocator::AllocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, VkDeviceMemory& memory, void*& mapped)
+    {
+        if (stats_.blockCount + stats_.dedicatedCount >= maxDeviceAllocations_) return false;
+
+        VkMemoryAllocateInfo allocInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = size,
+            .memoryTypeIndex = memoryType,
+        };
+        if (vkAllocateMemory(device_, &allocInfo, nullptr, &memory) != VK_SUCCESS) return false;
+
+        mapped = nullptr;
+        if (memoryProperties_.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        {
+            if (vkMapMemory(device_, memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+            {
+                vkFreeMemory(device_, memory, nullptr);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const bool Allocator::AllocateFromBlock(Block& block, const VkMemoryRequirements& requirements, VkDeviceSize& offset)
+    {
+        // First fit, alignment padding in front stays a free range of its own
+        for (size_t i = 0; i < block.free.size(); i++)
+        {
+            const Range range = block.free[i];
+            const VkDeviceSize start = AlignUp(range.offset, requirements.alignment);
+            const VkDeviceSize end = start + requirements.size;
+            if (end > range.offset + range.size) continue;
+
+            block.free.erase(block.free.begin() + i);
+            if (end < range.offset + range.size)
+            {
+                block.free.insert(block.free.begin() + i, Range{ end, range.offset + range.size - end });
+            }
+            if (start > range.offset)
+            {
+                block.free.insert(block.free.begin() + i, Range{ range.offset, start - range.offset });
+            }
+
+            offset = start;
+            block.allocationCount++;
+            return true;
+        }
+        return false;
+    }
+
+    void Allocator::FreeInBlock(Block& block, VkDeviceSize offset, VkDeviceSize size)
+    {
+        block.allocationCount--;
+
+        // Insert in offset order, merging with the neighbouring free ranges
+        auto next = std::lower_bound(block.free.begin(), block.free.end(), offset, [](const Range& range, VkDeviceSize value)
+        {
+            return range.offset < value;
+        });
+        Range freed{ offset, size };
+        if (next != block.free.end() && freed.offset + freed.size == next->offset)
+        {
+            freed.size += next->size;
+            next = block.free.erase(next);
+        }
+        if (next != block.free.begin())
+        {
+            auto previous = std::prev(next);
+            if (previous->offset + previous->size == freed.offset)
+            {
+                previous->size += freed.size;
+                return;
+            }
+        }
+        block.free.insert(next, freed);
+    }
+
+    void Free(Allocation& allocation)
+    {
+        if (allocation.allocator != nullptr) allocation.allocator->Free(allocation);
+    }
+}
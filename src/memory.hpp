@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+namespace Memory
+{
+    // What an allocation backs, for usage statistics. Transient attachments, whose contents never outlive a
+    // render pass, get lazily allocated memory of their own where the device has it.
+    enum Category
+    {
+        Textures = 0,
+        Geometry,
+        Uniforms,
+        Staging,
+        Attachments,
+        Transient,
+        CategoryCount,
+    };
+    inline constexpr std::array<const char*, CategoryCount> CategoryNames =
+    {
+        "textures",
+        "geometry",
+        "uniforms",
+        "staging",
+        "attachments",
+        "transient",
+    };
+
+    // Linear resources are buffers & linearly tiled images, bufferImageGranularity applies between the two kinds
+    enum class Tiling { Linear, Optimal };
+
+    class Allocator;
+    struct Block;
+
+    // A range of device memory to bind a resource at. Host visible allocations stay mapped for their lifetime.
+    struct Allocation
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        void* mapped = nullptr;
+
+        Allocator* allocator = nullptr;
+        Block* block = nullptr; // Null for a dedicated allocation
+        Category category = Textures;
+        bool lazilyAllocated = false; // Always dedicated, committed by the device only as needed
+    };
+
+    struct CategoryStats
+    {
+        uint32_t allocationCount = 0;
+        VkDeviceSize bytes = 0;
+    };
+
+    struct Stats
+    {
+        std::array<CategoryStats, CategoryCount> categories{};
+        uint32_t blockCount = 0;
+        uint32_t dedicatedCount = 0;
+        VkDeviceSize reservedBytes = 0; // Allocated from the device, blocks & dedicated allocations
+        VkDeviceSize usedBytes = 0; // Handed out, alignment padding aside
+        uint32_t maxDeviceAllocations = 0; // maxMemoryAllocationCount, to compare blocks & dedicated ones against
+        VkDeviceSize lazyBytes = 0; // Of reservedBytes, in lazily allocated memory
+        VkDeviceSize lazyCommittedBytes = 0; // Of lazyBytes, what the device has actually backed so far
+    };
+
+    // Sub-allocates buffer & image memory from large blocks, so that a scene costs a handful of vkAllocateMemory
+    // calls rather than one per resource. Each memory type has its own pools of free-list blocks, where freed
+    // ranges merge with their neighbours for reuse. Linear & optimal resources only share blocks if the device's
+    // bufferImageGranularity is 1. Large requests get a dedicated allocation, as do transient attachments in
+    // lazily allocated memory; so does the upload staging ring, which sub-allocates itself. Host visible blocks
+    // are mapped persistently, as memory can only be mapped once. Thread safe.
+    class Allocator
+    {
+    public:
+        Allocator(const VkPhysicalDevice& physicalDevice, const VkDevice& device);
+        // Frees all device memory, reporting allocations still live
+        ~Allocator();
+
+        Allocator(const Allocator&) = delete;
+        Allocator& operator=(const Allocator&) = delete;
+
+        const Allocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, Tiling tiling, Category category);
+        void Free(Allocation& allocation);
+
+        // Queries the device for the lazily allocated memory committed
+        const Stats GetStats() const;
+
+    private:
+        struct Pool
+        {
+            uint32_t memoryType;
+            std::vector<std::unique_ptr<Block>> blocks;
+        };
+
+        // First memory type of typeBits with properties, UINT32_MAX if none
+        const uint32_t FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const;
+        // Pools of a memory type, by tiling
+        const uint32_t PoolIndex(uint32_t memoryType, Tiling tiling) const;
+        const VkDeviceSize BlockSize(uint32_t memoryType) const;
+        const bool AllocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, VkDeviceMemory& memory, void*& mapped);
+        const bool AllocateFromBlock(Block& block, const VkMemoryRequirements& requirements, VkDeviceSize& offset);
+        void FreeInBlock(Block& block, VkDeviceSize offset, VkDeviceSize size);
+
+        const VkDevice device_;
+        VkPhysicalDeviceMemoryProperties memoryProperties_;
+        VkDeviceSize bufferImageGranularity_;
+        uint32_t maxDeviceAllocations_;
+
+        mutable std::mutex mutex_;
+        std::vector<Pool> pools_;
+        std::vector<VkDeviceMemory> lazyMemory_;
+        Stats stats_;
+    };
+
+    // Returns an allocation to its allocator, if it has one, & resets it
+    void Free(Allocation& allocation);
+}
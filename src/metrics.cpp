@@ -0,0 +1,171 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "profiler.hpp"
+
+namespace Metrics
+{
+    MetricsSink::MetricsSink(const std::string& path)
+        : path_(path)
+        , csv_(path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0)
+        , file_(path, std::ios::trunc)
+    {
+        if (!file_.is_open())
+        {
+            throw std::runtime_error("failed to open metrics file: " + path);
+        }
+        if (csv_)
+        {
+            file_ << "kind,frame,render_frame,host_time_ns,cpu_ms,gpu_ms,late_ms,missed_slots,input_to_submit_ms,input_to_gpu_done_ms,input_to_present_ms,vertex_invocations,clipping_invocations,clipping_primitives,fragment_invocations,grid_x,grid_y,overdraw_deg,vrs_mode\n";
+        }
+
+        queue_.reserve(256);
+        writer_ = std::thread(&MetricsSink::WriterLoop, this);
+
+        std::cout << "Writing frame metrics to " << path << std::endl;
+    }
+
+    MetricsSink::~MetricsSink()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
+
+        WriteSummary();
+    }
+
+    void MetricsSink::Push(const FrameRecord& record)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(record);
+        }
+        pushed_++;
+        wake_.notify_one();
+    }
+
+    void MetricsSink::WriterLoop()
+    {
+        Profiler::CpuProfiler::SetThreadName("metrics writer");
+
+        std::vector<FrameRecord> batch;
+        batch.reserve(256);
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                if (queue_.empty() && stopping_) break;
+                // Swap rather than copy, the producer keeps appending into the old batch's storage
+                std::swap(batch, queue_);
+            }
+
+            PROFILE_ZONE("write metrics");
+            for (const FrameRecord& record : batch)
+            {
+                WriteRecord(record);
+            }
+            batch.clear();
+            file_.flush();
+        }
+    }
+
+    void MetricsSink::WriteRecord(const FrameRecord& record)
+    {
+        const bool warp = record.kind == FrameKind::Warp;
+        if (warp)
+        {
+            warpCpuMs_.push_back(record.cpuMs);
+            warpGpuMs_.push_back(record.gpuMs);
+            warpLateMs_.push_back(record.lateMs);
+            if (record.inputToSubmitMs >= 0) warpInputToSubmitMs_.push_back(record.inputToSubmitMs);
+            if (record.inputToGpuDoneMs >= 0) warpInputToGpuDoneMs_.push_back(record.inputToGpuDoneMs);
+            if (record.inputToPresentMs >= 0) warpInputToPresentMs_.push_back(record.inputToPresentMs);
+            if (record.missedSlots) lateWarps_++;
+            missedWarpSlots_ += record.missedSlots;
+            warpFragmentInvocations_.push_back(static_cast<float>(record.fragmentInvocations));
+        }
+        else
+        {
+            renderCpuMs_.push_back(record.cpuMs);
+            renderGpuMs_.push_back(record.gpuMs);
+            renderFragmentInvocations_.push_back(static_cast<float>(record.fragmentInvocations));
+        }
+
+        if (csv_)
+        {
+            file_ << (warp ? "warp" : "render") << ',' << record.frameId << ',' << record.renderFrameId << ',' << record.hostTimeNs << ','
+                << record.cpuMs << ',' << record.gpuMs << ',' << record.lateMs << ',' << record.missedSlots << ','
+                << record.inputToSubmitMs << ',' << record.inputToGpuDoneMs << ',' << record.inputToPresentMs << ','
+                << record.vertexInvocations << ',' << record.clippingInvocations << ',' << record.clippingPrimitives << ',' << record.fragmentInvocations << ','
+                << record.gridResolutionX << ',' << record.gridResolutionY << ',' << record.overdrawDegrees << ',' << record.variableRateShadingMode << '\n';
+        }
+        else
+        {
+            file_ << "{\"kind\":\"" << (warp ? "warp" : "render") << "\",\"frame\":" << record.frameId << ",\"render_frame\":" << record.renderFrameId
+                << ",\"host_time_ns\":" << record.hostTimeNs << ",\"cpu_ms\":" << record.cpuMs << ",\"gpu_ms\":" << record.gpuMs;
+            if (warp)
+            {
+                file_ << ",\"late_ms\":" << record.lateMs << ",\"missed_slots\":" << record.missedSlots;
+                if (record.inputToSubmitMs >= 0) file_ << ",\"input_to_submit_ms\":" << record.inputToSubmitMs;
+                if (record.inputToGpuDoneMs >= 0) file_ << ",\"input_to_gpu_done_ms\":" << record.inputToGpuDoneMs;
+                if (record.inputToPresentMs >= 0) file_ << ",\"input_to_present_ms\":" << record.inputToPresentMs;
+            }
+            file_ << ",\"vertex_invocations\":" << record.vertexInvocations << ",\"clipping_invocations\":" << record.clippingInvocations
+                << ",\"clipping_primitives\":" << record.clippingPrimitives << ",\"fragment_invocations\":" << record.fragmentInvocations;
+            file_ << ",\"grid\":[" << record.gridResolutionX << ',' << record.gridResolutionY << "],\"overdraw_deg\":" << record.overdrawDegrees
+                << ",\"vrs_mode\":\"" << record.variableRateShadingMode << "\"}\n";
+        }
+    }
+
+    void MetricsSink::WriteSummary()
+    {
+        const std::string summaryPath = path_ + ".summary.json";
+        std::ofstream summary(summaryPath, std::ios::trunc);
+        if (!summary.is_open())
+        {
+            std::cout << "Failed to open metrics summary file " << summaryPath << std::endl;
+            return;
+        }
+
+        const auto percentile = [](std::vector<float>& values, float p)
+        {
+            const size_t rank = std::clamp<size_t>(static_cast<size_t>(p / 100.0f * values.size() + 0.999f), 1, values.size()) - 1;
+            std::nth_element(values.begin(), values.begin() + rank, values.end());
+            return values[rank];
+        };
+        const auto writeDistribution = [&](const char* name, std::vector<float>& values, bool last)
+        {
+            summary << "  \"" << name << "\": {\"count\": " << values.size();
+            if (!values.empty())
+            {
+                summary << ", \"p50\": " << percentile(values, 50.0f) << ", \"p90\": " << percentile(values, 90.0f)
+                    << ", \"p99\": " << percentile(values, 99.0f) << ", \"max\": " << *std::max_element(values.begin(), values.end());
+            }
+            summary << "}" << (last ? "\n" : ",\n");
+        };
+
+        summary << "{\n";
+        writeDistribution("render_cpu_ms", renderCpuMs_, false);
+        writeDistribution("render_gpu_ms", renderGpuMs_, false);
+        writeDistribution("warp_cpu_ms", warpCpuMs_, false);
+        writeDistribution("warp_gpu_ms", warpGpuMs_, false);
+        writeDistribution("warp_late_ms", warpLateMs_, false);
+        writeDistribution("warp_input_to_submit_ms", warpInputToSubmitMs_, false);
+        writeDistribution("warp_input_to_gpu_done_ms", warpInputToGpuDoneMs_, false);
+        writeDistribution("warp_input_to_present_ms", warpInputToPresentMs_, false);
+        writeDistribution("render_fragment_invocations", renderFragmentInvocations_, false);
+        writeDistribution("warp_fragment_invocations", warpFragmentInvocations_, false);
+        summary << "  \"late_warps\": " << lateWarps_ << ",\n";
+        summary << "  \"missed_warp_slots\": " << missedWarpSlots_ << "\n";
+        summary << "}\n";
+
+        std::cout << "Wrote metrics summary to " << summaryPath << std::endl;
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Metrics
+{
+    enum class FrameKind { Render, Warp };
+
+    // One completed render or warp frame, pushed once its GPU timing, and for warp frames its present, is known
+    struct FrameRecord
+    {
+        FrameKind kind;
+        uint64_t frameId;
+        uint64_t renderFrameId; // Render frame sampled by a warp frame, the frame itself for render frames
+        uint64_t hostTimeNs; // Profiler clock at CPU start of the frame
+        float cpuMs;
+        float gpuMs;
+
+        // Warp only
+        float lateMs; // How far past its scheduled slot the warp started
+        uint32_t missedSlots; // Whole warp intervals the warp fell behind by
+        // Motion-to-photon stages from the oldest input that fed the warp's pose, negative if unknown
+        float inputToSubmitMs;
+        float inputToGpuDoneMs;
+        float inputToPresentMs;
+
+        // Pipeline statistics for the scene draws / warp grid, all 0 if unsupported
+        uint64_t vertexInvocations;
+        uint64_t clippingInvocations;
+        uint64_t clippingPrimitives;
+        uint64_t fragmentInvocations;
+
+        // Active settings
+        int32_t gridResolutionX;
+        int32_t gridResolutionY;
+        float overdrawDegrees;
+        const char* variableRateShadingMode;
+    };
+
+    // Appends frame records to a CSV (".csv") or JSON lines (anything else) file from a background
+    // thread, so the render & warp threads only ever take a short lock to push. A percentile summary is
+    // written next to the file as "<path>.summary.json" on destruction.
+    class MetricsSink
+    {
+    public:
+        MetricsSink(const std::string& path);
+        ~MetricsSink();
+
+        MetricsSink(const MetricsSink&) = delete;
+        MetricsSink& operator=(const MetricsSink&) = delete;
+
+        void Push(const FrameRecord& record);
+        const uint64_t GetRecordCount() const { return pushed_; }
+
+    private:
+        void WriterLoop();
+        void WriteRecord(const FrameRecord& record);
+        void WriteSummary();
+
+        std::string path_;
+        bool csv_;
+        std::ofstream file_;
+
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::vector<FrameRecord> queue_;
+        bool stopping_ = false;
+        std::atomic<uint64_t> pushed_ = 0;
+
+        std::thread writer_;
+
+        // Owned by the writer thread, full-run samples for the summary
+        std::vector<float> renderCpuMs_;
+        std::vector<float> renderGpuMs_;
+        std::vector<float> warpCpuMs_;
+        std::vector<float> warpGpuMs_;
+        std::vector<float> warpLateMs_;
+        std::vector<float> warpInputToSubmitMs_;
+        std::vector<float> warpInputToGpuDoneMs_;
+        std::vector<float> warpInputToPresentMs_;
+        std::vector<float> renderFragmentInvocations_;
+        std::vector<float> warpFragmentInvocations_;
+        uint64_t lateWarps_ = 0;
+        uint64_t missedWarpSlots_ = 0;
+    };
+}
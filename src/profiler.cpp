@@ -0,0 +1,177 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+namespace Profiler
+{
+    std::unique_ptr<Event[]> CpuProfiler::events_;
+    size_t CpuProfiler::capacity_ = 0;
+    std::atomic<uint64_t> CpuProfiler::writeIndex_ = 0;
+    std::atomic<uint32_t> CpuProfiler::threadCount_ = 0;
+    std::mutex CpuProfiler::namesMutex_;
+    std::vector<std::string> CpuProfiler::threadNames_;
+    std::vector<std::string> CpuProfiler::gpuTrackNames_;
+
+    void CpuProfiler::Init(size_t capacity)
+    {
+        events_ = std::make_unique<Event[]>(capacity);
+        capacity_ = capacity;
+        writeIndex_ = 0;
+    }
+
+    const uint64_t CpuProfiler::Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    const uint64_t CpuProfiler::FromHostCounter(uint64_t counter)
+    {
+#ifdef _WIN32
+        // steady_clock scales the performance counter the same way, whole seconds split off against overflow
+        static const uint64_t frequency = []
+        {
+            LARGE_INTEGER value;
+            QueryPerformanceFrequency(&value);
+            return static_cast<uint64_t>(value.QuadPart);
+        }();
+        return counter / frequency * 1'000'000'000ull + counter % frequency * 1'000'000'000ull / frequency;
+#else
+        // steady_clock reads CLOCK_MONOTONIC in nanoseconds
+        return counter;
+#endif
+    }
+
+    void CpuProfiler::Record(const char* name, uint64_t startNs, uint64_t endNs)
+    {
+        Push(name, startNs, endNs, ThreadId());
+    }
+
+    void CpuProfiler::RecordGpu(uint32_t track, const char* name, uint64_t startNs, uint64_t endNs)
+    {
+        Push(name, startNs, endNs, track | GPU_TRACK_BIT);
+    }
+
+    void CpuProfiler::Push(const char* name, uint64_t startNs, uint64_t endNs, uint32_t threadId)
+    {
+        if (capacity_ == 0) return;
+
+        // Claim a slot, then publish it by writing its sequence last
+        const uint64_t index = writeIndex_.fetch_add(1, std::memory_order_relaxed);
+        Event& event = events_[index % capacity_];
+        event.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        event.name = name;
+        event.startNs = startNs;
+        event.endNs = endNs;
+        event.threadId = threadId;
+        event.sequence.store(index + 1, std::memory_order_release);
+    }
+
+    const uint32_t CpuProfiler::ThreadId()
+    {
+        thread_local const uint32_t id = threadCount_.fetch_add(1);
+        return id;
+    }
+
+    void CpuProfiler::SetThreadName(const char* name)
+    {
+        const uint32_t id = ThreadId();
+        std::lock_guard<std::mutex> lock(namesMutex_);
+        if (threadNames_.size() <= id) threadNames_.resize(id + 1);
+        threadNames_[id] = name;
+    }
+
+    const uint32_t CpuProfiler::RegisterGpuTrack(const char* name)
+    {
+        std::lock_guard<std::mutex> lock(namesMutex_);
+        gpuTrackNames_.push_back(name);
+        return gpuTrackNames_.size() - 1;
+    }
+
+    void CpuProfiler::WriteChromeTrace(const std::string& path)
+    {
+        std::ofstream file(path, std::ios::trunc);
+        if (!file.is_open())
+        {
+            throw std::runtime_error("failed to open trace file: " + path);
+        }
+
+        struct Snapshot
+        {
+            const char* name;
+            uint64_t startNs;
+            uint64_t endNs;
+            uint32_t threadId;
+        };
+
+        // Copy out complete events; slots mid-write or reused by a newer event while copying are skipped
+        const uint64_t end = writeIndex_.load(std::memory_order_acquire);
+        const uint64_t begin = end > capacity_ ? end - capacity_ : 0;
+        std::vector<Snapshot> snapshots;
+        snapshots.reserve(end - begin);
+        for (uint64_t i = begin; i < end; i++)
+        {
+            const Event& event = events_[i % capacity_];
+            if (event.sequence.load(std::memory_order_acquire) != i + 1) continue;
+            Snapshot snapshot { event.name, event.startNs, event.endNs, event.threadId };
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (event.sequence.load(std::memory_order_relaxed) != i + 1) continue;
+            snapshots.push_back(snapshot);
+        }
+
+        // Timestamps are written relative to the oldest event so they stay readable as microseconds
+        uint64_t originNs = UINT64_MAX;
+        for (const Snapshot& event : snapshots) originNs = std::min(originNs, event.startNs);
+
+        const auto escape = [](const std::string& str)
+        {
+            std::string out;
+            for (char c : str)
+            {
+                if (c == '"' || c == '\\') out += '\\';
+                out += c;
+            }
+            return out;
+        };
+
+        // CPU threads go under pid 0, GPU queues under pid 1 with one track per timer
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+        file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+        {
+            std::lock_guard<std::mutex> lock(namesMutex_);
+            for (uint32_t i = 0; i < threadNames_.size(); i++)
+            {
+                if (threadNames_[i].empty()) continue;
+                file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << i << ",\"args\":{\"name\":\"" << escape(threadNames_[i]) << "\"}}";
+            }
+            for (uint32_t i = 0; i < gpuTrackNames_.size(); i++)
+            {
+                file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\"" << escape(gpuTrackNames_[i]) << "\"}}";
+            }
+        }
+
+        for (const Snapshot& event : snapshots)
+        {
+            const bool gpu = event.threadId & GPU_TRACK_BIT;
+            const int64_t startNs = static_cast<int64_t>(event.startNs - originNs);
+            file << ",\n{\"name\":\"" << escape(event.name) << "\",\"cat\":\"" << (gpu ? "gpu" : "cpu") << "\",\"ph\":\"X\""
+                << ",\"pid\":" << (gpu ? 1 : 0) << ",\"tid\":" << (event.threadId & ~GPU_TRACK_BIT)
+                << ",\"ts\":" << startNs / 1000.0 << ",\"dur\":" << (event.endNs - event.startNs) / 1000.0 << "}";
+        }
+        file << "\n]}\n";
+
+        std::cout << "Wrote " << snapshots.size() << " trace events to " << path << std::endl;
+    }
+}
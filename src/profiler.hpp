@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+
+// Times the enclosing block as a CPU zone on the calling thread
+#define PROFILE_ZONE(name) Profiler::Zone PROFILER_CONCAT(profileZone_, __LINE__)(name)
+
+namespace Profiler
+{
+    // Names are stored by pointer and must outlive the profiler, in practice string literals
+    struct Event
+    {
+        const char* name;
+        uint64_t startNs;
+        uint64_t endNs;
+        uint32_t threadId; // Small sequential CPU thread id, or GPU track id with GPU_TRACK_BIT set
+        std::atomic<uint64_t> sequence; // Write index + 1 once the event is complete, 0 while being written
+    };
+
+    constexpr uint32_t GPU_TRACK_BIT = 0x80000000u;
+
+    // Lock-free ring of recent CPU zones and GPU scopes on a shared host clock
+    class CpuProfiler
+    {
+    public:
+        static void Init(size_t capacity = 1 << 16);
+
+        // Host clock shared by CPU zones and calibrated GPU timestamps, nanoseconds
+        static const uint64_t Now();
+        // Converts a raw reading of the OS counter Now() is built on, QueryPerformanceCounter on Windows and
+        // CLOCK_MONOTONIC elsewhere, e.g. a host timestamp calibrated against the GPU
+        static const uint64_t FromHostCounter(uint64_t counter);
+
+        static void Record(const char* name, uint64_t startNs, uint64_t endNs);
+        static void RecordGpu(uint32_t track, const char* name, uint64_t startNs, uint64_t endNs);
+
+        static const uint32_t ThreadId();
+        static void SetThreadName(const char* name);
+        static const uint32_t RegisterGpuTrack(const char* name);
+
+        // Dumps the events currently in the ring in Chrome trace_event JSON format
+        static void WriteChromeTrace(const std::string& path);
+
+    private:
+        CpuProfiler() {}
+
+        static void Push(const char* name, uint64_t startNs, uint64_t endNs, uint32_t threadId);
+
+        static std::unique_ptr<Event[]> events_;
+        static size_t capacity_;
+        static std::atomic<uint64_t> writeIndex_;
+        static std::atomic<uint32_t> threadCount_;
+
+        // Track names, indexed by thread id / GPU track id. Written rarely, under a lock.
+        static std::mutex namesMutex_;
+        static std::vector<std::string> threadNames_;
+        static std::vector<std::string> gpuTrackNames_;
+    };
+
+    class Zone
+    {
+    public:
+        Zone(const char* name) : name_(name), startNs_(CpuProfiler::Now()) {}
+        ~Zone() { CpuProfiler::Record(name_, startNs_, CpuProfiler::Now()); }
+
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+    private:
+        const char* name_;
+        uint64_t startNs_;
+    };
+}
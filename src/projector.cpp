@@ -3,52 +3,133 @@
 #include <chrono>
 #include <thread>
 #include <limits>
+#include <numeric>
 
 #include <stb_image.h>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/projection.hpp>
 #include <glm/gtx/euler_angles.hpp>
 
+#include "profiler.hpp"
 #include "scene.hpp"
 
 namespace Projector
 {
-    Projector::Projector()
+    // The device & host clocks drift apart over a long run, GPU timestamps are re-paired with the host this often
+    constexpr uint64_t GPU_CLOCK_RECALIBRATION_NS = 10'000'000'000ull;
+    // Calibration reads per pairing, the one with the smallest deviation is kept
+    constexpr uint32_t GPU_CLOCK_CALIBRATION_SAMPLES = 8;
+
+    Projector::Projector(const LaunchOptions& options)
+        : headless_(options.headless)
+        , streamTextures_(options.streamTextures)
+        , vertexLayout_(options.vertexLayout)
+        , benchmarkFrames_(options.benchmarkFrames)
+        , tracePath_(options.tracePath)
     {
         assert(MAX_FRAMES_IN_FLIGHT > 1);
 
-        if (!glfwInit())
+        Profiler::CpuProfiler::Init();
+        Profiler::CpuProfiler::SetThreadName("main");
+
+        if (headless_)
+        {
+            swapChainExtent_ = options.headlessExtent;
+            std::cout << "Running headless at " << swapChainExtent_.width << "x" << swapChainExtent_.height << std::endl;
+        }
+        else if (!glfwInit())
         {
             throw std::runtime_error("failed to initialize glfw");
         }
 
         CreateInstance();
-        CreateSurface();
+        if (!headless_) CreateSurface();
 
         PickPhysicalDevice();
         CreateLogicalDevice();
+        allocator_ = std::make_unique<Memory::Allocator>(physicalDevice_, device_);
+        // The render, warp & input threads keep cores of their own
+        jobs_ = std::make_unique<Jobs::JobSystem>(std::max(std::thread::hardware_concurrency(), 4u) - 2, "job");
+        // Past a handful of secondary command buffers their overhead outweighs the recording saved
+        recordChunkCount_ = std::min(jobs_->GetThreadCount(), 8u);
         CreateCommandPool();
-        CreateQueryPool();
 
-        renderTimer_.Init(device_, physicalDevice_, MAX_FRAMES_IN_FLIGHT, 200);
-        warpTimer_.Init(device_, physicalDevice_, 1, 200);
+        renderTimer_.Init(device_, physicalDevice_, "render", hostQueryResetSupported_, MAX_FRAMES_IN_FLIGHT, 200);
+        warpTimer_.Init(device_, physicalDevice_, "warp", hostQueryResetSupported_, 1, 200);
+        renderPipelineStats_.Init(device_, pipelineStatisticsSupported_, hostQueryResetSupported_, MAX_FRAMES_IN_FLIGHT, 200);
+        warpPipelineStats_.Init(device_, pipelineStatisticsSupported_, hostQueryResetSupported_, 1, 200);
+        renderStats_.timerScopes = renderTimer_.GetScopes();
+        renderPipelineStats_.SetFrameCompletedCallback([this](uint64_t frameId, const std::array<uint64_t, PipelineStatsQuery::CounterCount>& counters)
+        {
+            StageFrameStatistics(Metrics::FrameKind::Render, frameId, counters);
+        });
+        warpPipelineStats_.SetFrameCompletedCallback([this](uint64_t frameId, const std::array<uint64_t, PipelineStatsQuery::CounterCount>& counters)
+        {
+            StageFrameStatistics(Metrics::FrameKind::Warp, frameId, counters);
+        });
+        renderTimer_.SetFrameCompletedCallback([this](uint64_t frameId, float timeMs, uint64_t endHostNs)
+        {
+            CompleteFrameRecord(Metrics::FrameKind::Render, frameId, timeMs, -1.0f);
+        });
+        warpTimer_.SetFrameCompletedCallback([this](uint64_t frameId, float timeMs, uint64_t endHostNs)
+        {
+            const float inputToGpuDoneMs = latencyTracker_.FrameGpuDone(frameId, endHostNs);
+            // Offscreen, the warped target is final once the warp's GPU work is done, so that stands in for the present
+            if (headless_) PresentFrameRecord(frameId, inputToGpuDoneMs >= 0 ? latencyTracker_.FramePresented(frameId, endHostNs) : -1.0f);
+            CompleteFrameRecord(Metrics::FrameKind::Warp, frameId, timeMs, inputToGpuDoneMs);
+        });
+        CalibrateGpuClock();
 
-        Input::InputHandler::Init(window_);
+        if (!headless_) Input::InputHandler::Init(window_);
+        if (!options.recordPath.empty()) poseRecorder_ = std::make_unique<Input::PoseRecorder>(options.recordPath);
+        if (!options.replayPath.empty()) posePlayback_ = std::make_unique<Input::PosePlayback>(options.replayPath);
+        if (!headless_ && !posePlayback_) poseTracker_ = std::make_unique<Input::PoseTracker>(playerWarp_.position, playerWarp_.rotation, options.inputRate);
+        if (!options.metricsPath.empty()) metricsSink_ = std::make_unique<Metrics::MetricsSink>(options.metricsPath);
 
+        if (streamTextures_ && streamQueue_ == VK_NULL_HANDLE)
+        {
+            std::cout << "No spare graphics queue for texture streaming, loading textures up front" << std::endl;
+        }
+        {
+            const QueueFamilyIndices queueFamilies = FindQueueFamilies(physicalDevice_);
+            const uint32_t graphicsFamily = queueFamilies.graphicsFamily.value();
+            const uint32_t transferFamily = queueFamilies.transferFamily.value_or(VK_QUEUE_FAMILY_IGNORED);
+            if (streamQueue_ != VK_NULL_HANDLE)
+            {
+                uploads_ = std::make_unique<Upload::UploadContext>(physicalDevice_, device_, *allocator_, graphicsQueue_, graphicsFamily);
+                streamUploads_ = std::make_unique<Upload::UploadContext>(physicalDevice_, device_, *allocator_, streamQueue_, graphicsFamily, transferQueue_, transferFamily);
+                if (transferQueue_ != VK_NULL_HANDLE) std::cout << "Streaming textures through the dedicated transfer queue family " << transferFamily << std::endl;
+            }
+            else
+            {
+                uploads_ = std::make_unique<Upload::UploadContext>(physicalDevice_, device_, *allocator_, graphicsQueue_, graphicsFamily, transferQueue_, transferFamily);
+                if (transferQueue_ != VK_NULL_HANDLE) std::cout << "Uploading scene through the dedicated transfer queue family " << transferFamily << std::endl;
+            }
+        }
+        const uint64_t sceneLoadStartNs = Profiler::CpuProfiler::Now();
         scene_ = new Scene::Model(
             "res/sponza/Sponza.gltf",
             //"res/abeautifulgame/ABeautifulGame.gltf",
             physicalDevice_,
             device_,
-            commandPool_,
-            graphicsQueue_,
-            1.0f
+            *uploads_,
+            *jobs_,
+            1.0f,
+            vertexLayout_,
+            streamUploads_.get()
         );
+        std::cout << "Loaded scene in " << (Profiler::CpuProfiler::Now() - sceneLoadStartNs) / 1'000'000 << " ms" << std::endl;
+        {
+            const Memory::Stats memoryStats = allocator_->GetStats();
+            std::cout << "Scene memory: " << memoryStats.usedBytes / (1024 * 1024) << " MiB in " << memoryStats.blockCount << " blocks & "
+                << memoryStats.dedicatedCount << " dedicated allocations" << std::endl;
+        }
 
         CreateUniformBuffers();
 
+        UpdateProjectionParameters();
         RecreateSwapChain();
-        InitImGui();
+        if (!headless_) InitImGui();
 
         CreateCommandBuffers();
         CreateSyncObjects();
@@ -56,14 +137,23 @@ namespace Projector
 
     Projector::~Projector()
     {
-        ImGui_ImplVulkan_Shutdown();
-        ImGui_ImplGlfw_Shutdown();
-        ImGui::DestroyContext();
-        vkDestroyDescriptorPool(device_, imguiPool_, nullptr);
+        // Run unwinding from an exception on this thread leaves the render thread going
+        StopRenderThread();
+        poseTracker_.reset();
+
+        if (!headless_)
+        {
+            ImGui_ImplVulkan_Shutdown();
+            ImGui_ImplGlfw_Shutdown();
+            ImGui::DestroyContext();
+            vkDestroyDescriptorPool(device_, imguiPool_, nullptr);
+        }
 
         CleanupSwapChain();
 
         delete scene_;
+        streamUploads_.reset();
+        uploads_.reset();
 
         vkDestroyPipeline(device_, graphicsPipeline_, nullptr);
         vkDestroyPipelineLayout(device_, pipelineLayout_, nullptr);
@@ -72,10 +162,10 @@ namespace Projector
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
         {
             vkDestroyBuffer(device_, uniformBuffers_[i], nullptr);
-            vkFreeMemory(device_, uniformBuffersMemory_[i], nullptr);
+            Memory::Free(uniformBuffersMemory_[i]);
         }
         vkDestroyBuffer(device_, warpUniformBuffer_, nullptr);
-        vkFreeMemory(device_, warpUniformBufferMemory_, nullptr);
+        Memory::Free(warpUniformBufferMemory_);
 
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
         {
@@ -83,57 +173,99 @@ namespace Projector
         }
         vkDestroySemaphore(device_, imageAvailableSemaphore_, nullptr);
         vkDestroySemaphore(device_, renderReadySemaphore_, nullptr);
+        vkDestroySemaphore(device_, warpDoneSemaphore_, nullptr);
         vkDestroySemaphore(device_, warpFinishedSemaphore_, nullptr);
         vkDestroyFence(device_, warpInFlightFence_, nullptr);
 
+        renderTimer_.Destroy();
+        warpTimer_.Destroy();
+        renderPipelineStats_.Destroy();
+        warpPipelineStats_.Destroy();
+
         vkDestroyCommandPool(device_, commandPool_, nullptr);
+        vkDestroyCommandPool(device_, renderCommandPool_, nullptr);
+        for (VkCommandPool pool : recordCommandPools_)
+        {
+            vkDestroyCommandPool(device_, pool, nullptr);
+        }
+        allocator_.reset();
         vkDestroyDevice(device_, nullptr);
 
-        vkDestroySurfaceKHR(vk_, surface_, nullptr);
+        if (surface_ != VK_NULL_HANDLE) vkDestroySurfaceKHR(vk_, surface_, nullptr);
         vkDestroyInstance(vk_, nullptr);
 
-        glfwDestroyWindow(window_);
-        glfwTerminate();
+        if (!headless_)
+        {
+            glfwDestroyWindow(window_);
+            glfwTerminate();
+        }
 
         std::cout << "Cleaned up" << std::endl; 
     }
 
     void Projector::Run()
     {
-        static auto lastRefresh = std::chrono::high_resolution_clock::now();
-        static float tillRender = 0;
-        static float tillWarp = 0;
-
-        while (!glfwWindowShouldClose(window_))
+        if (headless_)
         {
-            const auto currentTime = std::chrono::high_resolution_clock::now();
-            const float deltaTime = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - lastRefresh).count();
-            lastRefresh = currentTime;
+            RunHeadless();
+            return;
+        }
 
-            tillRender -= deltaTime;
-            tillWarp -= deltaTime;
+        // This thread warps & presents on its own cadence, rendering happens in RenderLoop
+        PublishRenderInputs();
+        renderThread_ = std::thread(&Projector::RenderLoop, this);
 
-            if (tillRender < 0 || tillWarp < 0)
+        // Handle window events while sleeping, so cursor movement reaches the input thread as it happens
+        scheduler_.SetSleepFunction([](uint64_t durationNs) { glfwWaitEventsTimeout(durationNs / 1e9); });
+
+        uint64_t waitedSerial = 0;
+        while (!glfwWindowShouldClose(window_) && !renderFailed_)
+        {
+            float lateMs = 0.0f;
+            uint32_t missedSlots = 0;
+            uint64_t targetNs = 0;
+            if (doAsyncWarp_)
             {
-                glfwPollEvents();
+                scheduler_.SetRate(Scheduler::Warp, warpFramerate_);
+                scheduler_.SetPhaseAlignment(alignWarpToRender_, warpPhase_);
+                const Scheduler::Tick tick = scheduler_.WaitForNextDeadline();
+                if (!tick.due[Scheduler::Warp]) continue;
+                lateMs = tick.lateMs[Scheduler::Warp];
+                missedSlots = tick.missedSlots[Scheduler::Warp];
+                targetNs = tick.deadlineNs[Scheduler::Warp];
+            }
+            else
+            {
+                // Without async warp, every render frame is warped & presented as soon as it's submitted; the render
+                // thread posts an empty event to wake this up. Time out after a render interval so the overlay stays
+                // responsive with rendering off.
+                PROFILE_ZONE("wait render");
+                const uint64_t timeoutNs = Profiler::CpuProfiler::Now() + 1'000'000'000ull / std::max(renderFramerate_, 1);
+                uint64_t nowNs;
+                while (renderSubmittedSerial_ == waitedSerial && (nowNs = Profiler::CpuProfiler::Now()) < timeoutNs)
+                {
+                    glfwWaitEventsTimeout((timeoutNs - nowNs) / 1e9);
+                }
+                waitedSerial = renderSubmittedSerial_;
+                targetNs = Profiler::CpuProfiler::Now();
+            }
 
-                bool rendering = tillRender < 0;
-                bool warping = tillWarp < 0;
+            PollPresentCompletion();
 
-                FrameStats stats;
-                if (rendering || warping)
+            {
+                PROFILE_ZONE("frame");
                 {
-                    stats = GetFrameStats();
-                    renderTimer_.Update();
+                    PROFILE_ZONE("poll events");
+                    glfwPollEvents();
                 }
 
-                if (rendering)
                 {
-                    if (doRender_) DrawFrame();
-                    tillRender += 1.0f / (float)renderFramerate_;
+                    PROFILE_ZONE("read timers");
+                    UpdateWarpStats();
                 }
-                if (doAsyncWarp_ && warping || (!doAsyncWarp_ && rendering))
+
                 {
+                    std::optional<Profiler::Zone> imguiZone(std::in_place, "build imgui");
                     ImGui_ImplVulkan_NewFrame();
                     ImGui_ImplGlfw_NewFrame();
                     ImGui::NewFrame();
@@ -152,6 +284,17 @@ namespace Projector
                         ImGui::Spacing();
                         ImGui::Indent(12.0f);
                         ImGui::Checkbox("Render", &doRender_);
+                        ImGui::Checkbox("Parallel recording", &parallelRecording_);
+                        ImGui::SameLine();
+                        ImGui::Text("(%u threads)", recordChunkCount_);
+                        if (parallelRecording_ && pipelineStatisticsSupported_ && !inheritedQueriesSupported_)
+                        {
+                            ImGui::Text("Scene statistics not counted, no inherited queries");
+                        }
+                        if (scene_->GetLoadedTextureCount() < scene_->GetTextureCount())
+                        {
+                            ImGui::Text("Streaming textures: %u/%u", scene_->GetLoadedTextureCount(), scene_->GetTextureCount());
+                        }
                         ImGui::SliderInt("Render framerate", &renderFramerate_, 1, 120);
                         ImGui::SliderFloat("Field of view", &fov_, 0, MAX_VFOV_DEG - overdrawDegreesChange_);
                         ImGui::Indent(-12.0f);
@@ -164,6 +307,12 @@ namespace Projector
                         ImGui::Indent(12.0f);
                         ImGui::Checkbox("Enabled", &doAsyncWarp_);
                         ImGui::SliderInt("Warp framerate", &warpFramerate_, 1, 120);
+                        ImGui::Checkbox("Align to render deadlines", &alignWarpToRender_);
+                        if (alignWarpToRender_)
+                        {
+                            ImGui::SameLine();
+                            ImGui::SliderFloat("Phase", &warpPhase_, 0, 1, "%.2f intervals");
+                        }
                         ImGui::SliderFloat("Overdraw", &overdrawDegreesChange_, 0, MAX_VFOV_DEG - fov_, "%.1f degrees");
                         if (ImGui::IsItemDeactivatedAfterEdit())
                         {
@@ -220,42 +369,185 @@ namespace Projector
                         ImGui::Spacing();
                         ImGui::Spacing();
                         ImGui::Text("Device timestamp resolution: %f ns", timeStampPeriod_);
+                        if (ImGui::Button("Write trace"))
+                        {
+                            Profiler::CpuProfiler::WriteChromeTrace(tracePath_.empty() ? "projector_trace.json" : tracePath_);
+                        }
+                        ImGui::Spacing();
+                        ImGui::Spacing();
+
+                        // Render stats are owned by the render thread, the overlay draws its latest copy
+                        std::lock_guard<std::mutex> renderStatsLock(renderStatsMutex_);
+
+                        const auto timerTable = [](const std::vector<DeviceOpTimer::Scope>& scopes)
+                        {
+                            if (!ImGui::BeginTable(scopes[0].name, 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) return;
+
+                            ImGui::TableSetupColumn("Scope (ms)");
+                            ImGui::TableSetupColumn("Last");
+                            ImGui::TableSetupColumn("Min");
+                            ImGui::TableSetupColumn("Avg");
+                            ImGui::TableSetupColumn("P95");
+                            ImGui::TableSetupColumn("P99");
+                            ImGui::TableHeadersRow();
+                            for (const DeviceOpTimer::Scope& scope : scopes)
+                            {
+                                ImGui::TableNextRow();
+                                ImGui::TableNextColumn();
+                                ImGui::Text("%*s%s", 2 * scope.depth, "", scope.name);
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", scope.times.GetLast());
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", scope.times.GetMin());
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", scope.times.GetAverage());
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", scope.times.GetPercentile(95.0f));
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", scope.times.GetPercentile(99.0f));
+                            }
+                            ImGui::EndTable();
+                        };
+                        timerTable(renderStats_.timerScopes);
+                        ImGui::Spacing();
+                        timerTable(warpTimer_.GetScopes());
+                        ImGui::Spacing();
+                        ImGui::Spacing();
+
+                        if (ImGui::BeginTable("pacing", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+                        {
+                            ImGui::TableSetupColumn("Deadline lateness (ms)");
+                            ImGui::TableSetupColumn("Avg");
+                            ImGui::TableSetupColumn("P99");
+                            ImGui::TableSetupColumn("Max");
+                            ImGui::TableSetupColumn("Missed");
+                            ImGui::TableHeadersRow();
+                            const auto pacingRow = [](const char* name, const Scheduler::StreamPacing& pacing)
+                            {
+                                ImGui::TableNextRow();
+                                ImGui::TableNextColumn(); ImGui::TextUnformatted(name);
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", pacing.averageMs);
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", pacing.p99Ms);
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", pacing.maxMs);
+                                ImGui::TableNextColumn(); ImGui::Text("%llu", static_cast<unsigned long long>(pacing.missedDeadlines));
+                            };
+                            pacingRow("render", renderStats_.pacing);
+                            pacingRow("warp", scheduler_.GetPacing(Scheduler::Warp));
+                            ImGui::EndTable();
+                        }
+                        ImGui::Text("Warp spin window: %.3f ms, sleep overshoot avg: %.3f ms", scheduler_.GetSpinWindowMs(), scheduler_.GetSleepOvershoot().GetAverage());
+                        ImGui::Spacing();
+                        ImGui::Spacing();
+
+                        ImGui::Spacing();
+                        ImGui::Spacing();
+                        ImGui::TextColored(ImVec4(1, 0.5, 0, 1), "Motion-to-photon latency");
                         ImGui::Spacing();
                         ImGui::Spacing();
-                        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+                        if (ImGui::BeginTable("latency", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
                         {
-                            ImGui::Text("Frame %d render start stamp: %llu, end stamp: %llu (delta %llu)", i, stats.renderStartStamps[i], stats.renderEndStamps[i], stats.renderEndStamps[i] - stats.renderStartStamps[i]);
+                            ImGui::TableSetupColumn("Input to (ms)");
+                            ImGui::TableSetupColumn("Min");
+                            ImGui::TableSetupColumn("Avg");
+                            ImGui::TableSetupColumn("P95");
+                            ImGui::TableSetupColumn("P99");
+                            ImGui::TableHeadersRow();
+                            const auto latencyRow = [](const char* name, const RollingStats& latency)
+                            {
+                                ImGui::TableNextRow();
+                                ImGui::TableNextColumn(); ImGui::TextUnformatted(name);
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", latency.GetMin());
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", latency.GetAverage());
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", latency.GetPercentile(95.0f));
+                                ImGui::TableNextColumn(); ImGui::Text("%.3f", latency.GetPercentile(99.0f));
+                            };
+                            latencyRow("warp submit", latencyTracker_.GetInputToSubmit());
+                            latencyRow("GPU done", latencyTracker_.GetInputToGpuDone());
+                            latencyRow(presentWaitSupported_ ? "present" : "present call", latencyTracker_.GetInputToPresent());
+                            ImGui::EndTable();
                         }
-                        ImGui::Text("Warp start stamp: %llu, end stamp: %llu (delta %llu)", stats.warpStartStamp, stats.warpEndStamp, stats.warpEndStamp - stats.warpStartStamp);
                         ImGui::Spacing();
                         ImGui::Spacing();
-                        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+
+                        if (pipelineStatisticsSupported_ && ImGui::BeginTable("pipeline statistics", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+                        {
+                            ImGui::TableSetupColumn("Per frame");
+                            ImGui::TableSetupColumn("Scene last");
+                            ImGui::TableSetupColumn("Scene avg");
+                            ImGui::TableSetupColumn("Warp grid last");
+                            ImGui::TableSetupColumn("Warp grid avg");
+                            ImGui::TableHeadersRow();
+                            for (uint32_t c = 0; c < PipelineStatsQuery::CounterCount; c++)
+                            {
+                                const RollingStats& scene = renderStats_.counters[c];
+                                const RollingStats& warp = warpPipelineStats_.GetCounter((PipelineStatsQuery::Counter)c);
+                                ImGui::TableNextRow();
+                                ImGui::TableNextColumn(); ImGui::TextUnformatted(PipelineStatsQuery::CounterNames[c]);
+                                ImGui::TableNextColumn(); ImGui::Text("%.0f", scene.GetLast());
+                                ImGui::TableNextColumn(); ImGui::Text("%.0f", scene.GetAverage());
+                                ImGui::TableNextColumn(); ImGui::Text("%.0f", warp.GetLast());
+                                ImGui::TableNextColumn(); ImGui::Text("%.0f", warp.GetAverage());
+                            }
+                            ImGui::EndTable();
+                            ImGui::Spacing();
+                            ImGui::Spacing();
+                        }
+
+                        const Memory::Stats memoryStats = allocator_->GetStats();
+                        if (ImGui::BeginTable("device memory", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+                        {
+                            ImGui::TableSetupColumn("Device memory");
+                            ImGui::TableSetupColumn("Allocations");
+                            ImGui::TableSetupColumn("MiB");
+                            ImGui::TableHeadersRow();
+                            for (uint32_t c = 0; c < Memory::CategoryCount; c++)
+                            {
+                                const Memory::CategoryStats& category = memoryStats.categories[c];
+                                ImGui::TableNextRow();
+                                ImGui::TableNextColumn(); ImGui::TextUnformatted(Memory::CategoryNames[c]);
+                                ImGui::TableNextColumn(); ImGui::Text("%u", category.allocationCount);
+                                ImGui::TableNextColumn(); ImGui::Text("%.1f", category.bytes / (1024.0f * 1024.0f));
+                            }
+                            ImGui::EndTable();
+                        }
+                        ImGui::Text("Device allocations: %u blocks, %u dedicated (limit %u), %.1f/%.1f MiB used",
+                            memoryStats.blockCount,
+                            memoryStats.dedicatedCount,
+                            memoryStats.maxDeviceAllocations,
+                            memoryStats.usedBytes / (1024.0f * 1024.0f),
+                            memoryStats.reservedBytes / (1024.0f * 1024.0f)
+                        );
+                        if (memoryStats.lazyBytes > 0)
                         {
-                            ImGui::Text("Frame %d render time (ms): %f", i, stats.renderTimes[i]);
+                            ImGui::Text("Lazily allocated: %.1f MiB committed of %.1f MiB",
+                                memoryStats.lazyCommittedBytes / (1024.0f * 1024.0f),
+                                memoryStats.lazyBytes / (1024.0f * 1024.0f)
+                            );
                         }
                         ImGui::Spacing();
                         ImGui::Spacing();
-                        ImGui::Text("Warp time (ms): %f", stats.warpTime);
 
-                        ImGui::PlotLines("Frame Times", stats.renderTimes.data(), stats.renderTimes.size());
+                        if (metricsSink_)
+                        {
+                            ImGui::Text("Metrics records written: %llu", static_cast<unsigned long long>(metricsSink_->GetRecordCount()));
+                            ImGui::Spacing();
+                        }
+
+                        const RollingStats& renderTimes = renderStats_.timerScopes[0].times;
+                        const RollingStats& warpTimes = warpTimer_.GetFrameTimes();
                         ImGui::PlotLines(
                             "",
-                            renderTimer_.GetRenderTimes(),
-                            renderTimer_.GetRenderTimesCount(),
-                            renderTimer_.GetRenderTimesOffset(),
-                            ("Render frame time (ms), average: " + std::to_string(renderTimer_.GetRenderTimesAverage())).c_str(),
+                            renderTimes.GetValues(),
+                            renderTimes.GetValuesCount(),
+                            renderTimes.GetValuesOffset(),
+                            ("Render frame time (ms), average: " + std::to_string(renderTimes.GetAverage())).c_str(),
                             0,
-                            1.5f * renderTimer_.GetRenderTimesAverage(),
+                            1.5f * renderTimes.GetAverage(),
                             ImVec2(700, 100)
                         );
                         ImGui::PlotLines(
                             "",
-                            warpTimer_.GetRenderTimes(),
-                            warpTimer_.GetRenderTimesCount(),
-                            warpTimer_.GetRenderTimesOffset(),
-                            ("Warp frame time (ms), average: " + std::to_string(warpTimer_.GetRenderTimesAverage())).c_str(),
+                            warpTimes.GetValues(),
+                            warpTimes.GetValuesCount(),
+                            warpTimes.GetValuesOffset(),
+                            ("Warp frame time (ms), average: " + std::to_string(warpTimes.GetAverage())).c_str(),
                             0,
-                            1.5f * warpTimer_.GetRenderTimesAverage(),
+                            1.5f * warpTimes.GetAverage(),
                             ImVec2(700, 100)
                         );
 
@@ -266,38 +558,157 @@ namespace Projector
                     ImGui::ShowDemoWindow();
                     
 
-                    // Compute setting-dependent variables
-                    {
-                        renderFov_ = fov_ + overdrawDegrees_;
+                    UpdateProjectionParameters();
 
-                        float viewFovAngle = fov_ / 2.0f;
-                        float renderFovAngle = renderFov_ / 2.0f;
+                    if (doRecreateSwapchain) RecreateSwapChain();
 
-                        float renderEdgeFromMid = glm::tan(glm::radians(renderFovAngle));
-                        renderScreenScale_ = renderEdgeFromMid * 2.0f;
+                    ImGui::Render();
+                    imguiZone.reset();
 
-                        float renderOvershotFovAngle = renderFovAngle + ((clampOvershootPercent_ / 100.0f) * (89.9f - renderFovAngle));
-                        float renderOvershotEdgeFromMid = glm::tan(glm::radians(renderOvershotFovAngle));
-                        renderOvershotScreenScale_ = renderOvershotEdgeFromMid * 2.0f;
+                    overdrawDegrees_ = std::clamp(overdrawDegrees_, 0.0f, 180.0f - fov_);
 
-                        float viewEdgeFromMid = glm::tan(glm::radians(viewFovAngle));
-                        viewScreenScale_ = viewEdgeFromMid * 2.0f;
+                    warpLateMs_ = lateMs;
+                    warpMissedSlots_ = missedSlots;
+                    WarpPresent(targetNs);
+                    PublishRenderInputs();
 
-                        renderScale_ = std::clamp(renderScreenScale_ / viewScreenScale_, 0.1f, 8.0f);
+                    if (replayFinished_)
+                    {
+                        std::cout << "Camera path replay finished" << std::endl;
+                        glfwSetWindowShouldClose(window_, GLFW_TRUE);
                     }
+                }
+            }
+        }
 
-                    if (doRecreateSwapchain) RecreateSwapChain();
+        StopRenderThread();
+        if (renderException_) std::rethrow_exception(renderException_);
 
-                    ImGui::Render();
+        UpdateRenderStats();
+        UpdateWarpStats();
+        PollPresentCompletion();
+        if (!tracePath_.empty()) Profiler::CpuProfiler::WriteChromeTrace(tracePath_);
+    }
 
-                    overdrawDegrees_ = std::clamp(overdrawDegrees_, 0.0f, 180.0f - fov_);
+    void Projector::RunHeadless()
+    {
+        std::vector<float> renderCpuTimes;
+        std::vector<float> warpCpuTimes;
+        renderCpuTimes.reserve(benchmarkFrames_);
+        warpCpuTimes.reserve(benchmarkFrames_);
 
-                    WarpPresent();
-                    tillWarp += 1.0f / (float)warpFramerate_;
-                }
+        // Mirror the windowed cadence: one render for every N warps
+        const uint32_t warpsPerRender = std::max(1, warpFramerate_ / std::max(1, renderFramerate_));
+
+        // A replayed camera path runs to its end instead of a fixed frame count
+        for (uint32_t frame = 0; posePlayback_ ? !replayFinished_ : frame < benchmarkFrames_; frame++)
+        {
+            PROFILE_ZONE("frame");
+            {
+                PROFILE_ZONE("read timers");
+                UpdateRenderStats();
+                UpdateWarpStats();
             }
+
+            // Single threaded, the render & warp still only meet through the render slot handoff
+            PublishRenderInputs();
+            if (doRender_ && frame % warpsPerRender == 0)
+            {
+                const auto renderStart = std::chrono::high_resolution_clock::now();
+                DrawFrame(Profiler::CpuProfiler::Now());
+                renderCpuTimes.push_back(std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - renderStart).count());
+            }
+
+            const auto warpStart = std::chrono::high_resolution_clock::now();
+            WarpPresent(Profiler::CpuProfiler::Now());
+            warpCpuTimes.push_back(std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - warpStart).count());
         }
-        vkDeviceWaitIdle(device_);
+        WaitFrameQueuesIdle();
+
+        UpdateRenderStats();
+        UpdateWarpStats();
+
+        PrintBenchmarkSummary(renderCpuTimes, warpCpuTimes);
+        if (!tracePath_.empty()) Profiler::CpuProfiler::WriteChromeTrace(tracePath_);
+    }
+
+    void Projector::PrintBenchmarkSummary(const std::vector<float>& renderCpuTimes, const std::vector<float>& warpCpuTimes) const
+    {
+        const auto printCpu = [](const char* name, const std::vector<float>& times)
+        {
+            if (times.empty())
+            {
+                std::cout << "  " << name << " cpu: no samples" << std::endl;
+                return;
+            }
+            const auto [min, max] = std::minmax_element(times.begin(), times.end());
+            const float average = std::accumulate(times.begin(), times.end(), 0.0f) / times.size();
+            std::cout << "  " << name << " cpu (ms): min " << *min << ", avg " << average << ", max " << *max << " over " << times.size() << " frames" << std::endl;
+        };
+        const auto printGpu = [](const char* name, const DeviceOpTimer& timer)
+        {
+            for (const DeviceOpTimer::Scope& scope : timer.GetScopes())
+            {
+                const RollingStats& times = scope.times;
+                std::cout << "  " << std::string(2 * scope.depth, ' ') << (scope.depth ? scope.name : name) << " gpu";
+                if (times.GetTotalCount() == 0)
+                {
+                    std::cout << ": no samples" << std::endl;
+                    continue;
+                }
+                std::cout << " (ms): min " << times.GetTotalMin() << ", avg " << times.GetTotalAverage() << ", max " << times.GetTotalMax()
+                    << ", p95 " << times.GetPercentile(95.0f) << ", p99 " << times.GetPercentile(99.0f) << " over " << times.GetTotalCount() << " frames" << std::endl;
+            }
+            if (timer.GetDroppedFrames()) std::cout << "  " << name << " gpu: " << timer.GetDroppedFrames() << " frames dropped from timing" << std::endl;
+        };
+
+        std::cout << "Benchmark summary (" << swapChainExtent_.width << "x" << swapChainExtent_.height << ", " << warpCpuTimes.size() << " warp frames):" << std::endl;
+        printCpu("Render", renderCpuTimes);
+        printGpu("Render", renderTimer_);
+        printCpu("Warp  ", warpCpuTimes);
+        printGpu("Warp  ", warpTimer_);
+
+        const auto printLatency = [](const char* name, const RollingStats& latency)
+        {
+            if (latency.GetTotalCount() == 0) return;
+            std::cout << "  Input to " << name << " (ms): min " << latency.GetTotalMin() << ", avg " << latency.GetTotalAverage() << ", max " << latency.GetTotalMax()
+                << ", p95 " << latency.GetPercentile(95.0f) << ", p99 " << latency.GetPercentile(99.0f) << std::endl;
+        };
+        printLatency("warp submit", latencyTracker_.GetInputToSubmit());
+        printLatency("GPU done", latencyTracker_.GetInputToGpuDone());
+        printLatency("present (offscreen, GPU done)", latencyTracker_.GetInputToPresent());
+
+        const auto printStatistics = [](const char* name, const PipelineStatsQuery& statistics)
+        {
+            if (!statistics.IsSupported()) return;
+            std::cout << "  " << name << " pipeline statistics (per frame average):" << std::endl;
+            for (uint32_t c = 0; c < PipelineStatsQuery::CounterCount; c++)
+            {
+                std::cout << "    " << PipelineStatsQuery::CounterNames[c] << ": " << static_cast<uint64_t>(statistics.GetCounter((PipelineStatsQuery::Counter)c).GetTotalAverage()) << std::endl;
+            }
+        };
+        printStatistics("Scene", renderPipelineStats_);
+        printStatistics("Warp grid", warpPipelineStats_);
+    }
+
+    void Projector::UpdateProjectionParameters()
+    {
+        renderFov_ = fov_ + overdrawDegrees_;
+
+        float viewFovAngle = fov_ / 2.0f;
+        float renderFovAngle = renderFov_ / 2.0f;
+
+        float renderEdgeFromMid = glm::tan(glm::radians(renderFovAngle));
+        renderScreenScale_ = renderEdgeFromMid * 2.0f;
+
+        float renderOvershotFovAngle = renderFovAngle + ((clampOvershootPercent_ / 100.0f) * (89.9f - renderFovAngle));
+        float renderOvershotEdgeFromMid = glm::tan(glm::radians(renderOvershotFovAngle));
+        renderOvershotScreenScale_ = renderOvershotEdgeFromMid * 2.0f;
+
+        float viewEdgeFromMid = glm::tan(glm::radians(viewFovAngle));
+        viewScreenScale_ = viewEdgeFromMid * 2.0f;
+
+        renderScale_ = std::clamp(renderScreenScale_ / viewScreenScale_, 0.1f, 8.0f);
     }
 
     void Projector::Resized()
@@ -418,11 +829,15 @@ namespace Projector
                 indices.graphicsFamily = i;
             }
             VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
+            if (surface_ != VK_NULL_HANDLE) vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
             if (presentSupport)
             {
                 indices.presentFamily = i;
             }
+            if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+            {
+                indices.transferFamily = i;
+            }
             i++;
         }
         return indices;
@@ -463,6 +878,20 @@ namespace Projector
         }
     }
 
+    const bool Projector::IsDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName) const
+    {
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+        for (const auto& extension : availableExtensions)
+        {
+            if (strcmp(extension.extensionName, extensionName) == 0) return true;
+        }
+        return false;
+    }
+
     const bool Projector::CheckDeviceExtensionSupport(VkPhysicalDevice device) const
     {
         uint32_t extensionCount;
@@ -470,7 +899,13 @@ namespace Projector
         std::vector<VkExtensionProperties> availableExtensions(extensionCount);
         vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-        std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+        // Offscreen runs do without VRS, see PickPhysicalDevice
+        std::set<std::string> requiredExtensions;
+        if (!headless_)
+        {
+            requiredExtensions.insert(deviceExtensions.begin(), deviceExtensions.end());
+            requiredExtensions.insert(presentDeviceExtensions.begin(), presentDeviceExtensions.end());
+        }
         for (const auto& extension : availableExtensions)
         {
             requiredExtensions.erase(extension.extensionName);
@@ -489,6 +924,15 @@ namespace Projector
 
         bool extensionsSupported = CheckDeviceExtensionSupport(device);
 
+        // Offscreen runs only need graphics, and may land on software implementations
+        if (headless_)
+        {
+            return
+                indices.graphicsFamily.has_value() &&
+                extensionsSupported &&
+                deviceFeatures.samplerAnisotropy;
+        }
+
         bool swapChainAdequate = false;
         if (extensionsSupported)
         {
@@ -504,6 +948,14 @@ namespace Projector
             deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
     }
 
+    std::unique_lock<std::mutex> Projector::LockSharedQueue()
+    {
+        // Render & warp threads only contend when the graphics family had a single queue to give, see CreateLogicalDevice
+        std::unique_lock<std::mutex> lock(sharedQueueMutex_, std::defer_lock);
+        if (warpQueue_ == graphicsQueue_) lock.lock();
+        return lock;
+    }
+
     const VkShaderModule Projector::CreateShaderModule(const std::vector<char>& code) const
     {
         VkShaderModuleCreateInfo createInfo
@@ -591,8 +1043,8 @@ namespace Projector
         };
 
         uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        const char** glfwExtensions = nullptr;
+        if (!headless_) glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
         VkInstanceCreateInfo createInfo
         {
@@ -638,13 +1090,16 @@ namespace Projector
             throw std::runtime_error("failed to find GPUs with Vulkan support");
         }
 
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-        std::cout << "Required extensions: " << glfwExtensionCount << std::endl;
-        for (int i = 0; i < glfwExtensionCount; i++)
+        if (!headless_)
         {
-            std::cout << "  " << glfwExtensions[i] << std::endl;
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions;
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+            std::cout << "Required extensions: " << glfwExtensionCount << std::endl;
+            for (int i = 0; i < glfwExtensionCount; i++)
+            {
+                std::cout << "  " << glfwExtensions[i] << std::endl;
+            }
         }
 
         std::vector<VkPhysicalDevice> devices(deviceCount);
@@ -664,6 +1119,22 @@ namespace Projector
         {
             if (IsDeviceSuitable(device))
             {
+                // Software implementations picked for offscreen runs may lack attachment VRS
+                VkPhysicalDeviceFragmentShadingRateFeaturesKHR shadingRateFeatures
+                {
+                    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_FEATURES_KHR,
+                };
+                if (IsDeviceExtensionAvailable(device, VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME))
+                {
+                    VkPhysicalDeviceFeatures2 supportedFeatures
+                    {
+                        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                        .pNext = &shadingRateFeatures,
+                    };
+                    vkGetPhysicalDeviceFeatures2(device, &supportedFeatures);
+                }
+                variableRateShadingSupported_ = shadingRateFeatures.attachmentFragmentShadingRate;
+
                 VkPhysicalDeviceFragmentShadingRatePropertiesKHR shadingRateProperties
                 {
                     .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_PROPERTIES_KHR,
@@ -671,7 +1142,7 @@ namespace Projector
                 VkPhysicalDeviceProperties2 deviceProperties
                 {
                     .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
-                    .pNext = &shadingRateProperties,
+                    .pNext = variableRateShadingSupported_ ? &shadingRateProperties : nullptr,
                 };
                 vkGetPhysicalDeviceProperties2(device, &deviceProperties);
 
@@ -681,6 +1152,7 @@ namespace Projector
                 // msaaSamples_ = VK_SAMPLE_COUNT_1_BIT;
                 deviceName = deviceProperties.properties.deviceName;
                 shadingRateProperties_ = shadingRateProperties;
+                if (!variableRateShadingSupported_) break;
 
                 auto vkGetPhysicalDeviceFragmentShadingRatesKHR_ = (PFN_vkGetPhysicalDeviceFragmentShadingRatesKHR)vkGetInstanceProcAddr(vk_, "vkGetPhysicalDeviceFragmentShadingRatesKHR");
 
@@ -704,6 +1176,7 @@ namespace Projector
             throw std::runtime_error("failed to find a suitable GPU");
         }
         std::cout << "Picked device \"" << deviceName << "\"" << std::endl;
+        if (!variableRateShadingSupported_) std::cout << "No attachment VRS on this device, rendering at full rate" << std::endl;
     }
 
     void Projector::CreateLogicalDevice()
@@ -714,28 +1187,140 @@ namespace Projector
         QueueFamilyIndices queueFamilies = FindQueueFamilies(physicalDevice_);
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 
-        std::array<float, 2> graphicsQueuePriorities { defaultPriority, highPriority };
+        // Texture streaming gets a third queue so its uploads needn't synchronize with the render thread's submits.
+        // It's of the graphics family as mipmaps are generated with blits.
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice_, &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice_, &familyCount, families.data());
+        // Software implementations may expose a single graphics queue, the warp thread then submits to the render thread's
+        const uint32_t graphicsQueueCount = families[queueFamilies.graphicsFamily.value()].queueCount;
+        const bool warpQueueAvailable = graphicsQueueCount > 1;
+        const bool streamQueueAvailable = streamTextures_ && graphicsQueueCount > 2;
+
+        std::array<float, 3> graphicsQueuePriorities { defaultPriority, highPriority, defaultPriority };
         VkDeviceQueueCreateInfo graphicsQueueCreateInfo
         {
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
             .queueFamilyIndex = queueFamilies.graphicsFamily.value(),
-            .queueCount = 2,
+            .queueCount = streamQueueAvailable ? 3u : warpQueueAvailable ? 2u : 1u,
             .pQueuePriorities = graphicsQueuePriorities.data(),
         };
         queueCreateInfos.push_back(graphicsQueueCreateInfo);
 
-        VkDeviceQueueCreateInfo presentQueueCreateInfo
+        // Presenting is done by the warp thread, on the warp queue unless presentation needs another family
+        const bool separatePresentFamily = !headless_ && queueFamilies.presentFamily.value() != queueFamilies.graphicsFamily.value();
+        if (separatePresentFamily)
         {
-            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueFamilyIndex = queueFamilies.presentFamily.value(),
-            .queueCount = 1,
-            .pQueuePriorities = &defaultPriority,
+            VkDeviceQueueCreateInfo presentQueueCreateInfo
+            {
+                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .queueFamilyIndex = queueFamilies.presentFamily.value(),
+                .queueCount = 1,
+                .pQueuePriorities = &defaultPriority,
+            };
+            queueCreateInfos.push_back(presentQueueCreateInfo);
+        }
+        if (queueFamilies.transferFamily.has_value())
+        {
+            VkDeviceQueueCreateInfo transferQueueCreateInfo
+            {
+                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .queueFamilyIndex = queueFamilies.transferFamily.value(),
+                .queueCount = 1,
+                .pQueuePriorities = &defaultPriority,
+            };
+            queueCreateInfos.push_back(transferQueueCreateInfo);
+        }
+
+        std::vector<const char*> enabledExtensions;
+        if (variableRateShadingSupported_) enabledExtensions.insert(enabledExtensions.end(), deviceExtensions.begin(), deviceExtensions.end());
+        if (!headless_) enabledExtensions.insert(enabledExtensions.end(), presentDeviceExtensions.begin(), presentDeviceExtensions.end());
+
+        // Optional, counts shader invocations to compare VRS modes & grid resolutions on work done
+        VkPhysicalDeviceFeatures coreFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice_, &coreFeatures);
+        pipelineStatisticsSupported_ = coreFeatures.pipelineStatisticsQuery;
+        // Needed to keep the query active across secondary command buffers, see RecordDraw
+        inheritedQueriesSupported_ = pipelineStatisticsSupported_ && coreFeatures.inheritedQueries;
+
+        // Optional, lets GPU timestamps be placed on the CPU timeline without a round trip
+        if (IsDeviceExtensionAvailable(physicalDevice_, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME))
+        {
+            auto vkGetPhysicalDeviceCalibrateableTimeDomainsEXT_ = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(vk_, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+            uint32_t timeDomainCount = 0;
+            vkGetPhysicalDeviceCalibrateableTimeDomainsEXT_(physicalDevice_, &timeDomainCount, nullptr);
+            std::vector<VkTimeDomainEXT> timeDomains(timeDomainCount);
+            vkGetPhysicalDeviceCalibrateableTimeDomainsEXT_(physicalDevice_, &timeDomainCount, timeDomains.data());
+
+            // The host side is read in the domain the profiler clock is built on, see CpuProfiler::FromHostCounter
+#ifdef _WIN32
+            hostTimeDomain_ = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+#else
+            hostTimeDomain_ = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+#endif
+            calibratedTimestampsSupported_ = std::find(timeDomains.begin(), timeDomains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != timeDomains.end() &&
+                std::find(timeDomains.begin(), timeDomains.end(), hostTimeDomain_) != timeDomains.end();
+            if (calibratedTimestampsSupported_) enabledExtensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+        }
+
+        // Optional, reports when a presented image actually reached the display for latency measurement
+        VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+        };
+        VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+            .pNext = &presentWaitFeatures,
+        };
+        if (!headless_ &&
+            IsDeviceExtensionAvailable(physicalDevice_, VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+            IsDeviceExtensionAvailable(physicalDevice_, VK_KHR_PRESENT_WAIT_EXTENSION_NAME))
+        {
+            VkPhysicalDeviceFeatures2 supportedFeatures
+            {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &presentIdFeatures,
+            };
+            vkGetPhysicalDeviceFeatures2(physicalDevice_, &supportedFeatures);
+
+            presentWaitSupported_ = presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+            if (presentWaitSupported_)
+            {
+                enabledExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+                enabledExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+            }
+        }
+
+        // Optional, lets timer & statistics queries be reset from the host right before reuse
+        VkPhysicalDeviceHostQueryResetFeatures hostQueryResetFeatures
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES,
+        };
+        {
+            VkPhysicalDeviceFeatures2 supportedFeatures
+            {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &hostQueryResetFeatures,
+            };
+            vkGetPhysicalDeviceFeatures2(physicalDevice_, &supportedFeatures);
+            hostQueryResetSupported_ = hostQueryResetFeatures.hostQueryReset;
+        }
+        hostQueryResetFeatures.pNext = presentWaitSupported_ ? &presentIdFeatures : nullptr;
+
+        // Required since Vulkan 1.2, hands render frames between the render & warp threads
+        VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+            .pNext = &hostQueryResetFeatures,
+            .timelineSemaphore = VK_TRUE,
         };
-        queueCreateInfos.push_back(presentQueueCreateInfo);
 
         VkPhysicalDeviceFragmentShadingRateFeaturesKHR shadingRateFeatures
         {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADING_RATE_FEATURES_KHR,
+            .pNext = &timelineSemaphoreFeatures,
             .pipelineFragmentShadingRate = VK_FALSE,
             .primitiveFragmentShadingRate = VK_FALSE,
             .attachmentFragmentShadingRate = VK_TRUE,
@@ -743,10 +1328,12 @@ namespace Projector
         VkPhysicalDeviceFeatures2 deviceFeatures2
         {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
-            .pNext = &shadingRateFeatures,
+            .pNext = variableRateShadingSupported_ ? static_cast<void*>(&shadingRateFeatures) : static_cast<void*>(&timelineSemaphoreFeatures),
             .features = VkPhysicalDeviceFeatures
             {
                 .samplerAnisotropy = VK_TRUE,
+                .pipelineStatisticsQuery = pipelineStatisticsSupported_,
+                .inheritedQueries = inheritedQueriesSupported_,
             }
         };
         VkDeviceCreateInfo createInfo
@@ -757,8 +1344,8 @@ namespace Projector
             .pQueueCreateInfos = queueCreateInfos.data(),
             .enabledLayerCount = static_cast<uint32_t>(validationLayers.size()),
             .ppEnabledLayerNames = validationLayers.data(),
-            .enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()),
-            .ppEnabledExtensionNames = deviceExtensions.data(),
+            .enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size()),
+            .ppEnabledExtensionNames = enabledExtensions.data(),
         };
 
         if (vkCreateDevice(physicalDevice_, &createInfo, nullptr, &device_) != VK_SUCCESS)
@@ -767,37 +1354,104 @@ namespace Projector
         }
 
         vkGetDeviceQueue(device_, queueFamilies.graphicsFamily.value(), 0, &graphicsQueue_);
-        vkGetDeviceQueue(device_, queueFamilies.graphicsFamily.value(), 1, &warpQueue_);
-        vkGetDeviceQueue(device_, queueFamilies.presentFamily.value(), 0, &presentQueue_);
-    }
+        if (warpQueueAvailable) vkGetDeviceQueue(device_, queueFamilies.graphicsFamily.value(), 1, &warpQueue_);
+        else warpQueue_ = graphicsQueue_;
+        if (streamQueueAvailable) vkGetDeviceQueue(device_, queueFamilies.graphicsFamily.value(), 2, &streamQueue_);
+        if (queueFamilies.transferFamily.has_value()) vkGetDeviceQueue(device_, queueFamilies.transferFamily.value(), 0, &transferQueue_);
+        if (separatePresentFamily) vkGetDeviceQueue(device_, queueFamilies.presentFamily.value(), 0, &presentQueue_);
+        else presentQueue_ = warpQueue_;
 
-    void Projector::CreateQueryPool()
-    {
-        VkQueryPoolCreateInfo renderQueryPoolInfo =
+        if (variableRateShadingSupported_)
         {
-            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-            .pNext = nullptr,
-            .flags = 0,
-            .queryType = VK_QUERY_TYPE_TIMESTAMP,
-            .queryCount = MAX_FRAMES_IN_FLIGHT * 2, // 2 timestamps (before & after) for each pass
-        };
-        if (vkCreateQueryPool(device_, &renderQueryPoolInfo, nullptr, &renderQueryPool_) != VK_SUCCESS)
+            vkCmdSetFragmentShadingRateKHR_ = (PFN_vkCmdSetFragmentShadingRateKHR)vkGetDeviceProcAddr(device_, "vkCmdSetFragmentShadingRateKHR");
+        }
+        if (presentWaitSupported_)
+        {
+            vkWaitForPresentKHR_ = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(device_, "vkWaitForPresentKHR");
+        }
+        if (calibratedTimestampsSupported_)
         {
-            throw std::runtime_error("failed to create create render query pool");
+            vkGetCalibratedTimestampsEXT_ = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(device_, "vkGetCalibratedTimestampsEXT");
         }
+    }
 
-        VkQueryPoolCreateInfo warpQueryPoolInfo =
+    void Projector::CalibrateGpuClock()
+    {
+        uint64_t deviceTimestamp = 0;
+        uint64_t hostNs = 0;
+
+        if (calibratedTimestampsSupported_)
         {
-            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-            .pNext = nullptr,
-            .flags = 0,
-            .queryType = VK_QUERY_TYPE_TIMESTAMP,
-            .queryCount = 2,
-        };
-        if (vkCreateQueryPool(device_, &warpQueryPoolInfo, nullptr, &warpQueryPool_) != VK_SUCCESS)
+            const uint64_t deviationNs = SampleCalibratedTimestamps(deviceTimestamp, hostNs);
+            std::cout << "Calibrated GPU clock via VK_EXT_calibrated_timestamps (+-" << deviationNs / 1000.0f << " us), recalibrating every "
+                << GPU_CLOCK_RECALIBRATION_NS / 1'000'000'000ull << " s" << std::endl;
+        }
+        else
         {
-            throw std::runtime_error("failed to create create warp query pool");
+            // Fall back to a lone timestamp at the top of an otherwise empty submission.
+            // It lands somewhat after the host submit time, so GPU events skew slightly late.
+            VkQueryPool queryPool;
+            VkQueryPoolCreateInfo queryPoolInfo =
+            {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = 1,
+            };
+            if (vkCreateQueryPool(device_, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create calibration query pool");
+            }
+
+            VkCommandBuffer commandBuffer = Util::BeginSingleTimeCommands(device_, commandPool_);
+            vkCmdResetQueryPool(commandBuffer, queryPool, 0, 1);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+            hostNs = Profiler::CpuProfiler::Now();
+            Util::EndSingleTimeCommands(device_, commandPool_, graphicsQueue_, commandBuffer);
+
+            VK_CHECK_RESULT(vkGetQueryPoolResults(device_, queryPool, 0, 1, sizeof(deviceTimestamp), &deviceTimestamp, sizeof(deviceTimestamp), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+            vkDestroyQueryPool(device_, queryPool, nullptr);
+
+            std::cout << "Calibrated GPU clock via submission, trace GPU events are approximate" << std::endl;
         }
+
+        renderTimer_.SetHostClockCalibration(deviceTimestamp, hostNs);
+        warpTimer_.SetHostClockCalibration(deviceTimestamp, hostNs);
+    }
+
+    void Projector::RecalibrateGpuClock(DeviceOpTimer& timer)
+    {
+        if (!calibratedTimestampsSupported_ || Profiler::CpuProfiler::Now() - timer.GetCalibrationHostNs() < GPU_CLOCK_RECALIBRATION_NS) return;
+
+        PROFILE_ZONE("recalibrate gpu clock");
+        uint64_t deviceTimestamp = 0;
+        uint64_t hostNs = 0;
+        SampleCalibratedTimestamps(deviceTimestamp, hostNs);
+        timer.SetHostClockCalibration(deviceTimestamp, hostNs);
+    }
+
+    const uint64_t Projector::SampleCalibratedTimestamps(uint64_t& deviceTimestamp, uint64_t& hostNs) const
+    {
+        const std::array<VkCalibratedTimestampInfoEXT, 2> timestampInfos
+        {{
+            { .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT },
+            { .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = hostTimeDomain_ },
+        }};
+
+        // Both clocks are read in one call, the deviation bounds how far apart the reads were. Being preempted
+        // in between widens it, so the tightest sample wins.
+        uint64_t bestDeviationNs = std::numeric_limits<uint64_t>::max();
+        for (uint32_t sample = 0; sample < GPU_CLOCK_CALIBRATION_SAMPLES; sample++)
+        {
+            std::array<uint64_t, 2> timestamps;
+            uint64_t maxDeviation = 0;
+            VK_CHECK_RESULT(vkGetCalibratedTimestampsEXT_(device_, static_cast<uint32_t>(timestampInfos.size()), timestampInfos.data(), timestamps.data(), &maxDeviation));
+            if (maxDeviation >= bestDeviationNs) continue;
+
+            bestDeviationNs = maxDeviation;
+            deviceTimestamp = timestamps[0];
+            hostNs = Profiler::CpuProfiler::FromHostCounter(timestamps[1]);
+        }
+        return bestDeviationNs;
     }
 
     void Projector::CreateSwapChain()
@@ -872,6 +1526,43 @@ namespace Projector
         };
     }
 
+    void Projector::CreateOffscreenTargets()
+    {
+        swapChainImageFormat_ = FindSupportedFormat(
+            { VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB },
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT
+        );
+
+        // Same image count a mailbox swapchain would typically hand out
+        swapChainImages_.resize(3);
+        offscreenImagesMemory_.resize(swapChainImages_.size());
+        for (size_t i = 0; i < swapChainImages_.size(); i++)
+        {
+            Util::CreateImage(
+                *allocator_,
+                device_,
+                swapChainExtent_.width,
+                swapChainExtent_.height,
+                1,
+                VK_SAMPLE_COUNT_1_BIT,
+                swapChainImageFormat_,
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                Memory::Attachments,
+                swapChainImages_[i],
+                offscreenImagesMemory_[i]
+            );
+        }
+
+        renderExtent_ = VkExtent2D
+        {
+            .width = static_cast<uint32_t>(swapChainExtent_.width * renderScale_),
+            .height = static_cast<uint32_t>(swapChainExtent_.height * renderScale_),
+        };
+    }
+
     void Projector::CreateImageViews()
     {
         swapChainImageViews_.resize(swapChainImages_.size());
@@ -891,7 +1582,7 @@ namespace Projector
                 .format = swapChainImageFormat_,
                 .samples = msaaSamples_,
                 .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE, // Resolved, transient
                 .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
                 .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
             };
@@ -927,7 +1618,7 @@ namespace Projector
                 .format = FindDepthFormat(),
                 .samples = msaaSamples_,
                 .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-                .storeOp = VK_ATTACHMENT_STORE_OP_STORE, //VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE, // Resolved, transient
                 .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
                 .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
                 .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
@@ -998,7 +1689,7 @@ namespace Projector
             VkSubpassDescription2 subpass
             {
                 .sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2,
-                .pNext = &shadingRateAttachmentInfo,
+                .pNext = variableRateShadingSupported_ ? static_cast<const void*>(&shadingRateAttachmentInfo) : static_cast<const void*>(&depthStencilResolveInfo),
                 .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
                 .colorAttachmentCount = 1,
                 .pColorAttachments = &colorAttachmentRef,
@@ -1017,11 +1708,12 @@ namespace Projector
                 .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
             };
 
+            // The shading rate map goes last so it can be left out without VRS
             std::array<VkAttachmentDescription2, 5> attachments = { colorAttachment, colorAttachmentResolve, depthAttachment, depthAttachmentResolve, shadingRateAttachment };
             VkRenderPassCreateInfo2 renderPassInfo
             {
                 .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO_2,
-                .attachmentCount = static_cast<uint32_t>(attachments.size()),
+                .attachmentCount = static_cast<uint32_t>(variableRateShadingSupported_ ? attachments.size() : attachments.size() - 1),
                 .pAttachments = attachments.data(),
                 .subpassCount = 1,
                 .pSubpasses = &subpass,
@@ -1042,7 +1734,7 @@ namespace Projector
                 .format = swapChainImageFormat_,
                 .samples = msaaSamples_,
                 .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE, // Resolved, transient
                 .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
                 .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
                 .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
@@ -1063,7 +1755,7 @@ namespace Projector
                 .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
                 .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
                 .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-                .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                .finalLayout = headless_ ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
             };
             VkAttachmentReference colorAttachmentResolveRef
             {
@@ -1157,7 +1849,8 @@ namespace Projector
                 .primitiveRestartEnable = VK_FALSE,
             };
 
-            std::vector<VkDynamicState> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_FRAGMENT_SHADING_RATE_KHR };
+            std::vector<VkDynamicState> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+            if (variableRateShadingSupported_) dynamicStates.push_back(VK_DYNAMIC_STATE_FRAGMENT_SHADING_RATE_KHR);
             VkPipelineDynamicStateCreateInfo dynamicState
             {
                 .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
@@ -1266,7 +1959,7 @@ namespace Projector
                     Scene::VertexComponent::Normal,
                     Scene::VertexComponent::UV,
                     Scene::VertexComponent::Color,
-                }),
+                }, vertexLayout_),
 
                 .pInputAssemblyState = &inputAssembly,
                 .pViewportState = &viewportState,
@@ -1476,32 +2169,55 @@ namespace Projector
             .queueFamilyIndex = queueFamilyIndices.graphicsFamily.value(),
         };
 
-        if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool_) != VK_SUCCESS)
+        // Command pools aren't thread safe, the render thread records from a pool of its own
+        if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool_) != VK_SUCCESS ||
+            vkCreateCommandPool(device_, &poolInfo, nullptr, &renderCommandPool_) != VK_SUCCESS)
         {
             throw std::runtime_error("failed to create command pool");
         }
+
+        // Reset whole once per frame, after the frame's fence
+        VkCommandPoolCreateInfo recordPoolInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = queueFamilyIndices.graphicsFamily.value(),
+        };
+        recordCommandPools_.resize(MAX_FRAMES_IN_FLIGHT * recordChunkCount_);
+        for (VkCommandPool& pool : recordCommandPools_)
+        {
+            if (vkCreateCommandPool(device_, &recordPoolInfo, nullptr, &pool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create record command pool");
+            }
+        }
     }
 
     void Projector::CreateRenderImageResources()
     {
+        // The multisampled color & depth attachments of both passes are resolved & never stored, so they're
+        // transient & lazily allocated where the device allows. They can't share memory across passes, as the
+        // render & warp passes run concurrently on queues of their own.
+
         // Render color image
         {
             VkFormat colorFormat = swapChainImageFormat_;
-            Util::CreateImage(physicalDevice_, device_, renderExtent_.width, renderExtent_.height, 1, msaaSamples_, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage_, colorImageMemory_);
+            Util::CreateImage(*allocator_, device_, renderExtent_.width, renderExtent_.height, 1, msaaSamples_, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Transient, colorImage_, colorImageMemory_);
             colorImageView_ = Util::CreateImageView(device_, colorImage_, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
         }
         // Render depth image
         {
             VkFormat depthFormat = FindDepthFormat();
-            Util::CreateImage(physicalDevice_, device_, renderExtent_.width, renderExtent_.height, 1, msaaSamples_, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, renderDepthImage_, renderDepthImageMemory_);
+            Util::CreateImage(*allocator_, device_, renderExtent_.width, renderExtent_.height, 1, msaaSamples_, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Transient, renderDepthImage_, renderDepthImageMemory_);
             renderDepthImageView_ = Util::CreateImageView(device_, renderDepthImage_, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
         }
         // Shading rate map image
+        if (variableRateShadingSupported_)
         {
             VkFormat rateFormat = VK_FORMAT_R8_UINT;
             uint32_t width = static_cast<uint32_t>(ceil(renderExtent_.width / (float)shadingRateProperties_.maxFragmentShadingRateAttachmentTexelSize.width));
             uint32_t height = static_cast<uint32_t>(ceil(renderExtent_.height / (float)shadingRateProperties_.maxFragmentShadingRateAttachmentTexelSize.height));
-            Util::CreateImage(physicalDevice_, device_, width, height, 1, VK_SAMPLE_COUNT_1_BIT, rateFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadingRateImage_, shadingRateImageMemory_);
+            Util::CreateImage(*allocator_, device_, width, height, 1, VK_SAMPLE_COUNT_1_BIT, rateFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_FRAGMENT_SHADING_RATE_ATTACHMENT_BIT_KHR | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Attachments, shadingRateImage_, shadingRateImageMemory_);
             shadingRateImageView_ = Util::CreateImageView(device_, shadingRateImage_, rateFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
         
             VkDeviceSize imageSize = width * height * sizeof(uint8_t);
@@ -1521,54 +2237,12 @@ namespace Projector
                 break;
             }
 
-            uint8_t* mapData = new uint8_t[imageSize];
-            memset(mapData, noneVal, imageSize);
+            std::vector<uint8_t> mapData(imageSize);
+            Util::FillShadingRateMap(mapData.data(), width, height, viewScreenScale_ / renderScreenScale_, variableShaded, noneVal);
 
-            float visibleRatio = viewScreenScale_ / renderScreenScale_;
-            float outsideWidth = (width - width * visibleRatio) * 0.5f;
-            float outsideHeight = (height - height * visibleRatio) * 0.5f;
-
-            uint8_t* cursor = mapData;
-            for (uint32_t y = 0; y < height; y++)
-            {
-                for (uint32_t x = 0; x < width; x++)
-                {
-                    const float deltaX = ((float)width / 2.0f - (float)x) / width * 100.0f;
-                    const float deltaY = ((float)height / 2.0f - (float)y) / height * 100.0f;
-                    const float dist = std::sqrt(deltaX * deltaX + deltaY * deltaY);
-                    if (x < outsideWidth || x > width - outsideWidth || y < outsideHeight || y > height - outsideHeight)
-                    {
-                        *cursor = variableShaded;
-                    }
-                    cursor++;
-                }
-            }
-
-            VkBuffer stagingBuffer;
-            VkDeviceMemory stagingBufferMemory;
-            Util::CreateBuffer(physicalDevice_, device_, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-            uint8_t* data;
-            vkMapMemory(device_, stagingBufferMemory, 0, imageSize, 0, (void**)&data);
-            memcpy(data, mapData, (size_t)imageSize);
-            vkUnmapMemory(device_, stagingBufferMemory);
-
-            Util::TransitionImageLayout(device_, commandPool_, graphicsQueue_, shadingRateImage_, VK_FORMAT_R8_UINT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
-            Util::CopyBufferToImage(device_, commandPool_, graphicsQueue_, stagingBuffer, shadingRateImage_, width, height);
-
-            vkDestroyBuffer(device_, stagingBuffer, nullptr);
-            vkFreeMemory(device_, stagingBufferMemory, nullptr);
-
-            Util::TransitionImageLayout(
-                device_,
-                commandPool_,
-                graphicsQueue_,
-                shadingRateImage_,
-                VK_FORMAT_R8_UINT,
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                VK_IMAGE_LAYOUT_FRAGMENT_SHADING_RATE_ATTACHMENT_OPTIMAL_KHR,
-                1
-            );
+            // Scene loading is done with the context by now, it serves later uploads like this one
+            uploads_->UploadImage(shadingRateImage_, rateFormat, width, height, 1, mapData.data(), imageSize, VK_IMAGE_LAYOUT_FRAGMENT_SHADING_RATE_ATTACHMENT_OPTIMAL_KHR);
+            uploads_->Finish();
         }
         // Render result image
         {
@@ -1578,7 +2252,7 @@ namespace Projector
             for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
             {
                 VkFormat colorFormat = swapChainImageFormat_;
-                Util::CreateImage(physicalDevice_, device_, renderExtent_.width, renderExtent_.height, 1, VK_SAMPLE_COUNT_1_BIT, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, resultImages_[i], resultImagesMemory_[i]);
+                Util::CreateImage(*allocator_, device_, renderExtent_.width, renderExtent_.height, 1, VK_SAMPLE_COUNT_1_BIT, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Attachments, resultImages_[i], resultImagesMemory_[i]);
                 resultImageViews_[i] = Util::CreateImageView(device_, resultImages_[i], colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
                 Util::TransitionImageLayout(
                     device_,
@@ -1600,7 +2274,7 @@ namespace Projector
             for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
             {
                 VkFormat depthFormat = FindDepthFormat();
-                Util::CreateImage(physicalDevice_, device_, renderExtent_.width, renderExtent_.height, 1, VK_SAMPLE_COUNT_1_BIT, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, resultImagesDepth_[i], resultImagesMemoryDepth_[i]);
+                Util::CreateImage(*allocator_, device_, renderExtent_.width, renderExtent_.height, 1, VK_SAMPLE_COUNT_1_BIT, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Attachments, resultImagesDepth_[i], resultImagesMemoryDepth_[i]);
                 resultImageViewsDepth_[i] = Util::CreateImageView(device_, resultImagesDepth_[i], depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
                 Util::TransitionImageLayout(
                     device_,
@@ -1617,15 +2291,27 @@ namespace Projector
         // Warp color image
         {
             VkFormat colorFormat = swapChainImageFormat_;
-            Util::CreateImage(physicalDevice_, device_, renderExtent_.width, renderExtent_.height, 1, msaaSamples_, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, warpColorImage_, warpColorImageMemory_);
+            Util::CreateImage(*allocator_, device_, renderExtent_.width, renderExtent_.height, 1, msaaSamples_, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Transient, warpColorImage_, warpColorImageMemory_);
             warpColorImageView_ = Util::CreateImageView(device_, warpColorImage_, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
         }
         // Warp depth image
         {
             VkFormat depthFormat = FindDepthFormat();
-            Util::CreateImage(physicalDevice_, device_, renderExtent_.width, renderExtent_.height, 1, msaaSamples_, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, warpDepthImage_, warpDepthImageMemory_);
+            Util::CreateImage(*allocator_, device_, renderExtent_.width, renderExtent_.height, 1, msaaSamples_, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Transient, warpDepthImage_, warpDepthImageMemory_);
             warpDepthImageView_ = Util::CreateImageView(device_, warpDepthImage_, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
         }
+
+        const Memory::Stats memoryStats = allocator_->GetStats();
+        const VkDeviceSize transientBytes = memoryStats.categories[Memory::Transient].bytes;
+        if (memoryStats.lazyBytes > 0)
+        {
+            std::cout << "Transient attachments: " << transientBytes / (1024 * 1024) << " MiB lazily allocated, " << memoryStats.lazyCommittedBytes / (1024 * 1024)
+                << " MiB committed, " << (memoryStats.lazyBytes - memoryStats.lazyCommittedBytes) / (1024 * 1024) << " MiB saved" << std::endl;
+        }
+        else
+        {
+            std::cout << "Transient attachments: " << transientBytes / (1024 * 1024) << " MiB device local, no lazily allocated memory" << std::endl;
+        }
     }
 
     void Projector::CreateFramebuffers()
@@ -1647,7 +2333,7 @@ namespace Projector
                 {
                     .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
                     .renderPass = renderPass_,
-                    .attachmentCount = static_cast<uint32_t>(attachments.size()),
+                    .attachmentCount = static_cast<uint32_t>(variableRateShadingSupported_ ? attachments.size() : attachments.size() - 1),
                     .pAttachments = attachments.data(),
                     .width = renderExtent_.width,
                     .height = renderExtent_.height,
@@ -1701,16 +2387,20 @@ namespace Projector
 
             for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
             {
-                Util::CreateBuffer(physicalDevice_, device_, bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers_[i], uniformBuffersMemory_[i]);
-                vkMapMemory(device_, uniformBuffersMemory_[i], 0, bufferSize, 0, &uniformBuffersMapped_[i]);
+                Util::CreateBuffer(*allocator_, device_, bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, Memory::Uniforms, uniformBuffers_[i], uniformBuffersMemory_[i]);
+                uniformBuffersMapped_[i] = uniformBuffersMemory_[i].mapped;
             }
         }
 
         {
-            VkDeviceSize bufferSize = sizeof(WarpUniformBufferObject);
+            VkPhysicalDeviceProperties properties{};
+            vkGetPhysicalDeviceProperties(physicalDevice_, &properties);
+            const VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+            warpUniformStride_ = (sizeof(WarpUniformBufferObject) + alignment - 1) / alignment * alignment;
+            VkDeviceSize bufferSize = warpUniformStride_ * MAX_FRAMES_IN_FLIGHT;
 
-            Util::CreateBuffer(physicalDevice_, device_, bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, warpUniformBuffer_, warpUniformBufferMemory_);
-            vkMapMemory(device_, warpUniformBufferMemory_, 0, bufferSize, 0, &warpUniformBufferMapped_);
+            Util::CreateBuffer(*allocator_, device_, bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, Memory::Uniforms, warpUniformBuffer_, warpUniformBufferMemory_);
+            warpUniformBufferMapped_ = warpUniformBufferMemory_.mapped;
         }
     }
 
@@ -1799,10 +2489,10 @@ namespace Projector
 
         // Warp
         {
-            VkDescriptorSetLayoutBinding warpUboLayoutBinding // State params for vectex stage
+            VkDescriptorSetLayoutBinding warpUboLayoutBinding // State params for vectex stage, slot picked at bind time
             {
                 .binding = 0,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
                 .descriptorCount = 1,
                 .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
                 .pImmutableSamplers = nullptr, // Optional
@@ -1853,13 +2543,18 @@ namespace Projector
 
     void Projector::CreateDescriptorPool()
     {
-        std::array<VkDescriptorPoolSize, 2> poolSizes
+        std::array<VkDescriptorPoolSize, 3> poolSizes
         {
-            VkDescriptorPoolSize // For regular & warp pass
+            VkDescriptorPoolSize // For regular pass
             {
                 .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
                 .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
             },
+            VkDescriptorPoolSize // For warp pass
+            {
+                .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
+            },
             VkDescriptorPoolSize// For warp pass
             {
                 .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
@@ -1977,7 +2672,7 @@ namespace Projector
                         .dstBinding = 0,
                         .dstArrayElement = 0,
                         .descriptorCount = 1,
-                        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
                         .pBufferInfo = &bufferInfo,
                     },
                     VkWriteDescriptorSet
@@ -2025,7 +2720,7 @@ namespace Projector
             VkCommandBufferAllocateInfo allocInfo
             {
                 .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-                .commandPool = commandPool_,
+                .commandPool = renderCommandPool_,
                 .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
                 .commandBufferCount = (uint32_t)drawCommandBuffers_.size(),
             };
@@ -2035,6 +2730,25 @@ namespace Projector
                 throw std::runtime_error("failed to allocate command buffers");
             }
         }
+        // Parallel scene recording
+        {
+            recordCommandBuffers_.resize(recordCommandPools_.size());
+            for (size_t i = 0; i < recordCommandPools_.size(); i++)
+            {
+                VkCommandBufferAllocateInfo allocInfo
+                {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                    .commandPool = recordCommandPools_[i],
+                    .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                    .commandBufferCount = 1,
+                };
+
+                if (vkAllocateCommandBuffers(device_, &allocInfo, &recordCommandBuffers_[i]) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to allocate secondary command buffers");
+                }
+            }
+        }
         // Warp
         {
             VkCommandBufferAllocateInfo allocInfo
@@ -2071,6 +2785,7 @@ namespace Projector
         VkSemaphoreCreateInfo timelineSemaphoreInfo
         {
             .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &timelineCreateInfo,
         };
 
         VkFenceCreateInfo fenceInfo
@@ -2088,6 +2803,7 @@ namespace Projector
         }
         if (vkCreateSemaphore(device_, &semaphoreInfo, nullptr, &imageAvailableSemaphore_) != VK_SUCCESS ||
             vkCreateSemaphore(device_, &timelineSemaphoreInfo, nullptr, &renderReadySemaphore_) != VK_SUCCESS ||
+            vkCreateSemaphore(device_, &timelineSemaphoreInfo, nullptr, &warpDoneSemaphore_) != VK_SUCCESS ||
             vkCreateSemaphore(device_, &semaphoreInfo, nullptr, &warpFinishedSemaphore_) != VK_SUCCESS ||
             vkCreateFence(device_, &fenceInfo, nullptr, &warpInFlightFence_) != VK_SUCCESS)
         {
@@ -2134,7 +2850,7 @@ namespace Projector
             .Instance = vk_,
             .PhysicalDevice = physicalDevice_,
             .Device = device_,
-            .Queue = graphicsQueue_,
+            .Queue = warpQueue_,
             .DescriptorPool = imguiPool_,
             .MinImageCount = 3,
             .ImageCount = 3,
@@ -2144,7 +2860,7 @@ namespace Projector
 
         VkCommandBuffer commandBuffer = Util::BeginSingleTimeCommands(device_, commandPool_);
         ImGui_ImplVulkan_CreateFontsTexture();
-        Util::EndSingleTimeCommands(device_, commandPool_, graphicsQueue_, commandBuffer);
+        Util::EndSingleTimeCommands(device_, commandPool_, warpQueue_, commandBuffer);
         // ImGui_ImplVulkan_DestroyFontUploadObjects();
 
         int width = 0, height = 0;
@@ -2152,143 +2868,347 @@ namespace Projector
         ImGui::GetIO().FontGlobalScale = height / 720.0f;
     }
 
-    void Projector::UpdateUniformBuffer(bool render)
+    void Projector::UpdateRenderUniformBuffer(const RenderInputs& inputs)
+    {
+        PROFILE_ZONE("update render uniforms");
+        const Util::ViewProjection viewProjection = Util::ComputeViewProjection(
+            inputs.pose.position,
+            inputs.pose.rotation,
+            inputs.pose.position,
+            inputs.pose.rotation,
+            inputs.fov,
+            inputs.aspect
+        );
+
+        UniformBufferObject mainUbo
+        {
+            .view = viewProjection.renderView,
+            .proj = viewProjection.proj,
+        };
+        memcpy(uniformBuffersMapped_[renderFrame_], &mainUbo, sizeof(mainUbo));
+    }
+
+    // Late latch: called once the warp is recorded, right before its submit. Host writes are only guaranteed
+    // visible to submits made after them, so this is as late as the pose can be written.
+    void Projector::UpdateWarpUniformBuffer(uint64_t latchNs)
     {
+        PROFILE_ZONE("update warp uniforms");
         static auto startTime = std::chrono::high_resolution_clock::now();
-        static auto lastTime = std::chrono::high_resolution_clock::now();
 
         auto currentTime = std::chrono::high_resolution_clock::now();
         float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
-        float deltaTime = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - lastTime).count();
-        lastTime = std::chrono::high_resolution_clock::now();
-
-        Input::UserInput input = Input::InputHandler::GetInput(deltaTime);
 
-        glm::vec3 relativeMovement =
-            glm::eulerAngleY(playerWarp_.rotation.y) *
-            glm::vec4(input.moveDelta, 0);
+        // Replayed & static poses are as fresh as this warp
+        warpInputNs_ = Profiler::CpuProfiler::Now();
 
-        playerWarp_.position += relativeMovement;
-        playerWarp_.rotation.x -= input.mouseDelta.y;
-        playerWarp_.rotation.y -= input.mouseDelta.x;
+        if (posePlayback_)
+        {
+            // Replay advances one fixed step per warp frame, independent of wall time
+            replayTime_ += 1.0f / (float)warpFramerate_;
+            replayFinished_ = posePlayback_->IsFinished(replayTime_);
 
-        if (render)
+            const Input::PoseSample pose = posePlayback_->Sample(replayTime_);
+            playerWarp_.position = pose.position;
+            playerWarp_.rotation = pose.rotation;
+        }
+        else if (poseTracker_)
         {
-            playerRender_ = playerWarp_;
+            Input::TimedPose pose;
+            if (poseTracker_->GetPoses().Sample(latchNs, pose))
+            {
+                playerWarp_.position = pose.position;
+                playerWarp_.rotation = pose.rotation;
+                warpInputNs_ = pose.inputNs;
+            }
         }
 
-        glm::mat4 renderRotation = glm::eulerAngleYX(
-            playerRender_.rotation.y,
-            playerRender_.rotation.x
-        );
-        glm::mat4 warpRotation = glm::eulerAngleYX(
-            playerWarp_.rotation.y,
-            playerWarp_.rotation.x
-        );
+        if (poseRecorder_)
+        {
+            poseRecorder_->Record(time, playerWarp_.position, playerWarp_.rotation);
+        }
 
-        glm::mat4 renderView = glm::lookAt(
+        // playerRender_ is the pose of the render frame claimed for this warp
+        const Util::ViewProjection viewProjection = Util::ComputeViewProjection(
             playerRender_.position,
-            playerRender_.position + glm::vec3(renderRotation * glm::vec4(0, 0, -1, 0)),
-            glm::vec3(0.0f, 1.0f, 0.0f)
-        );
-        glm::mat4 warpView = glm::lookAt(
+            playerRender_.rotation,
             playerWarp_.position,
-            playerWarp_.position + glm::vec3(warpRotation * glm::vec4(0, 0, -1, 0)),
-            glm::vec3(0.0f, 1.0f, 0.0f)
-        );
-
-        glm::mat4 perspective = glm::perspective(
-            glm::radians(renderFov_),
-            swapChainExtent_.width / (float)swapChainExtent_.height,
-            0.01f,
-            100.0f
+            playerWarp_.rotation,
+            renderFov_,
+            swapChainExtent_.width / (float)swapChainExtent_.height
         );
-        perspective[1][1] *= -1; // Compensate for inverted clip Y axis on OpenGL
-        glm::mat4 inversePerspective = glm::inverse(perspective);
 
         glm::mat4 screen = glm::translate(
             glm::mat4(1.0f),
             playerRender_.position
         );
 
-        UniformBufferObject mainUbo
-        {
-            .view = renderView,
-            .proj = perspective,
-        };
-        memcpy(uniformBuffersMapped_[renderFrame_], &mainUbo, sizeof(mainUbo));
-
         WarpUniformBufferObject warpUbo
         {
-            .view = warpView,
-            .proj = perspective,
-            .inverseProj = inversePerspective,
-            .screen = screen * renderRotation,
+            .view = viewProjection.warpView,
+            .proj = viewProjection.proj,
+            .inverseProj = viewProjection.inverseProj,
+            .screen = screen * viewProjection.renderRotation,
             .gridResolution = gridResolution_,
             .screenScale = renderOvershotScreenScale_,
             .uvScale = renderOvershotScreenScale_ / renderScreenScale_,
             .depthBlend = depthBlend_,
         };
-        memcpy(warpUniformBufferMapped_, &warpUbo, sizeof(warpUbo));
+        memcpy(static_cast<char*>(warpUniformBufferMapped_) + warpFrameSerial_ % MAX_FRAMES_IN_FLIGHT * warpUniformStride_, &warpUbo, sizeof(warpUbo));
     }
 
-    void Projector::DrawFrame()
+    void Projector::RenderLoop()
     {
-        static bool firstFrame = true;
+        Profiler::CpuProfiler::SetThreadName("render");
+
+        // An exception escaping the thread would terminate the process, hand it to the main thread instead
+        try
+        {
+            while (!stopRendering_)
+            {
+                const RenderInputs inputs = GetRenderInputs();
+                renderScheduler_.SetRate(Scheduler::Render, inputs.doRender ? inputs.framerate : 0);
+                const Scheduler::Tick tick = renderScheduler_.WaitForNextDeadline();
+                if (!tick.due[Scheduler::Render]) continue;
 
-        vkWaitForFences(device_, 1, &inFlightFences_[renderFrame_], VK_TRUE, UINT64_MAX);
+                PROFILE_ZONE("frame");
+                std::lock_guard<std::mutex> renderLock(renderMutex_);
+                {
+                    PROFILE_ZONE("read timers");
+                    UpdateRenderStats();
+                }
+                DrawFrame(tick.deadlineNs[Scheduler::Render]);
+            }
+        }
+        catch (...)
+        {
+            renderException_ = std::current_exception();
+            renderFailed_ = true;
+            glfwPostEmptyEvent();
+        }
+    }
+
+    void Projector::StopRenderThread()
+    {
+        if (!renderThread_.joinable()) return;
+
+        stopRendering_ = true;
+        renderThread_.join();
+        WaitFrameQueuesIdle();
+    }
+
+    const RenderInputs Projector::CaptureRenderInputs() const
+    {
+        return RenderInputs
+        {
+            .pose = playerWarp_,
+            .doRender = doRender_,
+            .framerate = renderFramerate_,
+            .fov = renderFov_,
+            .aspect = swapChainExtent_.width / (float)swapChainExtent_.height,
+            .gridResolution = gridResolution_,
+            .overdrawDegrees = overdrawDegrees_,
+            .variableRateShadingMode = variableRateShadingMode_,
+            .parallelRecording = parallelRecording_,
+        };
+    }
+
+    void Projector::PublishRenderInputs()
+    {
+        const RenderInputs inputs = CaptureRenderInputs();
+        std::lock_guard<std::mutex> lock(renderInputsMutex_);
+        renderInputs_ = inputs;
+    }
+
+    const RenderInputs Projector::GetRenderInputs()
+    {
+        std::lock_guard<std::mutex> lock(renderInputsMutex_);
+        return renderInputs_;
+    }
+
+    void Projector::DrawFrame(uint64_t targetNs)
+    {
+        PROFILE_ZONE("draw frame");
+        const uint64_t startNs = Profiler::CpuProfiler::Now();
+        RenderInputs inputs = GetRenderInputs();
+        // Render from the pose at this frame's own deadline rather than the one the warp last published
+        Input::TimedPose pose;
+        if (poseTracker_ && poseTracker_->GetPoses().Sample(targetNs, pose))
+        {
+            inputs.pose.position = pose.position;
+            inputs.pose.rotation = pose.rotation;
+        }
+        renderFrameSerial_++;
+        renderFrame_ = renderFrameSerial_ % MAX_FRAMES_IN_FLIGHT;
+        RenderSlot& slot = renderSlots_[renderFrame_];
+
+        {
+            PROFILE_ZONE("wait render fence");
+            vkWaitForFences(device_, 1, &inFlightFences_[renderFrame_], VK_TRUE, UINT64_MAX);
+        }
         vkResetFences(device_, 1, &inFlightFences_[renderFrame_]);
 
-        UpdateUniformBuffer(true);
+        // The frame's descriptor sets are free again, point them to any textures streamed in meanwhile
+        scene_->UpdateStreamedTextures(renderFrame_);
 
-        uint64_t nextFrame = (renderFrame_ + 1) % MAX_FRAMES_IN_FLIGHT;
+        // Take the slot back from the warp thread. A warp that claimed it before the serial is cleared is waited
+        // for on the GPU, a later one sees the cleared serial and picks another frame.
+        slot.serial.store(0);
+        const uint64_t warpClaim = slot.warpClaim.load();
 
-        VkSemaphore waitSemaphores[] = { renderReadySemaphore_ };
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        VkSemaphore signalSemaphores[] = { renderReadySemaphore_ };
+        UpdateRenderUniformBuffer(inputs);
 
         // Main render record & submit
         {
             vkResetCommandBuffer(drawCommandBuffers_[renderFrame_], 0);
-            RecordDraw(drawCommandBuffers_[renderFrame_], renderFrame_);
+            {
+                PROFILE_ZONE("record draw");
+                RecordDraw(drawCommandBuffers_[renderFrame_], renderFrame_, inputs.parallelRecording);
+            }
 
+            VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
             VkTimelineSemaphoreSubmitInfo timelineSubmitInfo
             {
                 .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
                 .waitSemaphoreValueCount = 1,
-                .pWaitSemaphoreValues = &renderFrame_,
+                .pWaitSemaphoreValues = &warpClaim,
                 .signalSemaphoreValueCount = 1,
-                .pSignalSemaphoreValues = &nextFrame,
+                .pSignalSemaphoreValues = &renderFrameSerial_,
             };
 
             VkSubmitInfo submitInfo
             {
                 .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                .waitSemaphoreCount = firstFrame ? (uint32_t)0 : (uint32_t)1,
-                .pWaitSemaphores = firstFrame ? VK_NULL_HANDLE : waitSemaphores,
-                .pWaitDstStageMask = firstFrame ? VK_NULL_HANDLE : waitStages,
+                .pNext = &timelineSubmitInfo,
+                .waitSemaphoreCount = 1,
+                .pWaitSemaphores = &warpDoneSemaphore_,
+                .pWaitDstStageMask = &waitStage,
                 .commandBufferCount = 1,
                 .pCommandBuffers = &drawCommandBuffers_[renderFrame_],
                 .signalSemaphoreCount = 1,
-                .pSignalSemaphores = signalSemaphores,
+                .pSignalSemaphores = &renderReadySemaphore_,
             };
 
+            PROFILE_ZONE("submit draw");
+            auto queueLock = LockSharedQueue();
             if (vkQueueSubmit(graphicsQueue_, 1, &submitInfo, inFlightFences_[renderFrame_]) != VK_SUCCESS)
             {
                 throw std::runtime_error("failed to submit draw command buffer");
             }
         }
 
-        firstFrame = false;
-        renderFrame_ = nextFrame;
+        slot.pose.Store(inputs.pose);
+        slot.serial.store(renderFrameSerial_, std::memory_order_release);
+        renderSubmittedSerial_ = renderFrameSerial_;
+        // Wake a synchronous warp waiting on window events
+        if (!headless_) glfwPostEmptyEvent();
+
+        StageFrameRecord(Metrics::FrameKind::Render, renderFrameSerial_, renderFrameSerial_, startNs, inputs);
     }
 
-    void Projector::WarpPresent()
+    const uint64_t Projector::ClaimRenderFrame(uint64_t warpFrameId)
     {
-        vkWaitForFences(device_, 1, &warpInFlightFence_, VK_TRUE, UINT64_MAX);
+        PROFILE_ZONE("claim render frame");
+
+        // An asynchronous warp samples the newest completed frame, a synchronous one the newest submitted & waits
+        // for it on the GPU. Headless runs single threaded and takes the newest too, to stay deterministic.
+        const bool newestSubmitted = !doAsyncWarp_ || headless_;
+
+        uint64_t minimumSerial = 0;
+        while (true)
+        {
+            uint64_t completedSerial = 0;
+            vkGetSemaphoreCounterValue(device_, renderReadySemaphore_, &completedSerial);
+            const uint64_t submittedSerial = renderSubmittedSerial_.load();
+
+            const uint64_t serial = std::min(std::max(newestSubmitted ? submittedSerial : completedSerial, minimumSerial), submittedSerial);
+            if (serial == 0) return 0;
+
+            RenderSlot& slot = renderSlots_[serial % MAX_FRAMES_IN_FLIGHT];
+            if (slot.serial.load(std::memory_order_acquire) == serial)
+            {
+                const Player pose = slot.pose.Load();
+                // Handshake with DrawFrame, which clears the serial before reading the claim: either the render
+                // thread sees this claim and waits for the warp on the GPU, or this sees the cleared serial
+                slot.warpClaim.store(warpFrameId);
+                if (slot.serial.load() == serial)
+                {
+                    playerRender_ = pose;
+                    return serial;
+                }
+            }
+
+            // The slot is being rewritten, so newer frames have been submitted since; the warp waits for the next
+            // one on the GPU instead. Cleared slots with nothing newer, e.g. after swapchain recreation, leave none.
+            if (serial >= submittedSerial) return 0;
+            minimumSerial = serial + 1;
+        }
+    }
+
+    void Projector::WarpPresent(uint64_t targetNs)
+    {
+        PROFILE_ZONE("warp present");
+        const uint64_t startNs = Profiler::CpuProfiler::Now();
+        {
+            PROFILE_ZONE("wait warp fence");
+            vkWaitForFences(device_, 1, &warpInFlightFence_, VK_TRUE, UINT64_MAX);
+        }
+
+        if (headless_)
+        {
+            // No presentation engine, cycle through the offscreen targets directly
+            vkResetFences(device_, 1, &warpInFlightFence_);
+            warpFrameSerial_++;
+            lastWarpedFrame_ = ClaimRenderFrame(warpFrameSerial_);
+
+            uint32_t frameIndex = warpFrame_;
+            vkResetCommandBuffer(warpCommandBuffer_, 0);
+            {
+                PROFILE_ZONE("record warp");
+                RecordWarp(warpCommandBuffer_, frameIndex);
+            }
+            UpdateWarpUniformBuffer(std::max(targetNs, Profiler::CpuProfiler::Now()));
+
+            VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+            VkTimelineSemaphoreSubmitInfo timelineSubmitInfo
+            {
+                .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                .waitSemaphoreValueCount = 1,
+                .pWaitSemaphoreValues = &lastWarpedFrame_,
+                .signalSemaphoreValueCount = 1,
+                .pSignalSemaphoreValues = &warpFrameSerial_,
+            };
+            VkSubmitInfo submitInfo
+            {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .pNext = &timelineSubmitInfo,
+                .waitSemaphoreCount = 1,
+                .pWaitSemaphores = &renderReadySemaphore_,
+                .pWaitDstStageMask = &waitStage,
+                .commandBufferCount = 1,
+                .pCommandBuffers = &warpCommandBuffer_,
+                .signalSemaphoreCount = 1,
+                .pSignalSemaphores = &warpDoneSemaphore_,
+            };
+            {
+                auto queueLock = LockSharedQueue();
+                if (vkQueueSubmit(warpQueue_, 1, &submitInfo, warpInFlightFence_) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to submit warp command buffer");
+                }
+            }
+            warpInputToSubmitMs_ = latencyTracker_.FrameSubmitted(warpFrameSerial_, warpInputNs_, Profiler::CpuProfiler::Now());
+
+            warpFrame_ = (warpFrame_ + 1) % swapChainImages_.size();
+            StageFrameRecord(Metrics::FrameKind::Warp, warpFrameSerial_, lastWarpedFrame_, startNs, CaptureRenderInputs());
+            return;
+        }
 
         uint32_t frameIndex;
-        VkResult result = vkAcquireNextImageKHR(device_, swapChain_, UINT64_MAX, imageAvailableSemaphore_, VK_NULL_HANDLE, &frameIndex);
+        VkResult result;
+        {
+            PROFILE_ZONE("acquire image");
+            result = vkAcquireNextImageKHR(device_, swapChain_, UINT64_MAX, imageAvailableSemaphore_, VK_NULL_HANDLE, &frameIndex);
+        }
         if (result == VK_ERROR_OUT_OF_DATE_KHR)
         {
             std::cout << "Out-of-date swapchain on image acquire" << std::endl;
@@ -2306,51 +3226,88 @@ namespace Projector
 
         vkResetFences(device_, 1, &warpInFlightFence_);
 
-        UpdateUniformBuffer(false);
+        // Claimed only once the submit below is certain, the render thread may already be waiting on it
+        warpFrameSerial_++;
+        lastWarpedFrame_ = ClaimRenderFrame(warpFrameSerial_);
 
         uint32_t nextFrame = (warpFrame_ + 1) % swapChainImages_.size();
 
-        VkSemaphore waitSemaphores[] = { imageAvailableSemaphore_ };
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        VkSemaphore signalSemaphores[] = { warpFinishedSemaphore_ };
+        std::array<VkSemaphore, 2> waitSemaphores = { imageAvailableSemaphore_, renderReadySemaphore_ };
+        std::array<VkPipelineStageFlags, 2> waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT };
+        std::array<uint64_t, 2> waitValues = { 0, lastWarpedFrame_ }; // Binary semaphore values are ignored
+        std::array<VkSemaphore, 2> signalSemaphores = { warpFinishedSemaphore_, warpDoneSemaphore_ };
+        std::array<uint64_t, 2> signalValues = { 0, warpFrameSerial_ };
 
         // Warp record & submit
         {
             vkResetCommandBuffer(warpCommandBuffer_, 0);
-            RecordWarp(warpCommandBuffer_, frameIndex);
+            {
+                PROFILE_ZONE("record warp");
+                RecordWarp(warpCommandBuffer_, frameIndex);
+            }
+            // Latch the freshest pose, never older than the warp's deadline
+            UpdateWarpUniformBuffer(std::max(targetNs, Profiler::CpuProfiler::Now()));
 
+            VkTimelineSemaphoreSubmitInfo timelineSubmitInfo
+            {
+                .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                .waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size()),
+                .pWaitSemaphoreValues = waitValues.data(),
+                .signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size()),
+                .pSignalSemaphoreValues = signalValues.data(),
+            };
             VkSubmitInfo submitInfo
             {
                 .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                .waitSemaphoreCount = 1,
-                .pWaitSemaphores = waitSemaphores,
-                .pWaitDstStageMask = waitStages,
+                .pNext = &timelineSubmitInfo,
+                .waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size()),
+                .pWaitSemaphores = waitSemaphores.data(),
+                .pWaitDstStageMask = waitStages.data(),
                 .commandBufferCount = 1,
                 .pCommandBuffers = &warpCommandBuffer_,
-                .signalSemaphoreCount = 1,
-                .pSignalSemaphores = signalSemaphores,
+                .signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size()),
+                .pSignalSemaphores = signalSemaphores.data(),
             };
 
-            if (vkQueueSubmit(warpQueue_, 1, &submitInfo, warpInFlightFence_) != VK_SUCCESS)
             {
-                throw std::runtime_error("failed to submit warp command buffer");
+                auto queueLock = LockSharedQueue();
+                if (vkQueueSubmit(warpQueue_, 1, &submitInfo, warpInFlightFence_) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to submit warp command buffer");
+                }
             }
+            warpInputToSubmitMs_ = latencyTracker_.FrameSubmitted(warpFrameSerial_, warpInputNs_, Profiler::CpuProfiler::Now());
 
             warpFrame_ = nextFrame;
         }
 
         VkSwapchainKHR swapChains[] = { swapChain_ };
+        VkPresentIdKHR presentId
+        {
+            .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+            .swapchainCount = 1,
+            .pPresentIds = &warpFrameSerial_,
+        };
         VkPresentInfoKHR presentInfo
         {
             .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+            .pNext = presentWaitSupported_ ? &presentId : nullptr,
             .waitSemaphoreCount = 1,
-            .pWaitSemaphores = signalSemaphores,
+            .pWaitSemaphores = &warpFinishedSemaphore_,
             .swapchainCount = 1,
             .pSwapchains = swapChains,
             .pImageIndices = &frameIndex,
         };
 
-        result = vkQueuePresentKHR(presentQueue_, &presentInfo);
+        {
+            PROFILE_ZONE("present");
+            auto queueLock = LockSharedQueue();
+            result = vkQueuePresentKHR(presentQueue_, &presentInfo);
+        }
+        const uint64_t presentReturnNs = Profiler::CpuProfiler::Now();
+        StageFrameRecord(Metrics::FrameKind::Warp, warpFrameSerial_, lastWarpedFrame_, startNs, CaptureRenderInputs());
+        // Without present wait, the best available stand-in for display time is the return of the present call
+        if (!presentWaitSupported_) PresentFrameRecord(warpFrameSerial_, latencyTracker_.FramePresented(warpFrameSerial_, presentReturnNs));
         if (result == VK_ERROR_OUT_OF_DATE_KHR)
         {
             std::cout << "Out-of-date swapchain on image present" << std::endl;
@@ -2373,7 +3330,7 @@ namespace Projector
         }
     }
 
-    void Projector::RecordDraw(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+    void Projector::RecordDraw(VkCommandBuffer commandBuffer, uint32_t frameIndex, bool parallelRecording)
     {
         VkCommandBufferBeginInfo beginInfo
         {
@@ -2387,10 +3344,12 @@ namespace Projector
             throw std::runtime_error("failed to begin recording command buffer");
         }
 
-        vkCmdResetQueryPool(commandBuffer, renderQueryPool_, frameIndex * 2, 2);
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, renderQueryPool_, frameIndex * 2 + 0);
+        // Scene draws recorded into secondary command buffers can only be counted with inherited queries
+        const bool recordParallel = parallelRecording && recordChunkCount_ > 1 && !scene_->drawItems.empty();
+        renderFrameCounted_ = pipelineStatisticsSupported_ && (!recordParallel || inheritedQueriesSupported_);
 
-        renderTimer_.RecordStartTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+        if (renderFrameCounted_) renderPipelineStats_.BeginFrame(commandBuffer, inFlightFences_[frameIndex], renderFrameSerial_);
+        renderTimer_.RecordStartTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, inFlightFences_[frameIndex], renderFrameSerial_);
 
         std::array<VkClearValue, 3> clearValues
         {
@@ -2413,7 +3372,87 @@ namespace Projector
             .pClearValues = clearValues.data(),
         };
 
-        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        if (recordParallel)
+        {
+            // The pass may only execute secondary command buffers, so the scopes bracket all of it
+            renderTimer_.BeginScope(commandBuffer, "scene");
+            if (renderFrameCounted_) renderPipelineStats_.Begin(commandBuffer);
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+            std::vector<VkCommandBuffer> secondaries(recordChunkCount_, VK_NULL_HANDLE);
+            jobs_->ParallelFor(static_cast<uint32_t>(scene_->drawItems.size()), recordChunkCount_, [&](uint32_t begin, uint32_t end, uint32_t chunk)
+            {
+                const size_t index = frameIndex * recordChunkCount_ + chunk;
+                vkResetCommandPool(device_, recordCommandPools_[index], 0);
+
+                VkCommandBufferInheritanceInfo inheritanceInfo
+                {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+                    .renderPass = renderPass_,
+                    .subpass = 0,
+                    .framebuffer = mainFramebuffers_[renderFrame_],
+                    .pipelineStatistics = renderFrameCounted_ ? renderPipelineStats_.GetStatisticFlags() : 0,
+                };
+                VkCommandBufferBeginInfo secondaryBeginInfo
+                {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+                    .pInheritanceInfo = &inheritanceInfo,
+                };
+
+                VkCommandBuffer secondary = recordCommandBuffers_[index];
+                if (vkBeginCommandBuffer(secondary, &secondaryBeginInfo) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to begin recording secondary command buffer");
+                }
+                // Secondary command buffers inherit no state from the primary
+                RecordSceneState(secondary);
+                scene_->DrawRange(secondary, begin, end, pipelineLayout_, frameIndex);
+                if (vkEndCommandBuffer(secondary) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to record secondary command buffer");
+                }
+                secondaries[chunk] = secondary;
+            }, "record scene range");
+
+            secondaries.erase(std::remove(secondaries.begin(), secondaries.end(), VK_NULL_HANDLE), secondaries.end());
+            vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+
+            vkCmdEndRenderPass(commandBuffer);
+            if (renderFrameCounted_) renderPipelineStats_.End(commandBuffer);
+            renderTimer_.EndScope(commandBuffer);
+        }
+        else
+        {
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            RecordSceneState(commandBuffer);
+
+            renderTimer_.BeginScope(commandBuffer, "scene");
+            renderPipelineStats_.Begin(commandBuffer);
+            scene_->Draw(
+                commandBuffer,
+                0u,
+                pipelineLayout_,
+                1u,
+                frameIndex
+            );
+            renderPipelineStats_.End(commandBuffer);
+            renderTimer_.EndScope(commandBuffer);
+
+            vkCmdEndRenderPass(commandBuffer);
+        }
+
+        renderTimer_.RecordEndTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to record command buffer");
+        }
+    }
+
+    // Pipeline & dynamic state for the scene draws
+    void Projector::RecordSceneState(VkCommandBuffer commandBuffer)
+    {
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline_);
 
         VkViewport viewport
@@ -2445,27 +3484,138 @@ namespace Projector
             nullptr
         );
 
-        VkExtent2D fragmentSize = { 1, 1 };
-        VkFragmentShadingRateCombinerOpKHR combinerOps[2] = { VK_FRAGMENT_SHADING_RATE_COMBINER_OP_KEEP_KHR , VK_FRAGMENT_SHADING_RATE_COMBINER_OP_REPLACE_KHR };
-        auto vkCmdSetFragmentShadingRateKHR = (PFN_vkCmdSetFragmentShadingRateKHR)vkGetInstanceProcAddr(vk_, "vkCmdSetFragmentShadingRateKHR");
+        if (variableRateShadingSupported_)
+        {
+            VkExtent2D fragmentSize = { 1, 1 };
+            VkFragmentShadingRateCombinerOpKHR combinerOps[2] = { VK_FRAGMENT_SHADING_RATE_COMBINER_OP_KEEP_KHR , VK_FRAGMENT_SHADING_RATE_COMBINER_OP_REPLACE_KHR };
+            vkCmdSetFragmentShadingRateKHR_(commandBuffer, &fragmentSize, combinerOps);
+        }
+    }
 
-        vkCmdSetFragmentShadingRateKHR(commandBuffer, &fragmentSize, combinerOps);
+    void Projector::StageFrameRecord(Metrics::FrameKind kind, uint64_t frameId, uint64_t renderFrameId, uint64_t startNs, const RenderInputs& settings)
+    {
+        const bool warp = kind == Metrics::FrameKind::Warp;
+        PendingFrameRecord& pending = (warp ? pendingWarpRecords_ : pendingRenderRecords_)[frameId % pendingWarpRecords_.size()];
+        pending.timed = false;
+        pending.awaitingStatistics = warp ? pipelineStatisticsSupported_ : renderFrameCounted_;
+        pending.awaitingPresent = warp;
+        pending.record = Metrics::FrameRecord
+        {
+            .kind = kind,
+            .frameId = frameId,
+            .renderFrameId = renderFrameId,
+            .hostTimeNs = startNs,
+            .cpuMs = (Profiler::CpuProfiler::Now() - startNs) * 0.000001f,
+            .gpuMs = 0,
+            .lateMs = warp ? warpLateMs_ : 0.0f,
+            .missedSlots = warp ? warpMissedSlots_ : 0,
+            .inputToSubmitMs = warp ? warpInputToSubmitMs_ : -1.0f,
+            .inputToGpuDoneMs = -1.0f,
+            .inputToPresentMs = -1.0f,
+            .vertexInvocations = 0,
+            .clippingInvocations = 0,
+            .clippingPrimitives = 0,
+            .fragmentInvocations = 0,
+            .gridResolutionX = settings.gridResolution.x,
+            .gridResolutionY = settings.gridResolution.y,
+            .overdrawDegrees = settings.overdrawDegrees,
+            .variableRateShadingMode = VariableRateShadingNames[settings.variableRateShadingMode],
+        };
+    }
 
-        scene_->Draw(
-            commandBuffer,
-            0u,
-            pipelineLayout_,
-            1u
-        );
+    void Projector::StageFrameStatistics(Metrics::FrameKind kind, uint64_t frameId, const std::array<uint64_t, PipelineStatsQuery::CounterCount>& counters)
+    {
+        const bool warp = kind == Metrics::FrameKind::Warp;
+        PendingFrameRecord& pending = (warp ? pendingWarpRecords_ : pendingRenderRecords_)[frameId % pendingWarpRecords_.size()];
+        if (pending.record.frameId != frameId || !pending.awaitingStatistics) return;
+
+        pending.record.vertexInvocations = counters[PipelineStatsQuery::VertexInvocations];
+        pending.record.clippingInvocations = counters[PipelineStatsQuery::ClippingInvocations];
+        pending.record.clippingPrimitives = counters[PipelineStatsQuery::ClippingPrimitives];
+        pending.record.fragmentInvocations = counters[PipelineStatsQuery::FragmentInvocations];
+        pending.awaitingStatistics = false;
+        EmitFrameRecord(pending);
+    }
 
-        vkCmdEndRenderPass(commandBuffer);
+    void Projector::CompleteFrameRecord(Metrics::FrameKind kind, uint64_t frameId, float gpuMs, float inputToGpuDoneMs)
+    {
+        const bool warp = kind == Metrics::FrameKind::Warp;
+        PendingFrameRecord& pending = (warp ? pendingWarpRecords_ : pendingRenderRecords_)[frameId % pendingWarpRecords_.size()];
+        // Overwritten by a newer frame before its timing came back, drop it
+        if (pending.record.frameId != frameId || pending.timed) return;
+
+        pending.record.gpuMs = gpuMs;
+        pending.record.inputToGpuDoneMs = inputToGpuDoneMs;
+        pending.timed = true;
+        EmitFrameRecord(pending);
+    }
 
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderQueryPool_, frameIndex * 2 + 1);
-        renderTimer_.RecordEndTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    void Projector::PresentFrameRecord(uint64_t frameId, float inputToPresentMs)
+    {
+        PendingFrameRecord& pending = pendingWarpRecords_[frameId % pendingWarpRecords_.size()];
+        if (pending.record.frameId != frameId || !pending.awaitingPresent) return;
 
-        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        pending.record.inputToPresentMs = inputToPresentMs;
+        pending.awaitingPresent = false;
+        EmitFrameRecord(pending);
+    }
+
+    void Projector::DropPendingPresents()
+    {
+        latencyTracker_.ClearPendingPresents();
+        for (PendingFrameRecord& pending : pendingWarpRecords_)
         {
-            throw std::runtime_error("failed to record command buffer");
+            if (!pending.awaitingPresent) continue;
+            pending.awaitingPresent = false;
+            EmitFrameRecord(pending);
+        }
+    }
+
+    void Projector::EmitFrameRecord(PendingFrameRecord& pending)
+    {
+        // Timing, statistics & present are reported separately, whichever arrives last emits the record
+        if (!metricsSink_ || !pending.timed || pending.awaitingStatistics || pending.awaitingPresent) return;
+        metricsSink_->Push(pending.record);
+    }
+
+    void Projector::UpdateRenderStats()
+    {
+        RecalibrateGpuClock(renderTimer_);
+        renderPipelineStats_.Update();
+        renderTimer_.Update();
+        if (headless_) return;
+
+        std::lock_guard<std::mutex> lock(renderStatsMutex_);
+        renderStats_.timerScopes = renderTimer_.GetScopes();
+        for (uint32_t c = 0; c < PipelineStatsQuery::CounterCount; c++)
+        {
+            renderStats_.counters[c] = renderPipelineStats_.GetCounter((PipelineStatsQuery::Counter)c);
+        }
+        renderStats_.pacing = renderScheduler_.GetPacing(Scheduler::Render);
+    }
+
+    void Projector::UpdateWarpStats()
+    {
+        RecalibrateGpuClock(warpTimer_);
+        warpPipelineStats_.Update();
+        warpTimer_.Update();
+    }
+
+    void Projector::PollPresentCompletion()
+    {
+        if (!presentWaitSupported_) return;
+
+        // Zero timeout, only collects presents that already happened
+        while (const uint64_t frameId = latencyTracker_.GetOldestUnpresentedFrame())
+        {
+            VkResult result = vkWaitForPresentKHR_(device_, swapChain_, frameId, 0);
+            if (result == VK_TIMEOUT) break;
+            if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+            {
+                DropPendingPresents();
+                break;
+            }
+            PresentFrameRecord(frameId, latencyTracker_.FramePresented(frameId, Profiler::CpuProfiler::Now()));
         }
     }
 
@@ -2483,10 +3633,8 @@ namespace Projector
             throw std::runtime_error("failed to begin recording warp command buffer");
         }
 
-        vkCmdResetQueryPool(commandBuffer, warpQueryPool_, 0, 2);
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, warpQueryPool_, 0);
-
-        warpTimer_.RecordStartTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+        warpPipelineStats_.BeginFrame(commandBuffer, warpInFlightFence_, warpFrameSerial_);
+        warpTimer_.RecordStartTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, warpInFlightFence_, warpFrameSerial_);
 
         std::array<VkClearValue, 3> clearValues
         {
@@ -2512,16 +3660,21 @@ namespace Projector
         vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, warpGraphicsPipeline_);
 
-        vkCmdBindDescriptorSets(
-            commandBuffer,
-            VK_PIPELINE_BIND_POINT_GRAPHICS,
-            warpPipelineLayout_,
-            0,
-            1,
-            &warpDescriptorSets_[(renderFrame_ + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT],
-            0,
-            nullptr
-        );
+        // Nothing to warp before the first render frame or right after swapchain recreation, only the overlay is drawn
+        if (lastWarpedFrame_)
+        {
+            const uint32_t uniformOffset = static_cast<uint32_t>(warpFrameSerial_ % MAX_FRAMES_IN_FLIGHT * warpUniformStride_);
+            vkCmdBindDescriptorSets(
+                commandBuffer,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                warpPipelineLayout_,
+                0,
+                1,
+                &warpDescriptorSets_[lastWarpedFrame_ % MAX_FRAMES_IN_FLIGHT],
+                1,
+                &uniformOffset
+            );
+        }
 
         VkViewport viewport
         {
@@ -2541,13 +3694,21 @@ namespace Projector
         };
         vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-        vkCmdDraw(commandBuffer, 6 * gridResolution_.x * gridResolution_.y, 1, 0, 0);
+        warpTimer_.BeginScope(commandBuffer, "warp grid");
+        warpPipelineStats_.Begin(commandBuffer);
+        if (lastWarpedFrame_) vkCmdDraw(commandBuffer, 6 * gridResolution_.x * gridResolution_.y, 1, 0, 0);
+        warpPipelineStats_.End(commandBuffer);
+        warpTimer_.EndScope(commandBuffer);
 
-        ImDrawData* draw_data = ImGui::GetDrawData();
-        ImGui_ImplVulkan_RenderDrawData(draw_data, commandBuffer);
+        if (!headless_)
+        {
+            warpTimer_.BeginScope(commandBuffer, "imgui");
+            ImDrawData* draw_data = ImGui::GetDrawData();
+            ImGui_ImplVulkan_RenderDrawData(draw_data, commandBuffer);
+            warpTimer_.EndScope(commandBuffer);
+        }
 
         vkCmdEndRenderPass(commandBuffer);
-        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, warpQueryPool_, 1);
         warpTimer_.RecordEndTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
         if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
@@ -2556,111 +3717,47 @@ namespace Projector
         }
     }
 
-    const FrameStats Projector::GetFrameStats() const
+    void Projector::WaitFrameQueuesIdle()
     {
-        FrameStats stats =
-        {
-            .renderStartStamps = std::vector<uint64_t>(MAX_FRAMES_IN_FLIGHT, 0),
-            .renderEndStamps = std::vector<uint64_t>(MAX_FRAMES_IN_FLIGHT, 0),
-            .renderTimes = std::vector<float>(MAX_FRAMES_IN_FLIGHT, 0.0f),
-            .warpTime = 0.0f,
-        };
+        // Not vkDeviceWaitIdle, that needs every queue externally synchronized & the texture streaming thread submits
+        // to its own queues concurrently. Nothing waited on here is read or written by its uploads.
+        vkQueueWaitIdle(graphicsQueue_);
+        vkQueueWaitIdle(warpQueue_);
+        if (presentQueue_ != warpQueue_) vkQueueWaitIdle(presentQueue_);
+    }
 
-        // Render pass
+    void Projector::RecreateSwapChain()
+    {
+        PROFILE_ZONE("recreate swapchain");
+        // Pause the render thread between frames, its targets & pipeline are about to be replaced
+        std::lock_guard<std::mutex> renderLock(renderMutex_);
+        if (headless_)
         {
-            std::vector<uint64_t> results(MAX_FRAMES_IN_FLIGHT * 2 * 2, 0);
-            VkResult result = vkGetQueryPoolResults(
-                device_,
-                renderQueryPool_,
-                0,
-                MAX_FRAMES_IN_FLIGHT * 2, // 2 queries/timestamps per frame (start & end)
-                results.size() * sizeof(uint64_t), // 2 uint64_t entries per query/timestamp (result & availability value)
-                results.data(),
-                2 * sizeof(uint64_t),
-                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
-            );
-            if (result != VK_SUCCESS && result != VK_NOT_READY)
-            {
-                throw std::runtime_error(std::string("failed to get render query pool results: ") + string_VkResult(result));
-            }
+            std::cout << "Recreating offscreen targets" << std::endl;
 
-            for (uint64_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-            {
-                uint64_t startTimeStamp = 0;
-                uint64_t endTimeStamp = 0;
-                if (results[4*i + 1] != 0)
-                {
-                    startTimeStamp = results[4*i + 0];
-                }
-                if (results[4*i + 3] != 0)
-                {
-                    endTimeStamp = results[4*i + 2];
-                }
-                if (startTimeStamp != 0 && endTimeStamp != 0)
-                {
-                    stats.renderStartStamps[i] = startTimeStamp;
-                    stats.renderEndStamps[i] = endTimeStamp;
-                    stats.renderTimes[i] = (endTimeStamp - startTimeStamp) * timeStampPeriod_ * 0.000001f;
-                }
-            }
-        }
-        
+            WaitFrameQueuesIdle();
+            CleanupSwapChain();
 
-        // Warp pass
+            CreateOffscreenTargets();
+        }
+        else
         {
-            std::vector<uint64_t> results(2 * 2, 0);
-            VkResult result = vkGetQueryPoolResults(
-                device_,
-                warpQueryPool_,
-                0,
-                2, // 2 queries/timestamps (start & end)
-                results.size() * sizeof(uint64_t), // 2 uint64_t entries per query/timestamp (result & availability value)
-                results.data(),
-                2 * sizeof(uint64_t),
-                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
-            );
-            if (result != VK_SUCCESS && result != VK_NOT_READY)
+            int width = 0, height = 0;
+            glfwGetFramebufferSize(window_, &width, &height);
+            while (width == 0 || height == 0)
             {
-                throw std::runtime_error(std::string("failed to get warp query pool results: ") + string_VkResult(result));
+                glfwGetFramebufferSize(window_, &width, &height);
+                glfwWaitEvents();
             }
 
-            uint64_t startTimeStamp = 0;
-            uint64_t endTimeStamp = 0;
-            if (results[1] != 0)
-            {
-                startTimeStamp = results[0];
-            }
-            if (results[3] != 0)
-            {
-                endTimeStamp = results[2];
-            }
-            if (startTimeStamp != 0 && endTimeStamp != 0)
-            {
-                stats.warpStartStamp = startTimeStamp;
-                stats.warpEndStamp = endTimeStamp;
-                stats.warpTime = (endTimeStamp - startTimeStamp) * timeStampPeriod_ * 0.000001f;
-            }
-        }
+            std::cout << "Recreating swapchain" << std::endl;
 
-        return stats;
-    }
+            WaitFrameQueuesIdle();
+            CleanupSwapChain();
+            DropPendingPresents();
 
-    void Projector::RecreateSwapChain()
-    {
-        int width = 0, height = 0;
-        glfwGetFramebufferSize(window_, &width, &height);
-        while (width == 0 || height == 0)
-        {
-            glfwGetFramebufferSize(window_, &width, &height);
-            glfwWaitEvents();
+            CreateSwapChain();
         }
-
-        std::cout << "Recreating swapchain" << std::endl;
-
-        vkDeviceWaitIdle(device_);
-        CleanupSwapChain();
-
-        CreateSwapChain();
         CreateImageViews();
         CreateRenderPass();
         CreateDescriptorSetLayout();
@@ -2670,32 +3767,49 @@ namespace Projector
         CreateDescriptorSets();
         CreateFramebuffers();
         CreateGraphicsPipeline();
+
+        // The new result images hold no render frames yet
+        for (RenderSlot& slot : renderSlots_)
+        {
+            slot.serial = 0;
+        }
     }
 
     void Projector::CleanupSwapChain()
     {
         vkDestroyImageView(device_, colorImageView_, nullptr);
         vkDestroyImage(device_, colorImage_, nullptr);
-        vkFreeMemory(device_, colorImageMemory_, nullptr);
+        Memory::Free(colorImageMemory_);
 
         vkDestroyImageView(device_, renderDepthImageView_, nullptr);
         vkDestroyImage(device_, renderDepthImage_, nullptr);
-        vkFreeMemory(device_, renderDepthImageMemory_, nullptr);
+        Memory::Free(renderDepthImageMemory_);
 
         vkDestroyImageView(device_, shadingRateImageView_, nullptr);
         vkDestroyImage(device_, shadingRateImage_, nullptr);
-        vkFreeMemory(device_, shadingRateImageMemory_, nullptr);
+        Memory::Free(shadingRateImageMemory_);
 
         for (size_t i = 0; i < resultImageViews_.size(); i++) // MAX_FRAMES_IN_FLIGHT
         {
             vkDestroyImageView(device_, resultImageViews_[i], nullptr);
             vkDestroyImage(device_, resultImages_[i], nullptr);
-            vkFreeMemory(device_, resultImagesMemory_[i], nullptr);
+            Memory::Free(resultImagesMemory_[i]);
+        }
+
+        for (size_t i = 0; i < resultImageViewsDepth_.size(); i++) // MAX_FRAMES_IN_FLIGHT
+        {
+            vkDestroyImageView(device_, resultImageViewsDepth_[i], nullptr);
+            vkDestroyImage(device_, resultImagesDepth_[i], nullptr);
+            Memory::Free(resultImagesMemoryDepth_[i]);
         }
 
         vkDestroyImageView(device_, warpColorImageView_, nullptr);
         vkDestroyImage(device_, warpColorImage_, nullptr);
-        vkFreeMemory(device_, warpColorImageMemory_, nullptr);
+        Memory::Free(warpColorImageMemory_);
+
+        vkDestroyImageView(device_, warpDepthImageView_, nullptr);
+        vkDestroyImage(device_, warpDepthImage_, nullptr);
+        Memory::Free(warpDepthImageMemory_);
 
         vkDestroySampler(device_, warpSampler_, nullptr);
 
@@ -2718,7 +3832,20 @@ namespace Projector
             vkDestroyImageView(device_, swapChainImageViews_[i], nullptr);
         }
 
-        vkDestroySwapchainKHR(device_, swapChain_, nullptr);
+        if (headless_)
+        {
+            for (size_t i = 0; i < offscreenImagesMemory_.size(); i++)
+            {
+                vkDestroyImage(device_, swapChainImages_[i], nullptr);
+                Memory::Free(offscreenImagesMemory_[i]);
+            }
+            offscreenImagesMemory_.clear();
+            swapChainImages_.clear();
+        }
+        else
+        {
+            vkDestroySwapchainKHR(device_, swapChain_, nullptr);
+        }
     }
 
     void Projector::FramebufferResizeCallback(GLFWwindow* window, int width, int height)
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <iostream>
+#include <mutex>
+#include <exception>
 #include <optional>
 #include <memory>
 #include <set>
@@ -33,8 +36,13 @@
 
 #include "config.hpp"
 #include "input.hpp"
+#include "jobs.hpp"
+#include "memory.hpp"
+#include "metrics.hpp"
 #include "scene.hpp"
+#include "scheduler.hpp"
 #include "stats.hpp"
+#include "upload.hpp"
 #include "util.hpp"
 
 namespace Projector
@@ -46,15 +54,19 @@ namespace Projector
 #endif
 	};
 	const std::vector<const char*> deviceExtensions =
+	{
+		VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME, // VK_KHR_fragment_shading_rate, optional for offscreen runs
+	};
+	const std::vector<const char*> presentDeviceExtensions =
 	{
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME, // VK_KHR_swapchain
-		VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME, // VK_KHR_fragment_shading_rate
 	};
 
 	struct QueueFamilyIndices
 	{
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		std::optional<uint32_t> transferFamily; // Transfer only, typically a dedicated copy engine
 
 		const bool IsComplete() const;
 	};
@@ -90,14 +102,18 @@ namespace Projector
 		glm::vec2 rotation;
 	};
 
-	struct FrameStats
+	struct LaunchOptions
 	{
-		std::vector<uint64_t> renderStartStamps;
-		std::vector<uint64_t> renderEndStamps;
-		std::vector<float> renderTimes;
-		uint64_t warpStartStamp;
-		uint64_t warpEndStamp;
-		float warpTime;
+		bool headless = false; // Render offscreen without a window, surface or swapchain
+		uint32_t benchmarkFrames = 1000; // Warp frames to run in headless mode
+		VkExtent2D headlessExtent = { 1280, 720 };
+		std::string recordPath; // Record the warp camera path to this file
+		std::string replayPath; // Drive the camera from a recorded path at a fixed timestep
+		std::string tracePath; // Write a Chrome trace of recent CPU zones & GPU scopes here on exit
+		std::string metricsPath; // Stream per-frame metrics here (.csv or JSON lines)
+		uint32_t inputRate = 1000; // Pose samples per second taken by the input thread
+		bool streamTextures = false; // Start rendering with placeholder textures, loading the real ones in the background
+		Scene::VertexLayout vertexLayout = Scene::VertexLayout::Packed; // Scene vertex buffer layout
 	};
 
 	enum VariableRateShadingMode
@@ -114,10 +130,43 @@ namespace Projector
 		"4x4"
 	};
 
+	// What the render thread takes from the warp thread for each frame, published as a whole. The settings
+	// are also stamped on the frame's metrics record.
+	struct RenderInputs
+	{
+		Player pose;
+		bool doRender;
+		int framerate;
+		float fov;
+		float aspect;
+		glm::ivec2 gridResolution;
+		float overdrawDegrees;
+		VariableRateShadingMode variableRateShadingMode;
+		bool parallelRecording;
+	};
+
+	// Handoff of one frame-in-flight result image from the render thread to the warp thread. The render thread
+	// clears serial before rewriting the slot and sets it once the frame is submitted; the warp thread claims
+	// the slot for a warp frame before sampling it, which the render thread then waits for on the GPU.
+	struct RenderSlot
+	{
+		std::atomic<uint64_t> serial = 0; // Render frame held by the slot, 0 while being rewritten
+		Input::SeqlockPayload<Player> pose; // Pose the frame was rendered from, valid while serial is
+		std::atomic<uint64_t> warpClaim = 0; // Last warp frame to sample the slot
+	};
+
+	// The render thread's GPU stats & pacing, copied out after each readback for the overlay to draw
+	struct RenderStatsSnapshot
+	{
+		std::vector<DeviceOpTimer::Scope> timerScopes;
+		std::array<RollingStats, PipelineStatsQuery::CounterCount> counters;
+		Scheduler::StreamPacing pacing = {};
+	};
+
 	class Projector
 	{
 	public:
-		Projector();
+		Projector(const LaunchOptions& options = {});
 		~Projector();
 
 		void Run();
@@ -131,7 +180,9 @@ namespace Projector
 		const QueueFamilyIndices FindQueueFamilies(VkPhysicalDevice device) const;
 		void ListDeviceDetails(VkPhysicalDevice device) const;
 		const bool CheckDeviceExtensionSupport(VkPhysicalDevice device) const;
+		const bool IsDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName) const;
 		const bool IsDeviceSuitable(VkPhysicalDevice device) const;
+		std::unique_lock<std::mutex> LockSharedQueue();
 		const VkShaderModule CreateShaderModule(const std::vector<char>& code) const;
 		const VkFormat FindSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) const;
 		const VkFormat FindDepthFormat() const;
@@ -142,10 +193,16 @@ namespace Projector
 		void CreateSurface();
 		void PickPhysicalDevice();
 		void CreateLogicalDevice();
-		void CreateQueryPool();
 		void CreateSwapChain();
+		void CreateOffscreenTargets();
 		void CreateImageViews();
 		void CreateCommandPool();
+		void CalibrateGpuClock();
+		// Re-pairs the timer's GPU timestamps with the host clock once the last calibration is old enough to have
+		// drifted. Called from the thread that reads the timer back.
+		void RecalibrateGpuClock(DeviceOpTimer& timer);
+		// Reads the device & host clocks together, returns the deviation of the tightest of a few samples in ns
+		const uint64_t SampleCalibratedTimestamps(uint64_t& deviceTimestamp, uint64_t& hostNs) const;
 		void CreateRenderPass();
 		void CreateDescriptorSetLayout();
 		void CreateDescriptorPool();
@@ -159,14 +216,40 @@ namespace Projector
 		void CreateSyncObjects();
 		void InitImGui();
 
-		void UpdateUniformBuffer(bool render);
-		void DrawFrame();
-		void WarpPresent();
-		void RecordDraw(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+		void UpdateProjectionParameters();
+		void UpdateRenderUniformBuffer(const RenderInputs& inputs);
+		void UpdateWarpUniformBuffer(uint64_t latchNs);
+		void RenderLoop();
+		// Stops & joins the render thread if it runs, then waits for the frame queues
+		void StopRenderThread();
+		void DrawFrame(uint64_t targetNs);
+		void WarpPresent(uint64_t targetNs);
+		const uint64_t ClaimRenderFrame(uint64_t warpFrameId);
+		const RenderInputs CaptureRenderInputs() const;
+		void PublishRenderInputs();
+		const RenderInputs GetRenderInputs();
+		void RecordDraw(VkCommandBuffer commandBuffer, uint32_t frameIndex, bool parallelRecording);
+		void RecordSceneState(VkCommandBuffer commandBuffer);
 		void RecordWarp(VkCommandBuffer commandBuffer, uint32_t frameIndex);
-		const FrameStats GetFrameStats() const;
+
+		void PollPresentCompletion();
+		void UpdateRenderStats();
+		void UpdateWarpStats();
+		struct PendingFrameRecord; // Defined with the metrics members below
+		void StageFrameStatistics(Metrics::FrameKind kind, uint64_t frameId, const std::array<uint64_t, PipelineStatsQuery::CounterCount>& counters);
+		void StageFrameRecord(Metrics::FrameKind kind, uint64_t frameId, uint64_t renderFrameId, uint64_t startNs, const RenderInputs& settings);
+		void CompleteFrameRecord(Metrics::FrameKind kind, uint64_t frameId, float gpuMs, float inputToGpuDoneMs);
+		void PresentFrameRecord(uint64_t frameId, float inputToPresentMs);
+		// Releases warp records whose present will never be reported, along with the latency tracker's
+		void DropPendingPresents();
+		void EmitFrameRecord(PendingFrameRecord& pending);
+
+		void RunHeadless();
+		void PrintBenchmarkSummary(const std::vector<float>& renderCpuTimes, const std::vector<float>& warpCpuTimes) const;
 
 		void RecreateSwapChain();
+		// Waits for the render, warp & present queues, the caller keeps the render thread off them
+		void WaitFrameQueuesIdle();
 		void CleanupSwapChain();
 
 		static void FramebufferResizeCallback(GLFWwindow* window, int width, int height);
@@ -176,15 +259,16 @@ namespace Projector
 		VkPhysicalDevice physicalDevice_ = VK_NULL_HANDLE;
 		VkDevice device_ = VK_NULL_HANDLE;
 		float timeStampPeriod_;
+		// Backs every buffer & image the app creates, freed last before the device
+		std::unique_ptr<Memory::Allocator> allocator_;
 
 		// Queues
 		VkQueue graphicsQueue_ = VK_NULL_HANDLE;
 		VkQueue warpQueue_ = VK_NULL_HANDLE;
 		VkQueue presentQueue_ = VK_NULL_HANDLE;
-
-		// Query pools
-		VkQueryPool renderQueryPool_;
-		VkQueryPool warpQueryPool_;
+		VkQueue streamQueue_ = VK_NULL_HANDLE; // Texture streaming uploads, if requested & the graphics family has a queue to spare
+		VkQueue transferQueue_ = VK_NULL_HANDLE; // Of the dedicated transfer family if there is one
+		std::mutex sharedQueueMutex_; // Serializes render & warp submits when the graphics family has a single queue
 
 		// Window & surface
 		GLFWwindow* window_ = VK_NULL_HANDLE;
@@ -200,39 +284,46 @@ namespace Projector
 		std::vector<VkFramebuffer> warpFramebuffers_;
 		bool framebufferResized_ = false;
 
+		// Headless offscreen targets, stand-ins for swapchain images
+		bool headless_ = false;
+		bool streamTextures_ = false;
+		Scene::VertexLayout vertexLayout_ = Scene::VertexLayout::Packed;
+		uint32_t benchmarkFrames_ = 0;
+		std::vector<Memory::Allocation> offscreenImagesMemory_;
+
 		// Render depth buffer/image
 		VkImage renderDepthImage_ = VK_NULL_HANDLE;
-		VkDeviceMemory renderDepthImageMemory_ = VK_NULL_HANDLE;
+		Memory::Allocation renderDepthImageMemory_;
 		VkImageView renderDepthImageView_ = VK_NULL_HANDLE;
 
 		// WArp depth buffer/image
 		VkImage warpDepthImage_ = VK_NULL_HANDLE;
-		VkDeviceMemory warpDepthImageMemory_ = VK_NULL_HANDLE;
+		Memory::Allocation warpDepthImageMemory_;
 		VkImageView warpDepthImageView_ = VK_NULL_HANDLE;
 
 		// MSAA / color buffer image
 		VkImage colorImage_ = VK_NULL_HANDLE;
-		VkDeviceMemory colorImageMemory_ = VK_NULL_HANDLE;
+		Memory::Allocation colorImageMemory_;
 		VkImageView colorImageView_ = VK_NULL_HANDLE;
 
 		// Shading rate map
 		VkImage shadingRateImage_ = VK_NULL_HANDLE;
-		VkDeviceMemory shadingRateImageMemory_ = VK_NULL_HANDLE;
+		Memory::Allocation shadingRateImageMemory_;
 		VkImageView shadingRateImageView_ = VK_NULL_HANDLE;
 
 		// Warp MSAA / color buffer image
 		VkImage warpColorImage_ = VK_NULL_HANDLE;
-		VkDeviceMemory warpColorImageMemory_ = VK_NULL_HANDLE;
+		Memory::Allocation warpColorImageMemory_;
 		VkImageView warpColorImageView_ = VK_NULL_HANDLE;
 
 		VkExtent2D renderExtent_;
 
 		std::vector<VkImage> resultImages_;
-		std::vector<VkDeviceMemory> resultImagesMemory_;
+		std::vector<Memory::Allocation> resultImagesMemory_;
 		std::vector<VkImageView> resultImageViews_;
 		
 		std::vector<VkImage> resultImagesDepth_;
-		std::vector<VkDeviceMemory> resultImagesMemoryDepth_;
+		std::vector<Memory::Allocation> resultImagesMemoryDepth_;
 		std::vector<VkImageView> resultImageViewsDepth_;
 
 		// Render pipeline, resource descriptors & passes
@@ -249,21 +340,37 @@ namespace Projector
 		VkDescriptorPool descriptorPool_ = VK_NULL_HANDLE;
 		std::vector<VkDescriptorSet> descriptorSets_;
 		std::vector<VkBuffer> uniformBuffers_;
-		std::vector<VkDeviceMemory> uniformBuffersMemory_;
+		std::vector<Memory::Allocation> uniformBuffersMemory_;
 		std::vector<void*> uniformBuffersMapped_;
 
 		VkDescriptorSetLayout warpDescriptorSetLayout_ = VK_NULL_HANDLE;
 		VkSampler warpSampler_ = VK_NULL_HANDLE;
 		VkSampler warpSamplerDepth_ = VK_NULL_HANDLE;
 		std::vector<VkDescriptorSet> warpDescriptorSets_;
+		// One slot per warp frame, bound through a dynamic offset so the pose can be latched after recording
 		VkBuffer warpUniformBuffer_ = VK_NULL_HANDLE;
-		VkDeviceMemory warpUniformBufferMemory_ = VK_NULL_HANDLE;
+		Memory::Allocation warpUniformBufferMemory_;
 		void* warpUniformBufferMapped_;
+		VkDeviceSize warpUniformStride_ = 0;
+
+		// Scene loading uploads. The dedicated transfer queue goes to the context streaming textures if there is
+		// one, as that's where copies overlap rendering, else to the one loading the scene up front.
+		std::unique_ptr<Upload::UploadContext> uploads_;
+		std::unique_ptr<Upload::UploadContext> streamUploads_;
 
-		// Command buffers & syncing
-		VkCommandPool commandPool_ = VK_NULL_HANDLE;
+		// Shared by scene loading & parallel command recording
+		std::unique_ptr<Jobs::JobSystem> jobs_;
+
+		// Command buffers & syncing, the render & warp threads record from their own pools
+		VkCommandPool commandPool_ = VK_NULL_HANDLE; // Warp thread & one-off setup commands
+		VkCommandPool renderCommandPool_ = VK_NULL_HANDLE;
 		std::vector<VkCommandBuffer> drawCommandBuffers_;
-		VkSemaphore renderReadySemaphore_; // VK_SEMAPHORE_TYPE_TIMELINE
+		// Scene draws recorded into secondary command buffers, one pool & buffer per frame in flight & record chunk
+		uint32_t recordChunkCount_ = 1;
+		std::vector<VkCommandPool> recordCommandPools_;
+		std::vector<VkCommandBuffer> recordCommandBuffers_;
+		VkSemaphore renderReadySemaphore_; // VK_SEMAPHORE_TYPE_TIMELINE, signalled with the render frame serial
+		VkSemaphore warpDoneSemaphore_; // VK_SEMAPHORE_TYPE_TIMELINE, signalled with the warp frame serial
 		VkCommandBuffer warpCommandBuffer_ = VK_NULL_HANDLE;
 		VkSemaphore imageAvailableSemaphore_ = VK_NULL_HANDLE;
 		VkSemaphore warpFinishedSemaphore_ = VK_NULL_HANDLE;
@@ -276,8 +383,20 @@ namespace Projector
 		uint64_t renderFrame_ = 0;
 		uint64_t warpFrame_ = 0;
 
-		uint64_t lastRenderedFrame_ = 0;
-		uint64_t lastWarpedFrame_ = 0;
+		uint64_t lastWarpedFrame_ = 0; // Render frame sampled by the latest warp, 0 if none yet
+
+		// Render thread, the main thread doubles as the warp thread since GLFW & ImGui must stay on it
+		std::thread renderThread_;
+		std::atomic<bool> stopRendering_ = false;
+		std::atomic<bool> renderFailed_ = false;
+		std::exception_ptr renderException_; // Thrown on the render thread, rethrown by Run after joining it
+		std::mutex renderMutex_; // Held by the render thread for each frame, taken to pause it e.g. for swapchain recreation
+		std::array<RenderSlot, MAX_FRAMES_IN_FLIGHT> renderSlots_;
+		std::atomic<uint64_t> renderSubmittedSerial_ = 0;
+		std::mutex renderInputsMutex_;
+		RenderInputs renderInputs_ = {};
+		std::mutex renderStatsMutex_;
+		RenderStatsSnapshot renderStats_;
 
 		// MSAA
 		VkSampleCountFlagBits msaaSamples_ = VK_SAMPLE_COUNT_1_BIT;
@@ -285,6 +404,8 @@ namespace Projector
 		// Shading rate properties
 		VkPhysicalDeviceFragmentShadingRatePropertiesKHR shadingRateProperties_;
 		std::vector<VkPhysicalDeviceFragmentShadingRateKHR> shadingRates_;
+		bool variableRateShadingSupported_ = false; // Required for windowed runs, offscreen runs render at full rate without it
+		PFN_vkCmdSetFragmentShadingRateKHR vkCmdSetFragmentShadingRateKHR_ = nullptr;
 
 		// Misc
 		uint16_t objectIndex_ = 0;
@@ -299,11 +420,28 @@ namespace Projector
 		DeviceOpTimer renderTimer_;
 		DeviceOpTimer warpTimer_;
 
+		// Render & warp frame pacing, each thread sleeps on its own scheduler
+		Scheduler::FrameScheduler scheduler_;
+		Scheduler::FrameScheduler renderScheduler_;
+
+		// Queries are reset from the host instead of in command buffers when supported
+		bool hostQueryResetSupported_ = false;
+
+		// Pipeline statistics for the scene draws & the warp grid
+		bool pipelineStatisticsSupported_ = false;
+		bool inheritedQueriesSupported_ = false;
+		bool renderFrameCounted_ = false; // Whether the render frame being recorded runs the statistics query
+		PipelineStatsQuery renderPipelineStats_;
+		PipelineStatsQuery warpPipelineStats_;
+
 		// Settings
 		bool doRender_ = true;
+		bool parallelRecording_ = true;
 		bool doAsyncWarp_ = true;
 		int renderFramerate_ = 60;
 		int warpFramerate_ = 120;
+		bool alignWarpToRender_ = true;
+		float warpPhase_ = 0.0f;
 		float fov_ = 72.0f;
 		float overdrawDegreesChange_ = 8.0f;
 		float overdrawDegrees_ = overdrawDegreesChange_;
@@ -321,8 +459,46 @@ namespace Projector
 		float overshootAdditionalScreenScale_;
 		float renderScale_ = 1.0f;
 
-		// Player
+		// Player, playerRender_ being the pose of the render frame the warp thread last sampled. Live poses come
+		// from the input thread, sampled at each frame's deadline.
 		Player playerRender_ = {};
 		Player playerWarp_ = { .position = glm::vec3(0, 1.2f, 0) };
+		std::unique_ptr<Input::PoseTracker> poseTracker_;
+
+		// Profiling
+		bool calibratedTimestampsSupported_ = false;
+		VkTimeDomainEXT hostTimeDomain_ = VK_TIME_DOMAIN_DEVICE_EXT; // Host domain the profiler clock is built on
+		PFN_vkGetCalibratedTimestampsEXT vkGetCalibratedTimestampsEXT_ = nullptr;
+		std::string tracePath_;
+
+		// Motion-to-photon latency, warp frames are identified by a serial that doubles as the present id
+		LatencyTracker latencyTracker_;
+		uint64_t warpFrameSerial_ = 0;
+		uint64_t warpInputNs_ = 0; // Input time of the warp frame being recorded
+		bool presentWaitSupported_ = false;
+		PFN_vkWaitForPresentKHR vkWaitForPresentKHR_ = nullptr;
+
+		// Per-frame metrics, staged on the CPU side until the frame's GPU time, its pipeline statistics and for
+		// presented warp frames the present all come back. Each is reported independently, in any order.
+		struct PendingFrameRecord
+		{
+			Metrics::FrameRecord record = {};
+			bool timed = false;
+			bool awaitingStatistics = false;
+			bool awaitingPresent = false;
+		};
+		std::unique_ptr<Metrics::MetricsSink> metricsSink_;
+		std::array<PendingFrameRecord, 16> pendingRenderRecords_ = {};
+		std::array<PendingFrameRecord, 16> pendingWarpRecords_ = {};
+		uint64_t renderFrameSerial_ = 0;
+		float warpLateMs_ = 0;
+		uint32_t warpMissedSlots_ = 0; // As counted by the scheduler, which may have skipped slots since the last warp
+		float warpInputToSubmitMs_ = -1.0f;
+
+		// Camera path record & replay
+		std::unique_ptr<Input::PoseRecorder> poseRecorder_;
+		std::unique_ptr<Input::PosePlayback> posePlayback_;
+		float replayTime_ = 0;
+		bool replayFinished_ = false;
 	};
 }
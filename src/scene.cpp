@@ -4,15 +4,22 @@
 
 #include "scene.hpp"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <sys/stat.h>
 
 #include <ktx.h>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include "config.hpp"
+#include "profiler.hpp"
 #include "util.hpp"
 
 namespace Scene
@@ -28,13 +35,13 @@ namespace Scene
 		{
 			vkDestroyImageView(device, view, nullptr);
 			vkDestroyImage(device, image, nullptr);
-			vkFreeMemory(device, deviceMemory, nullptr);
+			Memory::Free(deviceMemory);
 			vkDestroySampler(device, sampler, nullptr);
             std::cout << "Destroyed GPU texture '" << uri << "'" << std::endl;
 		}
 	}
 
-	Texture::Texture(tinygltf::Image& gltfimage, const std::string path, const VkPhysicalDevice& physicalDevice, const VkDevice& d, const VkCommandPool& commandPool, const VkQueue& copyQueue, const VkDescriptorPool& descriptorSetPool)
+	Texture::Texture(tinygltf::Image& gltfimage, const std::string path, const VkPhysicalDevice& physicalDevice, const VkDevice& d, Upload::UploadContext& uploads, const VkDescriptorPool& descriptorSetPool)
 		: device(d) , uri(gltfimage.uri)
     {
         // Check if image points to an external ktx file
@@ -63,18 +70,7 @@ namespace Scene
             {
                 bufferSize = gltfimage.width * gltfimage.height * 4;
                 buffer = new unsigned char[bufferSize];
-
-                unsigned char* rgba = buffer;
-                unsigned char* rgb = &gltfimage.image[0];
-                for (size_t i = 0; i < gltfimage.width * gltfimage.height; ++i)
-                {
-                    for (int32_t j = 0; j < 3; ++j)
-                    {
-                        rgba[j] = rgb[j];
-                    }
-                    rgba += 4;
-                    rgb += 3;
-                }
+                ExpandRgbToRgba(&gltfimage.image[0], gltfimage.width * gltfimage.height, buffer);
                 deleteBuffer = true;
             }
             else
@@ -83,18 +79,8 @@ namespace Scene
                 bufferSize = gltfimage.image.size();
             }
 
-            VkBuffer stagingBuffer;
-            VkDeviceMemory stagingBufferMemory;
-
-            Util::CreateBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-            uint8_t* data;
-            VK_CHECK_RESULT(vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, (void**)&data));
-            memcpy(data, buffer, static_cast<size_t>(bufferSize));
-            vkUnmapMemory(device, stagingBufferMemory);
-
             Util::CreateImage(
-                physicalDevice,
+                uploads.GetAllocator(),
                 device,
                 width,
                 height,
@@ -104,18 +90,13 @@ namespace Scene
                 VK_IMAGE_TILING_OPTIMAL,
                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                Memory::Textures,
                 image,
                 deviceMemory
             );
 
-            Util::TransitionImageLayout(device, commandPool, copyQueue, image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-            Util::CopyBufferToImage(device, commandPool, copyQueue, stagingBuffer, image, width, height);
-
-            vkDestroyBuffer(device, stagingBuffer, nullptr);
-            vkFreeMemory(device, stagingBufferMemory, nullptr);
-
-            //Util::TransitionImageLayout(device, commandPool, copyQueue, image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
-            Util::GenerateMipmaps(physicalDevice, device, commandPool, copyQueue, image, VK_FORMAT_R8G8B8A8_UNORM, width, height, mipLevels);
+            // Staged right away, the buffer can go once recorded
+            uploads.UploadImage(image, VK_FORMAT_R8G8B8A8_UNORM, width, height, mipLevels, buffer, bufferSize);
 
             if (deleteBuffer)
             {
@@ -147,26 +128,9 @@ namespace Scene
             ktx_uint8_t* ktxTextureData = ktxTexture_GetData(ktxTexture);
             ktx_size_t ktxTextureSize = ktxTexture_GetDataSize(ktxTexture);
 
-            VkBuffer stagingBuffer;
-            VkDeviceMemory stagingBufferMemory;
-
-            Util::CreateBuffer(physicalDevice, device, ktxTextureSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-            uint8_t* data;
-            vkMapMemory(device, stagingBufferMemory, 0, ktxTextureSize, 0, (void**)&data);
-            memcpy(data, ktxTextureData, ktxTextureSize);
-            vkUnmapMemory(device, stagingBufferMemory);
+            Util::CreateImage(uploads.GetAllocator(), device, width, height, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Textures, image, deviceMemory);
 
-            Util::CreateImage(physicalDevice, device, width, height, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, deviceMemory);
-
-            Util::TransitionImageLayout(device, commandPool, copyQueue, image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-            Util::CopyBufferToImage(device, commandPool, copyQueue, stagingBuffer, image, width, height);
-
-            vkDestroyBuffer(device, stagingBuffer, nullptr);
-            vkFreeMemory(device, stagingBufferMemory, nullptr);
-
-            //Util::TransitionImageLayout(device, commandPool, copyQueue, image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
-            Util::GenerateMipmaps(physicalDevice, device, commandPool, copyQueue, image, VK_FORMAT_R8G8B8A8_UNORM, width,height, mipLevels);
+            uploads.UploadImage(image, VK_FORMAT_R8G8B8A8_UNORM, width, height, mipLevels, ktxTextureData, ktxTextureSize);
 
             ktxTexture_Destroy(ktxTexture);
         }
@@ -205,7 +169,7 @@ namespace Scene
         std::cout << "Created glTF GPU texture '" << uri << "' [" << width << 'x' << height << "]" << std::endl;
     }
 
-    Texture::Texture(const std::string path, const VkPhysicalDevice& physicalDevice, const VkDevice& d, const VkCommandPool& commandPool, const VkQueue& copyQueue, const VkDescriptorPool& descriptorSetPool)
+    Texture::Texture(const std::string path, const VkPhysicalDevice& physicalDevice, const VkDevice& d, Upload::UploadContext& uploads, const VkDescriptorPool& descriptorSetPool)
         : device(d), uri(path)
     {
         int texWidth, texHeight, texChannels;
@@ -223,27 +187,10 @@ namespace Scene
 
         mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-
-        Util::CreateBuffer(physicalDevice, device, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-        uint8_t* data;
-        VK_CHECK_RESULT(vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, (void**)&data));
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
-        vkUnmapMemory(device, stagingBufferMemory);
+        Util::CreateImage(uploads.GetAllocator(), device, texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Textures, image, deviceMemory);
 
+        uploads.UploadImage(image, VK_FORMAT_R8G8B8A8_UNORM, width, height, mipLevels, pixels, imageSize);
         stbi_image_free(pixels);
-        Util::CreateImage(physicalDevice, device, texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, deviceMemory);
-
-        Util::TransitionImageLayout(device, commandPool, copyQueue, image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-        Util::CopyBufferToImage(device, commandPool, copyQueue, stagingBuffer, image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
-
-        //TransitionImageLayout(textureImage_, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels_);
-        Util::GenerateMipmaps(physicalDevice, device, commandPool, copyQueue, image, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
 
         view = Util::CreateImageView(device, image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
 
@@ -333,118 +280,95 @@ namespace Scene
         descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);    
         VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()));
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
         {
-            std::vector<VkDescriptorImageInfo> imageDescriptors{};
-            std::vector<VkWriteDescriptorSet> writeDescriptorSets{};
-
-            //if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor)
-            {
-                imageDescriptors.push_back(baseColorTexture->descriptor);
-                writeDescriptorSets.push_back(VkWriteDescriptorSet{
-                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                    .dstSet = descriptorSets[i],
-                    .dstBinding = static_cast<uint32_t>(writeDescriptorSets.size()),
-                    .descriptorCount = 1,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    .pImageInfo = &baseColorTexture->descriptor,
-                });
-            }
-            //if (normalTexture && descriptorBindingFlags & DescriptorBindingFlags::ImageNormalMap)
-            {
-                imageDescriptors.push_back(normalTexture->descriptor);
-                writeDescriptorSets.push_back(VkWriteDescriptorSet{
-                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                    .dstSet = descriptorSets[i],
-                    .dstBinding = static_cast<uint32_t>(writeDescriptorSets.size()),
-                    .descriptorCount = 1,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    .pImageInfo = &normalTexture->descriptor,
-                });
-            }
-            vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+            WriteDescriptorSet(i);
         }
     }
 
-    Mesh::Mesh(const VkPhysicalDevice& pd, const VkDevice& d, const glm::mat4 matrix)
-        : physicalDevice(pd), device(d)
+    void Material::WriteDescriptorSet(uint32_t frameIndex)
     {
-        Util::CreateBuffer(
-            physicalDevice,
-            device,
-            sizeof(uniformBlock),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            uniformBuffer.buffer,
-            uniformBuffer.memory
-        );
-        VK_CHECK_RESULT(vkMapMemory(d, uniformBuffer.memory, 0, sizeof(uniformBlock), 0, &uniformBuffer.mapped));
-        uniformBuffer.descriptor = VkDescriptorBufferInfo
+        std::vector<VkWriteDescriptorSet> writeDescriptorSets{};
+
+        //if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor)
         {
-           .buffer = uniformBuffer.buffer,
-           .offset = 0,
-           .range = sizeof(uniformBlock)
-        };
-    };
+            writeDescriptorSets.push_back(VkWriteDescriptorSet{
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = descriptorSets[frameIndex],
+                .dstBinding = static_cast<uint32_t>(writeDescriptorSets.size()),
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .pImageInfo = &baseColorTexture->descriptor,
+            });
+        }
+        //if (normalTexture && descriptorBindingFlags & DescriptorBindingFlags::ImageNormalMap)
+        {
+            writeDescriptorSets.push_back(VkWriteDescriptorSet{
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = descriptorSets[frameIndex],
+                .dstBinding = static_cast<uint32_t>(writeDescriptorSets.size()),
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .pImageInfo = &normalTexture->descriptor,
+            });
+        }
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+    }
 
     Mesh::~Mesh()
     {
-        vkDestroyBuffer(device, uniformBuffer.buffer, nullptr);
-        vkFreeMemory(device, uniformBuffer.memory, nullptr);
         for (auto primitive : primitives)
         {
             delete primitive;
         }
     }
 
-    glm::mat4 Node::GetLocalMatrix()
+    const uint32_t TransformHierarchy::Add(int32_t parent)
     {
-        return glm::translate(glm::mat4(1.0f), translation) * glm::mat4(rotation) * glm::scale(glm::mat4(1.0f), scale) * matrix;
+        assert(parent < static_cast<int32_t>(Count()));
+        parents.push_back(parent);
+        translations.push_back(glm::vec3(0.0f));
+        rotations.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+        scales.push_back(glm::vec3(1.0f));
+        matrices.push_back(glm::mat4(1.0f));
+        worlds.push_back(glm::mat4(1.0f));
+        dirty.push_back(1);
+        return Count() - 1;
     }
 
-    glm::mat4 Node::GetMatrix()
+    const glm::mat4 TransformHierarchy::LocalMatrix(uint32_t node) const
     {
-        glm::mat4 m = GetLocalMatrix();
-        Node* p = parent;
-        while (p)
-        {
-            m = p->GetLocalMatrix() * m;
-            p = p->parent;
-        }
-        return m;
+        return glm::translate(glm::mat4(1.0f), translations[node]) * glm::mat4(rotations[node]) * glm::scale(glm::mat4(1.0f), scales[node]) * matrices[node];
     }
 
-    void Node::Update()
+    const TransformHierarchy::Range TransformHierarchy::Propagate()
     {
-        if (mesh)
+        // Parents come first, so a parent's flag & world matrix are final by the time its children are reached
+        Range changed{ Count(), 0 };
+        for (uint32_t node = 0; node < Count(); node++)
         {
-            mesh->uniformBlock.matrix = GetMatrix();
-            memcpy(mesh->uniformBuffer.mapped, &mesh->uniformBlock, sizeof(mesh->uniformBlock));
+            const int32_t parent = parents[node];
+            if (parent >= 0 && dirty[parent]) dirty[node] = 1;
+            if (!dirty[node]) continue;
 
-            //if (skin)
-            //{
-            //    mesh->uniformBlock.matrix = m;
-            //    // Update join matrices
-            //    glm::mat4 inverseTransform = glm::inverse(m);
-            //    for (size_t i = 0; i < skin->joints.size(); i++) {
-            //        vkglTF::Node* jointNode = skin->joints[i];
-            //        glm::mat4 jointMat = jointNode->getMatrix() * skin->inverseBindMatrices[i];
-            //        jointMat = inverseTransform * jointMat;
-            //        mesh->uniformBlock.jointMatrix[i] = jointMat;
-            //    }
-            //    mesh->uniformBlock.jointcount = (float)skin->joints.size();
-            //    memcpy(mesh->uniformBuffer.mapped, &mesh->uniformBlock, sizeof(mesh->uniformBlock));
-            //}
-            //else
-            //{
-            //    memcpy(mesh->uniformBuffer.mapped, &m, sizeof(glm::mat4));
-            //}
+            worlds[node] = parent >= 0 ? worlds[parent] * LocalMatrix(node) : LocalMatrix(node);
+            changed.begin = std::min(changed.begin, node);
+            changed.end = node + 1;
         }
+        if (changed.Empty()) return Range{};
 
-        for (auto& child : children)
+        std::fill(dirty.begin() + changed.begin, dirty.begin() + changed.end, uint8_t(0));
+        return changed;
+    }
+
+    const TransformHierarchy::Range TransformHierarchy::Update(const std::vector<glm::mat4*>& targets)
+    {
+        const Range changed = Propagate();
+        for (uint32_t node = changed.begin; node < changed.end; node++)
         {
-            child->Update();
+            if (targets[node]) *targets[node] = worlds[node];
         }
+        return changed;
     }
 
     Node::~Node()
@@ -459,7 +383,7 @@ namespace Scene
         }
     }
 
-    VkVertexInputBindingDescription Vertex::vertexInputBindingDescription;
+    std::vector<VkVertexInputBindingDescription> Vertex::vertexInputBindingDescriptions;
     std::vector<VkVertexInputAttributeDescription> Vertex::vertexInputAttributeDescriptions;
     VkPipelineVertexInputStateCreateInfo Vertex::pipelineVertexInputStateCreateInfo;
 
@@ -507,16 +431,82 @@ namespace Scene
         return result;
     }
 
+    VertexStream Vertex::GetPackedStream(VertexComponent component)
+    {
+        switch (component)
+        {
+        case VertexComponent::Position:
+            return PositionStream;
+        case VertexComponent::Joint0:
+        case VertexComponent::Weight0:
+            return SkinStream;
+        default:
+            return AttributeStream;
+        }
+    }
+
+    VkVertexInputAttributeDescription Vertex::GetPackedInputAttributeDescription(uint32_t location, VertexComponent component)
+    {
+        const uint32_t binding = GetPackedStream(component);
+        switch (component)
+        {
+        case VertexComponent::Position:
+            return VkVertexInputAttributeDescription({ location, binding, VK_FORMAT_R32G32B32_SFLOAT, 0 });
+        case VertexComponent::Normal:
+            return VkVertexInputAttributeDescription({ location, binding, VK_FORMAT_R16G16_SNORM, offsetof(PackedVertex, normal) });
+        case VertexComponent::UV:
+            return VkVertexInputAttributeDescription({ location, binding, VK_FORMAT_R16G16_SFLOAT, offsetof(PackedVertex, uv) });
+        case VertexComponent::Color:
+            return VkVertexInputAttributeDescription({ location, binding, VK_FORMAT_R8G8B8A8_UNORM, offsetof(PackedVertex, color) });
+        case VertexComponent::Tangent:
+            return VkVertexInputAttributeDescription({ location, binding, VK_FORMAT_R8G8B8A8_SNORM, offsetof(PackedVertex, tangent) });
+        case VertexComponent::Joint0:
+            return VkVertexInputAttributeDescription({ location, binding, VK_FORMAT_R16G16B16A16_UINT, offsetof(SkinVertex, joints) });
+        case VertexComponent::Weight0:
+            return VkVertexInputAttributeDescription({ location, binding, VK_FORMAT_R8G8B8A8_UNORM, offsetof(SkinVertex, weights) });
+        default:
+            return VkVertexInputAttributeDescription({});
+        }
+    }
+
     /** @brief Returns the default pipeline vertex input state create info structure for the requested vertex components */
-    VkPipelineVertexInputStateCreateInfo* Vertex::GetPipelineVertexInputState(const std::vector<VertexComponent> components)
+    VkPipelineVertexInputStateCreateInfo* Vertex::GetPipelineVertexInputState(const std::vector<VertexComponent> components, VertexLayout layout)
     {
-        Vertex::vertexInputBindingDescription = Vertex::GetInputBindingDescription(0);
-        Vertex::vertexInputAttributeDescriptions = Vertex::GetInputAttributeDescriptions(0, components);
+        if (layout == VertexLayout::Full)
+        {
+            Vertex::vertexInputBindingDescriptions = { Vertex::GetInputBindingDescription(0) };
+            Vertex::vertexInputAttributeDescriptions = Vertex::GetInputAttributeDescriptions(0, components);
+        }
+        else
+        {
+            // Only the streams read are bound, a position only pipeline fetches 12 bytes a vertex
+            constexpr uint32_t strides[VertexStreamCount] = { sizeof(glm::vec3), sizeof(PackedVertex), sizeof(SkinVertex) };
+            bool used[VertexStreamCount] = {};
+            Vertex::vertexInputAttributeDescriptions.clear();
+            uint32_t location = 0;
+            for (VertexComponent component : components)
+            {
+                used[GetPackedStream(component)] = true;
+                Vertex::vertexInputAttributeDescriptions.push_back(Vertex::GetPackedInputAttributeDescription(location, component));
+                location++;
+            }
+            Vertex::vertexInputBindingDescriptions.clear();
+            for (uint32_t stream = 0; stream < VertexStreamCount; stream++)
+            {
+                if (!used[stream]) continue;
+                Vertex::vertexInputBindingDescriptions.push_back(VkVertexInputBindingDescription
+                {
+                    .binding = stream,
+                    .stride = strides[stream],
+                    .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+                });
+            }
+        }
         Vertex::pipelineVertexInputStateCreateInfo = VkPipelineVertexInputStateCreateInfo
         {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-            .vertexBindingDescriptionCount = 1,
-            .pVertexBindingDescriptions = &Vertex::vertexInputBindingDescription,
+            .vertexBindingDescriptionCount = static_cast<uint32_t>(Vertex::vertexInputBindingDescriptions.size()),
+            .pVertexBindingDescriptions = Vertex::vertexInputBindingDescriptions.data(),
             .vertexAttributeDescriptionCount = static_cast<uint32_t>(Vertex::vertexInputAttributeDescriptions.size()),
             .pVertexAttributeDescriptions = Vertex::vertexInputAttributeDescriptions.data(),
         };
@@ -528,17 +518,26 @@ namespace Scene
     {
         if (index < textures.size())
         {
-            return &textures[index];
+            return textures[index].get();
         }
         return nullptr;
     }
 
     Model::~Model()
     {
+        if (streamThread_.joinable())
+        {
+            stopStreaming_ = true;
+            streamThread_.join();
+        }
+        streamJobs_.reset();
+
+        vkDestroyBuffer(device_, transforms.buffer, nullptr);
+        Memory::Free(transforms.memory);
         vkDestroyBuffer(device_, vertices.buffer, nullptr);
-        vkFreeMemory(device_, vertices.memory, nullptr);
+        Memory::Free(vertices.memory);
         vkDestroyBuffer(device_, indices.buffer, nullptr);
-        vkFreeMemory(device_, indices.memory, nullptr);
+        Memory::Free(indices.memory);
 
         textures.clear();
         delete emptyTexture_;
@@ -565,51 +564,204 @@ namespace Scene
         vkDestroyDescriptorPool(device_, descriptorPool_, nullptr);
     }
 
-    void Model::LoadNode(Node* parent, const tinygltf::Node& node, uint32_t nodeIndex, const tinygltf::Model& model, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, float globalscale)
+    void ExpandRgbToRgba(const unsigned char* rgb, size_t pixelCount, unsigned char* rgba)
     {
-        Node* newNode = new Node
+        for (size_t i = 0; i < pixelCount; ++i)
         {
-            .parent = parent,
-            .index = nodeIndex,
-            .matrix = glm::mat4(1.0f),
-            .name = node.name,
-            //.skinIndex = node.skin,
-        };
+            rgba[0] = rgb[0];
+            rgba[1] = rgb[1];
+            rgba[2] = rgb[2];
+            rgba[3] = 255;
+            rgba += 4;
+            rgb += 3;
+        }
+    }
 
-        // Generate local node matrix
-        glm::vec3 translation = glm::vec3(0.0f);
+    void ReadNodeTransform(const tinygltf::Node& node, TransformHierarchy& hierarchy, uint32_t target)
+    {
         if (node.translation.size() == 3)
         {
-            translation = glm::make_vec3(node.translation.data());
-            newNode->translation = translation;
+            hierarchy.translations[target] = glm::make_vec3(node.translation.data());
         }
-        glm::mat4 rotation = glm::mat4(1.0f);
         if (node.rotation.size() == 4)
         {
-            glm::quat q = glm::make_quat(node.rotation.data());
-            newNode->rotation = glm::mat4(q);
+            hierarchy.rotations[target] = glm::make_quat(node.rotation.data());
         }
-        glm::vec3 scale = glm::vec3(1.0f);
         if (node.scale.size() == 3)
         {
-            scale = glm::make_vec3(node.scale.data());
-            newNode->scale = scale;
+            hierarchy.scales[target] = glm::make_vec3(node.scale.data());
         }
         if (node.matrix.size() == 16)
         {
-            newNode->matrix = glm::make_mat4x4(node.matrix.data());
-            if (globalscale != 1.0f)
+            hierarchy.matrices[target] = glm::make_mat4x4(node.matrix.data());
+        }
+        hierarchy.MarkDirty(target);
+    }
+
+    void WriteVertices(const VertexStreams& streams, Vertex* vertices)
+    {
+        const bool hasSkin = streams.joints && streams.weights;
+        for (size_t v = 0; v < streams.count; v++)
+        {
+            Vertex& vert = vertices[v];
+            vert.pos = glm::vec4(glm::make_vec3(&streams.position[v * 3]), 1.0f);
+            vert.normal = glm::normalize(glm::vec3(streams.normal ? glm::make_vec3(&streams.normal[v * 3]) : glm::vec3(0.0f)));
+            vert.uv = streams.uv ? glm::make_vec2(&streams.uv[v * 2]) : glm::vec3(0.0f);
+            if (streams.color)
+            {
+                switch (streams.colorComponents)
+                {
+                case 3:
+                    vert.color = glm::vec4(glm::make_vec3(&streams.color[v * 3]), 1.0f);
+                    break;
+                case 4:
+                    vert.color = glm::make_vec4(&streams.color[v * 4]);
+                    break;
+                }
+            }
+            else
+            {
+                vert.color = glm::vec4(1.0f);
+            }
+            vert.tangent = streams.tangent ? glm::vec4(glm::make_vec4(&streams.tangent[v * 4])) : glm::vec4(0.0f);
+            vert.joint0 = hasSkin ? glm::vec4(glm::make_vec4(&streams.joints[v * 4])) : glm::vec4(0.0f);
+            vert.weight0 = hasSkin ? glm::make_vec4(&streams.weights[v * 4]) : glm::vec4(0.0f);
+        }
+    }
+
+    void AppendVertices(const VertexStreams& streams, std::vector<Vertex>& vertexBuffer)
+    {
+        const size_t vertexStart = vertexBuffer.size();
+        vertexBuffer.resize(vertexStart + streams.count);
+        WriteVertices(streams, &vertexBuffer[vertexStart]);
+    }
+
+    const glm::vec2 OctahedralEncode(glm::vec3 direction)
+    {
+        const float l1 = glm::abs(direction.x) + glm::abs(direction.y) + glm::abs(direction.z);
+        if (l1 == 0.0f) return glm::vec2(0.0f);
+
+        // Project onto the octahedron, folding the lower hemisphere over the upper one's diagonals
+        direction /= l1;
+        const glm::vec2 upper(direction.x, direction.y);
+        if (direction.z >= 0.0f) return upper;
+        const glm::vec2 sign(upper.x >= 0.0f ? 1.0f : -1.0f, upper.y >= 0.0f ? 1.0f : -1.0f);
+        return (1.0f - glm::abs(glm::vec2(upper.y, upper.x))) * sign;
+    }
+
+    void WritePackedVertices(const VertexStreams& streams, glm::vec3* positions, PackedVertex* attributes, SkinVertex* skin)
+    {
+        const bool hasSkin = streams.joints && streams.weights;
+        for (size_t v = 0; v < streams.count; v++)
+        {
+            positions[v] = glm::make_vec3(&streams.position[v * 3]);
+
+            PackedVertex& vert = attributes[v];
+            vert.normal = glm::packSnorm2x16(streams.normal ? OctahedralEncode(glm::make_vec3(&streams.normal[v * 3])) : glm::vec2(0.0f));
+            if (streams.tangent)
+            {
+                const glm::vec4 tangent = glm::make_vec4(&streams.tangent[v * 4]);
+                vert.tangent = glm::packSnorm4x8(glm::vec4(OctahedralEncode(glm::vec3(tangent)), tangent.w, 0.0f));
+            }
+            else
+            {
+                vert.tangent = 0;
+            }
+            vert.uv = glm::packHalf2x16(streams.uv ? glm::make_vec2(&streams.uv[v * 2]) : glm::vec2(0.0f));
+            glm::vec4 color(1.0f);
+            if (streams.color)
+            {
+                color = streams.colorComponents == 3 ? glm::vec4(glm::make_vec3(&streams.color[v * 3]), 1.0f) : glm::make_vec4(&streams.color[v * 4]);
+            }
+            vert.color = glm::packUnorm4x8(color);
+
+            if (skin)
+            {
+                for (int j = 0; j < 4; j++) skin[v].joints[j] = hasSkin ? streams.joints[v * 4 + j] : 0;
+                skin[v].weights = glm::packUnorm4x8(hasSkin ? glm::make_vec4(&streams.weights[v * 4]) : glm::vec4(0.0f));
+            }
+        }
+    }
+
+    namespace
+    {
+        template<typename T, typename Target>
+        void ConvertIndices(const void* data, size_t count, Target* indices)
+        {
+            // Accessor data needn't be aligned for T
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t index = 0; index < count; index++)
             {
-                //newNode->matrix = glm::scale(newNode->matrix, glm::vec3(globalscale));
+                T value;
+                memcpy(&value, bytes + index * sizeof(T), sizeof(T));
+                indices[index] = static_cast<Target>(value);
             }
+        }
+
+        template<typename Target>
+        const bool ConvertIndices(const void* data, int componentType, size_t count, Target* indices)
+        {
+            switch (componentType)
+            {
+            case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
+                ConvertIndices<uint32_t>(data, count, indices);
+                return true;
+            case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:
+                ConvertIndices<uint16_t>(data, count, indices);
+                return true;
+            case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE:
+                ConvertIndices<uint8_t>(data, count, indices);
+                return true;
+            default:
+                return false;
+            }
+        }
+    }
+
+    const bool IsSupportedIndexType(int componentType)
+    {
+        return componentType == TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT ||
+            componentType == TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT ||
+            componentType == TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE;
+    }
+
+    const VkIndexType PrimitiveIndexType(size_t vertexCount)
+    {
+        // Valid indices are below the vertex count. Primitive restart isn't enabled, 0xFFFF would be an index too.
+        return vertexCount < 0x10000 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    }
+
+    const bool WriteIndices(const void* data, int componentType, size_t count, uint16_t* indices)
+    {
+        return ConvertIndices(data, componentType, count, indices);
+    }
+
+    const bool WriteIndices(const void* data, int componentType, size_t count, uint32_t* indices)
+    {
+        return ConvertIndices(data, componentType, count, indices);
+    }
+
+    void Model::LoadNode(Node* parent, const tinygltf::Node& node, uint32_t nodeIndex, const tinygltf::Model& model, std::vector<PrimitiveLoad>& primitiveLoads, float globalscale)
+    {
+        // Added before its children, keeping the hierarchy & linearNodes in topological order
+        Node* newNode = new Node
+        {
+            .parent = parent,
+            .index = nodeIndex,
+            .name = node.name,
+            //.skinIndex = node.skin,
+            .hierarchyIndex = hierarchy.Add(parent ? static_cast<int32_t>(parent->hierarchyIndex) : -1),
         };
+        linearNodes.push_back(newNode);
+
+        ReadNodeTransform(node, hierarchy, newNode->hierarchyIndex);
 
         // Node with children
         if (node.children.size() > 0)
         {
             for (auto i = 0; i < node.children.size(); i++)
             {
-                LoadNode(newNode, model.nodes[node.children[i]], node.children[i], model, indexBuffer, vertexBuffer, globalscale);
+                LoadNode(newNode, model.nodes[node.children[i]], node.children[i], model, primitiveLoads, globalscale);
             }
         }
 
@@ -617,7 +769,7 @@ namespace Scene
         if (node.mesh > -1)
         {
             const tinygltf::Mesh mesh = model.meshes[node.mesh];
-            Mesh* newMesh = new Mesh(physicalDevice_, device_, newNode->matrix);
+            Mesh* newMesh = new Mesh();
             newMesh->name = mesh.name;
             for (size_t j = 0; j < mesh.primitives.size(); j++)
             {
@@ -626,8 +778,12 @@ namespace Scene
                 {
                     continue;
                 }
-                uint32_t indexStart = static_cast<uint32_t>(indexBuffer.size());
-                uint32_t vertexStart = static_cast<uint32_t>(vertexBuffer.size());
+                // Placed after the previous primitive, its indices after the last ones of their region. The data itself is
+                // converted once all nodes are loaded.
+                const PrimitiveLoad* previous = primitiveLoads.empty() ? nullptr : &primitiveLoads.back();
+                uint32_t vertexStart = previous ? previous->firstVertex + static_cast<uint32_t>(previous->streams.count) : 0;
+                PrimitiveLoad load{ .firstVertex = vertexStart };
+                uint32_t indexStart = 0;
                 uint32_t indexCount = 0;
                 uint32_t vertexCount = 0;
                 glm::vec3 posMin{};
@@ -635,21 +791,15 @@ namespace Scene
                 bool hasSkin = false;
                 // Vertices
                 {
-                    const float* bufferPos = nullptr;
-                    const float* bufferNormals = nullptr;
-                    const float* bufferTexCoords = nullptr;
-                    const float* bufferColors = nullptr;
-                    const float* bufferTangents = nullptr;
-                    uint32_t numColorComponents;
-                    const uint16_t* bufferJoints = nullptr;
-                    const float* bufferWeights = nullptr;
+                    VertexStreams& streams = load.streams;
 
                     // Position attribute is required
                     assert(primitive.attributes.find("POSITION") != primitive.attributes.end());
 
                     const tinygltf::Accessor& posAccessor = model.accessors[primitive.attributes.find("POSITION")->second];
                     const tinygltf::BufferView& posView = model.bufferViews[posAccessor.bufferView];
-                    bufferPos = reinterpret_cast<const float*>(&(model.buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]));
+                    streams.position = reinterpret_cast<const float*>(&(model.buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]));
+                    streams.count = posAccessor.count;
                     posMin = glm::vec3(posAccessor.minValues[0], posAccessor.minValues[1], posAccessor.minValues[2]);
                     posMax = glm::vec3(posAccessor.maxValues[0], posAccessor.maxValues[1], posAccessor.maxValues[2]);
 
@@ -657,14 +807,14 @@ namespace Scene
                     {
                         const tinygltf::Accessor& normAccessor = model.accessors[primitive.attributes.find("NORMAL")->second];
                         const tinygltf::BufferView& normView = model.bufferViews[normAccessor.bufferView];
-                        bufferNormals = reinterpret_cast<const float*>(&(model.buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
+                        streams.normal = reinterpret_cast<const float*>(&(model.buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
                     }
 
                     if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end())
                     {
                         const tinygltf::Accessor& uvAccessor = model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
                         const tinygltf::BufferView& uvView = model.bufferViews[uvAccessor.bufferView];
-                        bufferTexCoords = reinterpret_cast<const float*>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
+                        streams.uv = reinterpret_cast<const float*>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
                     }
 
                     if (primitive.attributes.find("COLOR_0") != primitive.attributes.end())
@@ -672,15 +822,15 @@ namespace Scene
                         const tinygltf::Accessor& colorAccessor = model.accessors[primitive.attributes.find("COLOR_0")->second];
                         const tinygltf::BufferView& colorView = model.bufferViews[colorAccessor.bufferView];
                         // Color buffer are either of type vec3 or vec4
-                        numColorComponents = colorAccessor.type == TINYGLTF_PARAMETER_TYPE_FLOAT_VEC3 ? 3 : 4;
-                        bufferColors = reinterpret_cast<const float*>(&(model.buffers[colorView.buffer].data[colorAccessor.byteOffset + colorView.byteOffset]));
+                        streams.colorComponents = colorAccessor.type == TINYGLTF_PARAMETER_TYPE_FLOAT_VEC3 ? 3 : 4;
+                        streams.color = reinterpret_cast<const float*>(&(model.buffers[colorView.buffer].data[colorAccessor.byteOffset + colorView.byteOffset]));
                     }
 
                     if (primitive.attributes.find("TANGENT") != primitive.attributes.end())
                     {
                         const tinygltf::Accessor& tangentAccessor = model.accessors[primitive.attributes.find("TANGENT")->second];
                         const tinygltf::BufferView& tangentView = model.bufferViews[tangentAccessor.bufferView];
-                        bufferTangents = reinterpret_cast<const float*>(&(model.buffers[tangentView.buffer].data[tangentAccessor.byteOffset + tangentView.byteOffset]));
+                        streams.tangent = reinterpret_cast<const float*>(&(model.buffers[tangentView.buffer].data[tangentAccessor.byteOffset + tangentView.byteOffset]));
                     }
 
                     // Skinning
@@ -689,45 +839,19 @@ namespace Scene
                     {
                         const tinygltf::Accessor& jointAccessor = model.accessors[primitive.attributes.find("JOINTS_0")->second];
                         const tinygltf::BufferView& jointView = model.bufferViews[jointAccessor.bufferView];
-                        bufferJoints = reinterpret_cast<const uint16_t*>(&(model.buffers[jointView.buffer].data[jointAccessor.byteOffset + jointView.byteOffset]));
+                        streams.joints = reinterpret_cast<const uint16_t*>(&(model.buffers[jointView.buffer].data[jointAccessor.byteOffset + jointView.byteOffset]));
                     }
 
                     if (primitive.attributes.find("WEIGHTS_0") != primitive.attributes.end())
                     {
                         const tinygltf::Accessor& uvAccessor = model.accessors[primitive.attributes.find("WEIGHTS_0")->second];
                         const tinygltf::BufferView& uvView = model.bufferViews[uvAccessor.bufferView];
-                        bufferWeights = reinterpret_cast<const float*>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
+                        streams.weights = reinterpret_cast<const float*>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
                     }
 
-                    hasSkin = (bufferJoints && bufferWeights);
+                    hasSkin = (streams.joints && streams.weights);
 
                     vertexCount = static_cast<uint32_t>(posAccessor.count);
-
-                    for (size_t v = 0; v < posAccessor.count; v++)
-                    {
-                        Vertex vert{};
-                        vert.pos = glm::vec4(glm::make_vec3(&bufferPos[v * 3]), 1.0f);
-                        vert.normal = glm::normalize(glm::vec3(bufferNormals ? glm::make_vec3(&bufferNormals[v * 3]) : glm::vec3(0.0f)));
-                        vert.uv = bufferTexCoords ? glm::make_vec2(&bufferTexCoords[v * 2]) : glm::vec3(0.0f);
-                        if (bufferColors)
-                        {
-                            switch (numColorComponents)
-                            {
-                            case 3:
-                                vert.color = glm::vec4(glm::make_vec3(&bufferColors[v * 3]), 1.0f);
-                            case 4:
-                                vert.color = glm::make_vec4(&bufferColors[v * 4]);
-                            }
-                        }
-                        else
-                        {
-                            vert.color = glm::vec4(1.0f);
-                        }
-                        vert.tangent = bufferTangents ? glm::vec4(glm::make_vec4(&bufferTangents[v * 4])) : glm::vec4(0.0f);
-                        vert.joint0 = hasSkin ? glm::vec4(glm::make_vec4(&bufferJoints[v * 4])) : glm::vec4(0.0f);
-                        vert.weight0 = hasSkin ? glm::make_vec4(&bufferWeights[v * 4]) : glm::vec4(0.0f);
-                        vertexBuffer.push_back(vert);
-                    }
                 }
                 // Indices
                 {
@@ -737,48 +861,27 @@ namespace Scene
 
                     indexCount = static_cast<uint32_t>(accessor.count);
 
-                    switch (accessor.componentType)
-                    {
-                    case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
+                    if (!IsSupportedIndexType(accessor.componentType))
                     {
-                        uint32_t* buf = new uint32_t[accessor.count];
-                        memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint32_t));
-                        for (size_t index = 0; index < accessor.count; index++) {
-                            indexBuffer.push_back(buf[index] + vertexStart);
-                        }
-                        delete[] buf;
-                        break;
-                    }
-                    case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:
-                    {
-                        uint16_t* buf = new uint16_t[accessor.count];
-                        memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint16_t));
-                        for (size_t index = 0; index < accessor.count; index++) {
-                            indexBuffer.push_back(buf[index] + vertexStart);
-                        }
-                        delete[] buf;
-                        break;
-                    }
-                    case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE:
-                    {
-                        uint8_t* buf = new uint8_t[accessor.count];
-                        memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint8_t));
-                        for (size_t index = 0; index < accessor.count; index++)
-                        {
-                            indexBuffer.push_back(buf[index] + vertexStart);
-                        }
-                        delete[] buf;
-                        break;
-                    }
-                    default:
                         std::cerr << "Index component type " << accessor.componentType << " not supported" << std::endl;
                         return;
                     }
+                    load.indices = &buffer.data[accessor.byteOffset + bufferView.byteOffset];
+                    load.indexComponentType = accessor.componentType;
+                    load.indexCount = accessor.count;
+                    load.indexType = PrimitiveIndexType(vertexCount);
+
+                    uint32_t& regionCount = load.indexType == VK_INDEX_TYPE_UINT16 ? indices.count16 : indices.count32;
+                    indexStart = regionCount;
+                    load.firstIndex = indexStart;
+                    regionCount += indexCount;
                 }
+                primitiveLoads.push_back(load);
                 Primitive* newPrimitive = new Primitive
                 {
                     .firstIndex = indexStart,
                     .indexCount = indexCount,
+                    .indexType = load.indexType,
                     .firstVertex = vertexStart,
                     .vertexCount = vertexCount,
                     .material = primitive.material > -1 ? materials[primitive.material] : materials.back(),
@@ -795,19 +898,215 @@ namespace Scene
         {
             nodes.push_back(newNode);
         }
-        linearNodes.push_back(newNode);
     }
 
-    void Model::LoadImages(tinygltf::Model& gltfModel)
+    bool DeferImageDecode(tinygltf::Image* image, const int, std::string*, std::string*, int, int, const unsigned char* bytes, int size, void*)
     {
-        textures.reserve(gltfModel.images.size());
-        for (tinygltf::Image& image : gltfModel.images)
+        image->image.assign(bytes, bytes + size);
+        image->component = 0;
+        return true;
+    }
+
+    void DecodeImage(tinygltf::Image& image)
+    {
+        // KTX images are read from their own file by Texture
+        const size_t extension = image.uri.find_last_of('.');
+        if (extension != std::string::npos && image.uri.substr(extension + 1) == "ktx") return;
+
+        int width, height, components;
+        unsigned char* pixels = stbi_load_from_memory(image.image.data(), static_cast<int>(image.image.size()), &width, &height, &components, 4);
+        if (!pixels)
         {
-            //Texture texture(image, path, physicalDevice_, device_, commandPool_, transferQueue_, descriptorPool_);
-            textures.emplace_back(Texture(image, path, physicalDevice_, device_, commandPool_, transferQueue_, descriptorPool_));
+            throw std::runtime_error("failed to decode image '" + image.uri + "': " + stbi_failure_reason());
         }
-        // Create an empty texture to be used for empty material images
-        emptyTexture_ = new Texture("res/empty.bmp", physicalDevice_, device_, commandPool_, transferQueue_, descriptorPool_);
+        image.image.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+        stbi_image_free(pixels);
+
+        image.width = width;
+        image.height = height;
+        image.component = 4;
+        image.bits = 8;
+        image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+    }
+
+    void Model::LoadImages(std::vector<tinygltf::Image>& images, Jobs::JobSystem& jobs, Upload::UploadContext& uploads, const std::function<void(uint32_t, std::unique_ptr<Texture>)>& loaded, const std::function<void(uint32_t, const std::string&)>& failed)
+    {
+        // Decode every image on the job system. The upload context isn't thread safe, so uploads are recorded from
+        // this thread, each batch as soon as its images are decoded.
+        const uint32_t imageCount = static_cast<uint32_t>(images.size());
+        std::vector<std::string> errors(imageCount);
+        std::mutex readyMutex;
+        std::condition_variable readyCondition;
+        std::vector<uint32_t> ready;
+
+        Jobs::TaskGroup decodes(jobs);
+        for (uint32_t i = 0; i < imageCount; i++)
+        {
+            decodes.Run([&, i]
+            {
+                try
+                {
+                    if (!stopStreaming_) DecodeImage(images[i]);
+                }
+                catch (const std::exception& e)
+                {
+                    errors[i] = e.what();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(readyMutex);
+                    ready.push_back(i);
+                }
+                readyCondition.notify_one();
+            }, "decode image");
+        }
+
+        // Textures are handed over once the batch holding their upload has completed
+        struct PendingTexture
+        {
+            uint32_t index;
+            uint64_t serial;
+            std::unique_ptr<Texture> texture;
+        };
+        std::deque<PendingTexture> pending;
+        std::string error;
+
+        std::vector<uint32_t> batch;
+        for (uint32_t handled = 0; handled < imageCount && !stopStreaming_ && error.empty();)
+        {
+            {
+                std::unique_lock<std::mutex> lock(readyMutex);
+                while (ready.empty())
+                {
+                    // Decode meanwhile rather than block, the job system may have no workers of its own. Once
+                    // nothing is queued, the decodes left are running elsewhere & will notify.
+                    lock.unlock();
+                    const bool ran = jobs.RunPending();
+                    lock.lock();
+                    if (!ran) readyCondition.wait(lock, [&] { return !ready.empty(); });
+                }
+                std::swap(batch, ready);
+            }
+            for (uint32_t i : batch)
+            {
+                if (stopStreaming_) break;
+
+                tinygltf::Image& image = images[i];
+                if (errors[i].empty())
+                {
+                    try
+                    {
+                        pending.push_back({ i, 0, std::make_unique<Texture>(image, path, physicalDevice_, device_, uploads, descriptorPool_) });
+                    }
+                    catch (const std::exception& e)
+                    {
+                        errors[i] = e.what();
+                    }
+                }
+                // Staged or failed, the pixels aren't needed any more
+                image.image = {};
+                handled++;
+
+                if (errors[i].empty()) continue;
+                if (!failed)
+                {
+                    error = errors[i];
+                    break;
+                }
+                failed(i, errors[i]);
+            }
+            batch.clear();
+
+            // One submit for all the images decoded meanwhile
+            const uint64_t serial = uploads.Flush();
+            for (auto texture = pending.rbegin(); texture != pending.rend() && texture->serial == 0; ++texture)
+            {
+                texture->serial = serial;
+            }
+            while (!pending.empty() && uploads.IsComplete(pending.front().serial))
+            {
+                loaded(pending.front().index, std::move(pending.front().texture));
+                pending.pop_front();
+            }
+        }
+        decodes.Wait();
+
+        // Textures may only go once the GPU is done with them, even when stopping or failing
+        uploads.Finish();
+        for (PendingTexture& texture : pending)
+        {
+            loaded(texture.index, std::move(texture.texture));
+        }
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+
+    void Model::StreamTextures(std::vector<tinygltf::Image> images)
+    {
+        Profiler::CpuProfiler::SetThreadName("texture stream");
+        const uint64_t startNs = Profiler::CpuProfiler::Now();
+        uint32_t failedCount = 0;
+        try
+        {
+            LoadImages(images, *streamJobs_, *streamUploads_, [this](uint32_t index, std::unique_ptr<Texture> texture)
+            {
+                // Only the render thread reads the texture, after taking its index from the list
+                textures[index] = std::move(texture);
+                {
+                    std::lock_guard<std::mutex> lock(streamedMutex_);
+                    streamedImages_.push_back(index);
+                }
+                streamedCount_++;
+            }, [&](uint32_t index, const std::string& error)
+            {
+                // One bad image shouldn't hold back the rest, its materials just keep the placeholder
+                std::cerr << "Failed to stream texture " << index << " (" << images[index].uri << "), keeping the placeholder: " << error << std::endl;
+                failedCount++;
+            });
+        }
+        catch (const std::exception& e)
+        {
+            // Materials keep whatever they're bound to, the placeholder for those not loaded
+            std::cerr << "Texture streaming failed: " << e.what() << std::endl;
+            return;
+        }
+        if (!stopStreaming_)
+        {
+            std::cout << "Streamed " << streamedCount_ << " textures in " << (Profiler::CpuProfiler::Now() - startNs) / 1'000'000 << " ms";
+            if (failedCount) std::cout << ", " << failedCount << " failed";
+            std::cout << std::endl;
+        }
+    }
+
+    void Model::UpdateStreamedTextures(uint32_t frameIndex)
+    {
+        std::vector<uint32_t> arrived;
+        {
+            std::lock_guard<std::mutex> lock(streamedMutex_);
+            std::swap(arrived, streamedImages_);
+        }
+
+        // Sets of other frames may still be in use, each frame's is rewritten when it comes around
+        const uint32_t allFrames = (1u << MAX_FRAMES_IN_FLIGHT) - 1;
+        for (uint32_t image : arrived)
+        {
+            for (Material& material : materials)
+            {
+                if (material.baseColorImage != static_cast<int>(image)) continue;
+                material.baseColorTexture = textures[image].get();
+                material.baseColorImage = -1;
+                material.staleFrames = allFrames;
+                staleFrames_ = allFrames;
+            }
+        }
+
+        const uint32_t frameBit = 1u << frameIndex;
+        if (!(staleFrames_ & frameBit)) return;
+        for (Material& material : materials)
+        {
+            if (!(material.staleFrames & frameBit)) continue;
+            material.WriteDescriptorSet(frameIndex);
+            material.staleFrames &= ~frameBit;
+        }
+        staleFrames_ &= ~frameBit;
     }
 
     void Model::LoadMaterials(tinygltf::Model& gltfModel)
@@ -817,7 +1116,14 @@ namespace Scene
             Material material(device_);
             if (mat.values.find("baseColorTexture") != mat.values.end())
             {
-                material.baseColorTexture = GetTexture(gltfModel.textures[mat.values["baseColorTexture"].TextureIndex()].source);
+                const int image = gltfModel.textures[mat.values["baseColorTexture"].TextureIndex()].source;
+                material.baseColorTexture = GetTexture(image);
+                // Still streaming, bound to the placeholder until the image is in
+                if (!material.baseColorTexture && image >= 0 && image < static_cast<int>(textures.size()))
+                {
+                    material.baseColorTexture = emptyTexture_;
+                    material.baseColorImage = image;
+                }
             }
             //// Metallic roughness workflow
             //if (mat.values.find("metallicRoughnessTexture") != mat.values.end())
@@ -875,15 +1181,17 @@ namespace Scene
         materials.push_back(Material(device_));
     }
 
-    Model::Model(const std::string filename, const VkPhysicalDevice& pd, const VkDevice& d, const VkCommandPool& commandPool, const VkQueue& transferQueue, const float scale)
+    Model::Model(const std::string filename, const VkPhysicalDevice& pd, const VkDevice& d, Upload::UploadContext& uploads, Jobs::JobSystem& jobs, const float scale, const VertexLayout vertexLayout, Upload::UploadContext* streamUploads)
         : physicalDevice_(pd)
         , device_(d)
-        , transferQueue_(transferQueue)
-        , commandPool_(commandPool)
+        , uploads_(uploads)
         , scale_(scale)
+        , streamUploads_(streamUploads)
     {
         tinygltf::Model gltfModel;
         tinygltf::TinyGLTF gltfContext;
+        // Images are only read in here, LoadImages decodes them in parallel
+        gltfContext.SetImageLoader(DeferImageDecode, nullptr);
         
         size_t pos = filename.find_last_of('/');
         path = filename.substr(0, pos);
@@ -892,35 +1200,96 @@ namespace Scene
 
         bool fileLoaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, filename);
 
-        std::vector<uint32_t> indexBuffer;
-        std::vector<Vertex> vertexBuffer;
+        std::vector<uint16_t> indexBuffer16;
+        std::vector<uint32_t> indexBuffer32;
+        std::vector<Vertex> vertexBuffer; // Full layout
+        std::vector<glm::vec3> positionBuffer; // Packed layout streams
+        std::vector<PackedVertex> attributeBuffer;
+        std::vector<SkinVertex> skinBuffer;
+        size_t vertexCount = 0;
 
         if (fileLoaded)
         {
-            LoadImages(gltfModel);
+            // Empty texture for empty material images, and the placeholder for streamed ones
+            emptyTexture_ = new Texture("res/empty.bmp", physicalDevice_, device_, uploads_, descriptorPool_);
+            textures.resize(gltfModel.images.size());
+            if (!streamUploads_)
+            {
+                LoadImages(gltfModel.images, jobs, uploads_, [this](uint32_t index, std::unique_ptr<Texture> texture)
+                {
+                    textures[index] = std::move(texture);
+                });
+                streamedCount_ = static_cast<uint32_t>(textures.size());
+            }
             LoadMaterials(gltfModel);
             const tinygltf::Scene& scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
+            std::vector<PrimitiveLoad> primitiveLoads;
             for (size_t i = 0; i < scene.nodes.size(); i++) {
                 const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
-                LoadNode(nullptr, node, scene.nodes[i], gltfModel, indexBuffer, vertexBuffer, scale);
+                LoadNode(nullptr, node, scene.nodes[i], gltfModel, primitiveLoads, scale);
             }
+
+            // Every primitive has its own slice of the buffers, so they convert independently
+            if (!primitiveLoads.empty())
+            {
+                const PrimitiveLoad& last = primitiveLoads.back();
+                vertexCount = last.firstVertex + last.streams.count;
+                indexBuffer16.resize(indices.count16);
+                indexBuffer32.resize(indices.count32);
+                if (vertexLayout == VertexLayout::Full)
+                {
+                    vertexBuffer.resize(vertexCount);
+                }
+                else
+                {
+                    positionBuffer.resize(vertexCount);
+                    attributeBuffer.resize(vertexCount);
+                    const bool skinned = std::any_of(primitiveLoads.begin(), primitiveLoads.end(), [](const PrimitiveLoad& load)
+                    {
+                        return load.streams.joints && load.streams.weights;
+                    });
+                    if (skinned) skinBuffer.resize(vertexCount);
+                }
+            }
+            jobs.ParallelFor(static_cast<uint32_t>(primitiveLoads.size()), [&](uint32_t begin, uint32_t end, uint32_t chunk)
+            {
+                for (uint32_t i = begin; i < end; i++)
+                {
+                    const PrimitiveLoad& load = primitiveLoads[i];
+                    if (vertexLayout == VertexLayout::Full)
+                    {
+                        WriteVertices(load.streams, vertexBuffer.data() + load.firstVertex);
+                    }
+                    else
+                    {
+                        WritePackedVertices(load.streams, positionBuffer.data() + load.firstVertex, attributeBuffer.data() + load.firstVertex,
+                            skinBuffer.empty() ? nullptr : skinBuffer.data() + load.firstVertex);
+                    }
+                    if (load.indexType == VK_INDEX_TYPE_UINT16)
+                    {
+                        WriteIndices(load.indices, load.indexComponentType, load.indexCount, indexBuffer16.data() + load.firstIndex);
+                    }
+                    else
+                    {
+                        WriteIndices(load.indices, load.indexComponentType, load.indexCount, indexBuffer32.data() + load.firstIndex);
+                    }
+                }
+            }, "convert primitives");
             //if (gltfModel.animations.size() > 0)
             //{
             //    LoadAnimations(gltfModel);
             //}
             //LoadSkins(gltfModel);
 
-            for (auto node : linearNodes)
+            for (Node* node : nodes)
             {
-                // Assign skins
-                //if (node->skinIndex > -1)
-                //{
-                //    node->skin = skins[node->skinIndex];
-                //}
-
-                // Initial pose
-                node->Update();
+                AppendDrawItems(node);
             }
+
+            CreateTransformBuffer();
+
+            // Initial pose, every node is dirty after loading
+            UpdateTransforms();
         }
         else
         {
@@ -936,57 +1305,59 @@ namespace Scene
             }
         }
 
-        size_t vertexBufferSize = vertexBuffer.size() * sizeof(Vertex);
-        size_t indexBufferSize = indexBuffer.size() * sizeof(uint32_t);
-        indices.count = static_cast<uint32_t>(indexBuffer.size());
-        vertices.count = static_cast<uint32_t>(vertexBuffer.size());
-
-        assert((vertexBufferSize > 0) && (indexBufferSize > 0));
-
-        struct StagingBuffer {
-            VkBuffer buffer;
-            VkDeviceMemory memory;
-        } vertexStaging, indexStaging;
-
-        // Create staging buffers
-        Util::CreateBuffer(physicalDevice_, device_, vertexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vertexStaging.buffer, vertexStaging.memory);
-        Util::CreateBuffer(physicalDevice_, device_, indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indexStaging.buffer, indexStaging.memory);
-
-        uint8_t* data;
+        // The layout's streams one after another in a single buffer, each starting 16 byte aligned
+        struct StreamData
+        {
+            const void* data;
+            VkDeviceSize size;
+        };
+        std::vector<StreamData> streamData;
+        if (vertexLayout == VertexLayout::Full)
+        {
+            streamData.push_back({ vertexBuffer.data(), vertexBuffer.size() * sizeof(Vertex) });
+        }
+        else
+        {
+            streamData.push_back({ positionBuffer.data(), positionBuffer.size() * sizeof(glm::vec3) });
+            streamData.push_back({ attributeBuffer.data(), attributeBuffer.size() * sizeof(PackedVertex) });
+            if (!skinBuffer.empty()) streamData.push_back({ skinBuffer.data(), skinBuffer.size() * sizeof(SkinVertex) });
+        }
+        vertices.layout = vertexLayout;
+        vertices.streamCount = static_cast<uint32_t>(streamData.size());
+        VkDeviceSize vertexBufferSize = 0;
+        for (uint32_t stream = 0; stream < vertices.streamCount; stream++)
+        {
+            vertices.streamOffsets[stream] = vertexBufferSize;
+            vertexBufferSize = (vertexBufferSize + streamData[stream].size + 15) / 16 * 16;
+        }
 
-        VK_CHECK_RESULT(vkMapMemory(device_, vertexStaging.memory, 0, vertexBufferSize, 0, (void**)&data));
-        memcpy(data, vertexBuffer.data(), (size_t)vertexBufferSize);
-        vkUnmapMemory(device_, vertexStaging.memory);
+        // The 32-bit region starts 4 byte aligned, as index buffer offsets must be a multiple of the index size
+        const VkDeviceSize indexBufferSize16 = indexBuffer16.size() * sizeof(uint16_t);
+        const VkDeviceSize indexBufferSize32 = indexBuffer32.size() * sizeof(uint32_t);
+        indices.offset32 = (indexBufferSize16 + 3) / 4 * 4;
+        const VkDeviceSize indexBufferSize = indices.offset32 + indexBufferSize32;
+        indices.count = static_cast<int>(indexBuffer16.size() + indexBuffer32.size());
+        vertices.count = static_cast<uint32_t>(vertexCount);
 
-        VK_CHECK_RESULT(vkMapMemory(device_, indexStaging.memory, 0, indexBufferSize, 0, (void**)&data));
-        memcpy(data, indexBuffer.data(), (size_t)indexBufferSize);
-        vkUnmapMemory(device_, indexStaging.memory);
+        assert((vertexBufferSize > 0) && (indexBufferSize > 0));
 
         // Create device local buffers
-        Util::CreateBuffer(physicalDevice_, device_, vertexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertices.buffer, vertices.memory);
-        Util::CreateBuffer(physicalDevice_, device_, indexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indices.buffer, indices.memory);
-       
-        // Copy from staging buffers
-        Util::CopyBuffer(device_, commandPool, transferQueue_, vertexStaging.buffer, vertices.buffer, vertexBufferSize);
-        Util::CopyBuffer(device_, commandPool, transferQueue_, indexStaging.buffer, indices.buffer, indexBufferSize);
-
-        vkDestroyBuffer(device_, vertexStaging.buffer, nullptr);
-        vkFreeMemory(device_, vertexStaging.memory, nullptr);
-        vkDestroyBuffer(device_, indexStaging.buffer, nullptr);
-        vkFreeMemory(device_, indexStaging.memory, nullptr);
+        Util::CreateBuffer(uploads_.GetAllocator(), device_, vertexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Geometry, vertices.buffer, vertices.memory);
+        Util::CreateBuffer(uploads_.GetAllocator(), device_, indexBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, Memory::Geometry, indices.buffer, indices.memory);
+
+        // Batched with anything still recorded, all of it done by the time the constructor returns
+        for (uint32_t stream = 0; stream < vertices.streamCount; stream++)
+        {
+            uploads_.UploadBuffer(vertices.buffer, streamData[stream].data, streamData[stream].size, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, vertices.streamOffsets[stream]);
+        }
+        if (indexBufferSize16 > 0) uploads_.UploadBuffer(indices.buffer, indexBuffer16.data(), indexBufferSize16, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+        if (indexBufferSize32 > 0) uploads_.UploadBuffer(indices.buffer, indexBuffer32.data(), indexBufferSize32, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, indices.offset32);
+        uploads_.Finish();
 
         /*getSceneDimensions();*/
 
         // Setup descriptors
-        uint32_t uboCount{ 0 };
         uint32_t imageCount{ 0 };
-        for (auto node : linearNodes)
-        {
-            if (node->mesh)
-            {
-                uboCount++;
-            }
-        }
         for (auto material : materials)
         {
             if (material.baseColorTexture != nullptr)
@@ -996,7 +1367,7 @@ namespace Scene
         }
         std::vector<VkDescriptorPoolSize> poolSizes =
         {
-            { .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = uboCount },
+            { .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, .descriptorCount = 1 },
         };
         if (imageCount > 0)
         {
@@ -1013,13 +1384,13 @@ namespace Scene
         VkDescriptorPoolCreateInfo descriptorPoolCI
         {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-            .maxSets = MAX_FRAMES_IN_FLIGHT * (uboCount + imageCount),
+            .maxSets = 1 + MAX_FRAMES_IN_FLIGHT * imageCount,
             .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
             .pPoolSizes = poolSizes.data(),
         };
         VK_CHECK_RESULT(vkCreateDescriptorPool(device_, &descriptorPoolCI, nullptr, &descriptorPool_));
 
-        // Descriptors for per-node uniform buffers
+        // Descriptor for the transform buffer
         {
             // Layout is global, so only create if it hasn't already been created before
             if (descriptorSetLayoutUbo == VK_NULL_HANDLE)
@@ -1028,7 +1399,7 @@ namespace Scene
                 {
                     {
                         .binding = 0,
-                        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
                         .descriptorCount = 1,
                         .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
                     },
@@ -1042,10 +1413,31 @@ namespace Scene
                 VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device_, &descriptorLayoutCI, nullptr, &descriptorSetLayoutUbo));
             }
 
-            for (auto node : nodes)
+            VkDescriptorSetAllocateInfo descriptorSetAllocInfo
             {
-                PrepareNodeDescriptor(node, descriptorSetLayoutUbo);
-            }
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .descriptorPool = descriptorPool_,
+                .descriptorSetCount = 1,
+                .pSetLayouts = &descriptorSetLayoutUbo,
+            };
+            VK_CHECK_RESULT(vkAllocateDescriptorSets(device_, &descriptorSetAllocInfo, &transforms.descriptorSet));
+
+            const VkDescriptorBufferInfo bufferInfo
+            {
+                .buffer = transforms.buffer,
+                .offset = 0,
+                .range = transforms.range,
+            };
+            VkWriteDescriptorSet writeDescriptorSet
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = transforms.descriptorSet,
+                .dstBinding = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .pBufferInfo = &bufferInfo,
+            };
+            vkUpdateDescriptorSets(device_, 1, &writeDescriptorSet, 0, nullptr);
         }
 
         // Descriptors for per-material images
@@ -1089,24 +1481,42 @@ namespace Scene
                 }
             }
         }
+
+        if (streamUploads_ && !gltfModel.images.empty())
+        {
+            streamJobs_ = std::make_unique<Jobs::JobSystem>(std::max(jobs.GetThreadCount() / 2, 1u), "stream");
+            streamThread_ = std::thread(&Model::StreamTextures, this, std::move(gltfModel.images));
+        }
+    }
+
+    void Model::BindBuffers(VkCommandBuffer commandBuffer)
+    {
+        const VkBuffer buffers[VertexStreamCount] = { vertices.buffer, vertices.buffer, vertices.buffer };
+        vkCmdBindVertexBuffers(commandBuffer, 0, vertices.streamCount, buffers, vertices.streamOffsets);
+        BindIndexRegion(commandBuffer, VK_INDEX_TYPE_UINT16);
+    }
+
+    void Model::BindIndexRegion(VkCommandBuffer commandBuffer, VkIndexType indexType)
+    {
+        vkCmdBindIndexBuffer(commandBuffer, indices.buffer, indexType == VK_INDEX_TYPE_UINT16 ? 0 : indices.offset32, indexType);
     }
 
-    void Model::DrawNode(Node* node, VkCommandBuffer commandBuffer, uint32_t renderFlags, VkPipelineLayout pipelineLayout, uint32_t bindImageSet)
+    void Model::DrawNode(Node* node, VkCommandBuffer commandBuffer, uint32_t renderFlags, VkPipelineLayout pipelineLayout, uint32_t bindImageSet, uint32_t frameIndex)
     {
-        const VkDeviceSize offsets[1] = { 0 };
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
-        vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+        BindBuffers(commandBuffer);
+        VkIndexType boundIndexType = VK_INDEX_TYPE_UINT16;
         if (node->mesh)
         {
+            const uint32_t transformOffset = TransformOffset(node->mesh);
             vkCmdBindDescriptorSets(
                 commandBuffer,
                 VK_PIPELINE_BIND_POINT_GRAPHICS,
                 pipelineLayout,
                 1,
                 1,
-                &node->mesh->uniformBuffer.descriptorSet,
-                0,
-                nullptr
+                &transforms.descriptorSet,
+                1,
+                &transformOffset
             );  
 
             for (Primitive* primitive : node->mesh->primitives)
@@ -1136,62 +1546,121 @@ namespace Scene
                             pipelineLayout,
                             2,
                             1,
-                            &material.descriptorSets[0],
+                            &material.descriptorSets[frameIndex],
                             0,
                             nullptr
                         );
                     }
-                    vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, 0, 0);
+                    if (primitive->indexType != boundIndexType)
+                    {
+                        BindIndexRegion(commandBuffer, primitive->indexType);
+                        boundIndexType = primitive->indexType;
+                    }
+                    vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, static_cast<int32_t>(primitive->firstVertex), 0);
                 }
             }
         }
         for (auto& child : node->children)
         {
-            DrawNode(child, commandBuffer, renderFlags, pipelineLayout, renderFlags);
+            DrawNode(child, commandBuffer, renderFlags, pipelineLayout, renderFlags, frameIndex);
         }
     }
 
-    void Model::Draw(VkCommandBuffer commandBuffer, uint32_t renderFlags, VkPipelineLayout pipelineLayout, uint32_t bindImageSet)
+    void Model::Draw(VkCommandBuffer commandBuffer, uint32_t renderFlags, VkPipelineLayout pipelineLayout, uint32_t bindImageSet, uint32_t frameIndex)
     {
         if (!buffersBound)
         {
-            const VkDeviceSize offsets[1] = { 0 };
-            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
-            vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+            BindBuffers(commandBuffer);
             buffersBound = true;
         }
         for (auto& node : nodes)
         {
-            DrawNode(node, commandBuffer, renderFlags, pipelineLayout, bindImageSet);
+            DrawNode(node, commandBuffer, renderFlags, pipelineLayout, bindImageSet, frameIndex);
         }
     }
 
-    void Model::PrepareNodeDescriptor(Node* node, VkDescriptorSetLayout descriptorSetLayout) {
-        if (node->mesh)
+    void Model::DrawRange(VkCommandBuffer commandBuffer, uint32_t begin, uint32_t end, VkPipelineLayout pipelineLayout, uint32_t frameIndex)
+    {
+        BindBuffers(commandBuffer);
+
+        const Mesh* boundMesh = nullptr;
+        VkIndexType boundIndexType = VK_INDEX_TYPE_UINT16;
+        for (uint32_t i = begin; i < end; i++)
         {
-            VkDescriptorSetAllocateInfo descriptorSetAllocInfo
+            const DrawItem& item = drawItems[i];
+            if (item.mesh != boundMesh)
             {
-                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-                .descriptorPool = descriptorPool_,
-                .descriptorSetCount = 1,
-                .pSetLayouts = &descriptorSetLayout,
-            };
-            VK_CHECK_RESULT(vkAllocateDescriptorSets(device_, &descriptorSetAllocInfo, &node->mesh->uniformBuffer.descriptorSet));
+                const uint32_t transformOffset = TransformOffset(item.mesh);
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &transforms.descriptorSet, 1, &transformOffset);
+                boundMesh = item.mesh;
+            }
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &item.primitive->material.descriptorSets[frameIndex], 0, nullptr);
+            if (item.primitive->indexType != boundIndexType)
+            {
+                BindIndexRegion(commandBuffer, item.primitive->indexType);
+                boundIndexType = item.primitive->indexType;
+            }
+            vkCmdDrawIndexed(commandBuffer, item.primitive->indexCount, 1, item.primitive->firstIndex, static_cast<int32_t>(item.primitive->firstVertex), 0);
+        }
+    }
 
-            VkWriteDescriptorSet writeDescriptorSet
+    void Model::AppendDrawItems(Node* node)
+    {
+        if (node->mesh)
+        {
+            for (Primitive* primitive : node->mesh->primitives)
             {
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = node->mesh->uniformBuffer.descriptorSet,
-                .dstBinding = 0,
-                .descriptorCount = 1,
-                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                .pBufferInfo = &node->mesh->uniformBuffer.descriptor,
-            };
-            vkUpdateDescriptorSets(device_, 1, &writeDescriptorSet, 0, nullptr);
+                drawItems.push_back({ node->mesh, primitive });
+            }
         }
-        for (auto& child : node->children)
+        for (Node* child : node->children)
+        {
+            AppendDrawItems(child);
+        }
+    }
+
+    void Model::CreateTransformBuffer()
+    {
+        std::vector<Mesh*> meshes;
+        for (Node* node : linearNodes)
         {
-            PrepareNodeDescriptor(child, descriptorSetLayout);
+            if (node->mesh) meshes.push_back(node->mesh);
         }
+
+        VkPhysicalDeviceProperties properties{};
+        vkGetPhysicalDeviceProperties(physicalDevice_, &properties);
+        const VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+        transforms.stride = (sizeof(glm::mat4) + alignment - 1) / alignment * alignment;
+        transforms.range = (sizeof(TransformBlock) + 15) / 16 * 16;
+        const VkDeviceSize bufferSize = (std::max<VkDeviceSize>(meshes.size(), 1) - 1) * transforms.stride + transforms.range;
+
+        Util::CreateBuffer(
+            uploads_.GetAllocator(),
+            device_,
+            bufferSize,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            Memory::Uniforms,
+            transforms.buffer,
+            transforms.memory
+        );
+        memset(transforms.memory.mapped, 0, static_cast<size_t>(bufferSize));
+
+        for (uint32_t i = 0; i < meshes.size(); i++)
+        {
+            meshes[i]->transformIndex = i;
+            meshes[i]->transform = reinterpret_cast<glm::mat4*>(static_cast<uint8_t*>(transforms.memory.mapped) + i * transforms.stride);
+        }
+        nodeTransforms.resize(linearNodes.size());
+        for (size_t node = 0; node < linearNodes.size(); node++)
+        {
+            nodeTransforms[node] = linearNodes[node]->mesh ? linearNodes[node]->mesh->transform : nullptr;
+        }
+    }
+
+    const TransformHierarchy::Range Model::UpdateTransforms()
+    {
+        Profiler::Zone zone("update transforms");
+        return hierarchy.Update(nodeTransforms);
     }
 }
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #define TINYGLTF_NO_STB_IMAGE_WRITE
@@ -10,6 +16,10 @@
 
 #include "vulkan/vulkan.h"
 
+#include "jobs.hpp"
+#include "memory.hpp"
+#include "upload.hpp"
+
 namespace Scene
 {
 	extern VkDescriptorSetLayout descriptorSetLayoutImage;
@@ -23,7 +33,7 @@ namespace Scene
 		std::string uri;
 
 		VkImage image;
-		VkDeviceMemory deviceMemory;
+		Memory::Allocation deviceMemory;
 		VkImageView view;
 		uint32_t width, height;
 		uint32_t mipLevels;
@@ -31,8 +41,9 @@ namespace Scene
 		VkSampler sampler;
 		void Destroy();
 
-		Texture(tinygltf::Image& gltfimage, const std::string path, const VkPhysicalDevice& physicalDevice, const VkDevice& d, const VkCommandPool& commandPool, const VkQueue& copyQueue, const VkDescriptorPool& descriptorSetPool);
-		Texture(const std::string path, const VkPhysicalDevice& physicalDevice, const VkDevice& d, const VkCommandPool& commandPool, const VkQueue& copyQueue, const VkDescriptorPool& descriptorSetPool);
+		// Uploads are recorded into the context, the texture can be sampled once its batch has completed
+		Texture(tinygltf::Image& gltfimage, const std::string path, const VkPhysicalDevice& physicalDevice, const VkDevice& d, Upload::UploadContext& uploads, const VkDescriptorPool& descriptorSetPool);
+		Texture(const std::string path, const VkPhysicalDevice& physicalDevice, const VkDevice& d, Upload::UploadContext& uploads, const VkDescriptorPool& descriptorSetPool);
 		~Texture();
 
 		Texture(const Texture& o) = delete;
@@ -63,16 +74,26 @@ namespace Scene
 		//Texture* specularGlossinessTexture;
 		//Texture* diffuseTexture;
 
+		// While streaming, the image baseColorTexture will be swapped to once loaded, -1 when already bound
+		int baseColorImage = -1;
+		// Frames in flight whose descriptor set still points to a replaced texture
+		uint32_t staleFrames = 0;
+
 		Material(const VkDevice& device) : device(device) {};
 
+		// One per frame in flight, so a set can be rewritten while other frames still use theirs
 		std::vector<VkDescriptorSet> descriptorSets;
 		void CreateDescriptorSets(const VkDescriptorPool descriptorPool, const VkDescriptorSetLayout descriptorSetLayout/*, uint32_t descriptorBindingFlags*/);
+		void WriteDescriptorSet(uint32_t frameIndex);
 	};
 
+	// Indices are relative to firstVertex, which draws pass as their vertex offset. firstIndex is within the region of
+	// the model's index buffer holding indexType indices.
 	struct Primitive
 	{
 		uint32_t firstIndex;
 		uint32_t indexCount;
+		VkIndexType indexType;
 		uint32_t firstVertex;
 		uint32_t vertexCount;
 		Material& material;
@@ -91,49 +112,59 @@ namespace Scene
 
 	struct Mesh
 	{
-		const VkDevice device;
-		const VkPhysicalDevice physicalDevice;
-
 		std::vector<Primitive*> primitives;
 		std::string name;
 
-		struct UniformBuffer
-		{
-			VkBuffer buffer;
-			VkDeviceMemory memory;
-			VkDescriptorBufferInfo descriptor;
-			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
-			void* mapped;
-		} uniformBuffer;
-
-		struct UniformBlock
-		{
-			glm::mat4 matrix;
-			glm::mat4 jointMatrix[64]{};
-			float jointcount{ 0 };
-		} uniformBlock;
+		// Slot in the model's transform buffer, see Model::Transforms
+		uint32_t transformIndex = 0;
+		glm::mat4* transform = nullptr;
 
-		Mesh(const VkPhysicalDevice& physicalDevice, const VkDevice& device, const glm::mat4 matrix);
 		~Mesh();
 	};
 
+	// Node transforms as arrays in topological order, every parent before its children, so that world matrices
+	// propagate in one linear pass. Only nodes marked dirty & their descendants are recomputed.
+	struct TransformHierarchy
+	{
+		// Nodes whose world matrices changed, [begin, end) in hierarchy order
+		struct Range
+		{
+			uint32_t begin = 0;
+			uint32_t end = 0;
+			const bool Empty() const { return begin >= end; }
+		};
+
+		std::vector<int32_t> parents; // -1 for roots
+		std::vector<glm::vec3> translations;
+		std::vector<glm::quat> rotations;
+		std::vector<glm::vec3> scales;
+		std::vector<glm::mat4> matrices; // glTF node matrix, applied after TRS
+		std::vector<glm::mat4> worlds;
+		std::vector<uint8_t> dirty; // Local transform changed since the last Propagate
+
+		// Appends an identity transform, marked dirty. The parent must have been added before.
+		const uint32_t Add(int32_t parent);
+		const uint32_t Count() const { return static_cast<uint32_t>(parents.size()); }
+		const glm::mat4 LocalMatrix(uint32_t node) const;
+		void MarkDirty(uint32_t node) { dirty[node] = 1; }
+		void MarkAllDirty() { std::fill(dirty.begin(), dirty.end(), uint8_t(1)); }
+		// Recomputes the world matrices of dirty nodes & their descendants & clears the flags
+		const Range Propagate();
+		// Propagates, then copies the world matrix of each changed node to its target, e.g. a mapped transform
+		// slot. Targets are indexed like the nodes, nullptr for nodes without one.
+		const Range Update(const std::vector<glm::mat4*>& targets);
+	};
+
 	struct Node {
 		Node* parent;
 		uint32_t index;
 		std::vector<Node*> children;
-		glm::mat4 matrix;
 		std::string name;
 		Mesh* mesh;
 		//Skin* skin;
 		//int32_t skinIndex = -1;
-		glm::vec3 translation{};
-		glm::vec3 scale{ 1.0f };
-		glm::quat rotation{};
-
-		glm::mat4 GetLocalMatrix();
-		glm::mat4 GetMatrix();
+		uint32_t hierarchyIndex; // Into the model's TransformHierarchy & linearNodes
 
-		void Update();
 		~Node();
 
 		Node* FindChild(uint32_t index);
@@ -141,6 +172,40 @@ namespace Scene
 
 	enum class VertexComponent { Position, Normal, UV, Color, Tangent, Joint0, Weight0 };
 
+	// How a model's vertices are laid out in its vertex buffer
+	enum class VertexLayout
+	{
+		Full, // Interleaved Vertex, all 32-bit floats
+		Packed, // Positions in a stream of their own, PackedVertex attributes in a second & SkinVertex in a third if skinned
+	};
+
+	// Vertex buffer bindings of the packed layout. A position only pipeline, e.g. for depth or culling, reads one
+	// tightly packed stream.
+	enum VertexStream
+	{
+		PositionStream = 0,
+		AttributeStream,
+		SkinStream,
+		VertexStreamCount,
+	};
+
+	// Packed layout attributes, 16 bytes. Normals & tangents are octahedral encoded, with the tangent's handedness
+	// in its third component. The scene shaders don't light anything & ignore both, so nothing decodes them yet.
+	struct PackedVertex
+	{
+		uint32_t normal; // R16G16_SNORM
+		uint32_t tangent; // R8G8B8A8_SNORM
+		uint32_t uv; // R16G16_SFLOAT
+		uint32_t color; // R8G8B8A8_UNORM
+	};
+
+	// Packed layout skinning attributes, only stored for models with skinned primitives
+	struct SkinVertex
+	{
+		uint16_t joints[4]; // R16G16B16A16_UINT
+		uint32_t weights; // R8G8B8A8_UNORM
+	};
+
 	struct Vertex
 	{
 		glm::vec3 pos;
@@ -151,50 +216,136 @@ namespace Scene
 		glm::vec4 weight0;
 		glm::vec4 tangent;
 
-		static VkVertexInputBindingDescription vertexInputBindingDescription;
+		static std::vector<VkVertexInputBindingDescription> vertexInputBindingDescriptions;
 		static std::vector<VkVertexInputAttributeDescription> vertexInputAttributeDescriptions;
 		static VkPipelineVertexInputStateCreateInfo pipelineVertexInputStateCreateInfo;
 
 		static VkVertexInputBindingDescription GetInputBindingDescription(uint32_t binding);
 		static VkVertexInputAttributeDescription GetInputAttributeDescription(uint32_t binding, uint32_t location, VertexComponent component);
 		static std::vector<VkVertexInputAttributeDescription> GetInputAttributeDescriptions(uint32_t binding, const std::vector<VertexComponent> components);
+		// Packed layout stream a component is read from, & its attribute description there
+		static VertexStream GetPackedStream(VertexComponent component);
+		static VkVertexInputAttributeDescription GetPackedInputAttributeDescription(uint32_t location, VertexComponent component);
 		/** @brief Returns the default pipeline vertex input state create info structure for the requested vertex components */
-		static VkPipelineVertexInputStateCreateInfo* GetPipelineVertexInputState(const std::vector<VertexComponent> components);
+		static VkPipelineVertexInputStateCreateInfo* GetPipelineVertexInputState(const std::vector<VertexComponent> components, VertexLayout layout = VertexLayout::Full);
+	};
+
+	// Tightly packed glTF accessor data for one primitive, null for absent attributes
+	struct VertexStreams
+	{
+		size_t count;
+		const float* position;
+		const float* normal;
+		const float* uv;
+		const float* color;
+		uint32_t colorComponents;
+		const float* tangent;
+		const uint16_t* joints;
+		const float* weights;
 	};
 
+	// One primitive's accessor data and where it goes in the model's vertex & index buffers
+	struct PrimitiveLoad
+	{
+		VertexStreams streams;
+		const void* indices;
+		int indexComponentType;
+		size_t indexCount;
+		VkIndexType indexType;
+		uint32_t firstVertex;
+		uint32_t firstIndex; // Within the indexType region
+	};
+
+	// CPU side of model loading, free of device work so they can be benchmarked in isolation
+	void ExpandRgbToRgba(const unsigned char* rgb, size_t pixelCount, unsigned char* rgba);
+	void ReadNodeTransform(const tinygltf::Node& node, TransformHierarchy& hierarchy, uint32_t target);
+	// tinygltf image loader keeping the encoded bytes, with component left 0 until DecodeImage has run
+	bool DeferImageDecode(tinygltf::Image* image, const int imageIndex, std::string* error, std::string* warning, int requestedWidth, int requestedHeight, const unsigned char* bytes, int size, void* userData);
+	// Decodes a deferred image in place to 8-bit RGBA, like tinygltf's own loader
+	void DecodeImage(tinygltf::Image& image);
+	void WriteVertices(const VertexStreams& streams, Vertex* vertices);
+	void AppendVertices(const VertexStreams& streams, std::vector<Vertex>& vertexBuffer);
+	// Octahedral encoding of a unit vector to [-1, 1]^2, a zero vector encodes to +Z
+	const glm::vec2 OctahedralEncode(glm::vec3 direction);
+	// Writes the packed layout's streams, skin only if not null. Primitives without skinning get zero joints & weights.
+	void WritePackedVertices(const VertexStreams& streams, glm::vec3* positions, PackedVertex* attributes, SkinVertex* skin);
+	const bool IsSupportedIndexType(int componentType);
+	// Index type a primitive is stored with, 16 bits unless it has too many vertices
+	const VkIndexType PrimitiveIndexType(size_t vertexCount);
+	// Converts 8/16/32-bit indices to 16 or 32 bits, unchanged in value. False for unsupported component types.
+	const bool WriteIndices(const void* data, int componentType, size_t count, uint16_t* indices);
+	const bool WriteIndices(const void* data, int componentType, size_t count, uint32_t* indices);
+	template<typename T>
+	const bool AppendIndices(const void* data, int componentType, size_t count, std::vector<T>& indexBuffer)
+	{
+		if (!IsSupportedIndexType(componentType)) return false;
+
+		const size_t indexStart = indexBuffer.size();
+		indexBuffer.resize(indexStart + count);
+		return WriteIndices(data, componentType, count, &indexBuffer[indexStart]);
+	}
+
 	class Model {
 	private:
 		Texture* GetTexture(uint32_t index);
+		void AppendDrawItems(Node* node);
+		void StreamTextures(std::vector<tinygltf::Image> images);
 
 		const VkPhysicalDevice physicalDevice_;
 		const VkDevice device_;
-		const VkQueue transferQueue_;
-		const VkCommandPool commandPool_;
+		Upload::UploadContext& uploads_;
 		VkDescriptorPool descriptorPool_;
 		const float scale_;
 
 		Texture* emptyTexture_;
+
+		// Texture streaming, see UpdateStreamedTextures
+		Upload::UploadContext* const streamUploads_;
+		std::unique_ptr<Jobs::JobSystem> streamJobs_; // Kept apart so decodes never stall the render thread's parallel recording
+		std::thread streamThread_;
+		std::atomic<bool> stopStreaming_ = false;
+		std::mutex streamedMutex_;
+		std::vector<uint32_t> streamedImages_; // Loaded since the last UpdateStreamedTextures
+		std::atomic<uint32_t> streamedCount_ = 0;
+		uint32_t staleFrames_ = 0;
 	public:
+		// All streams of a layout live in the one buffer, each at its own offset
 		struct Vertices
 		{
 			int count;
 			VkBuffer buffer;
-			VkDeviceMemory memory;
+			Memory::Allocation memory;
+			VertexLayout layout;
+			uint32_t streamCount; // Bindings from 0 on, 1 for the full layout
+			VkDeviceSize streamOffsets[VertexStreamCount];
 		} vertices;
 
+		// 16-bit indices first, then a 32-bit region for primitives with more vertices than 16 bits address
 		struct Indices
 		{
 			int count;
 			VkBuffer buffer;
-			VkDeviceMemory memory;
+			Memory::Allocation memory;
+			uint32_t count16 = 0;
+			uint32_t count32 = 0;
+			VkDeviceSize offset32 = 0; // Byte offset of the 32-bit region
 		} indices;
 
 		std::vector<Node*> nodes;
-		std::vector<Node*> linearNodes;
+		std::vector<Node*> linearNodes; // In hierarchy order
+		TransformHierarchy hierarchy;
+
+		// Every primitive in the order Draw records them, so recording can be split into ranges
+		struct DrawItem
+		{
+			Mesh* mesh;
+			Primitive* primitive;
+		};
+		std::vector<DrawItem> drawItems;
 
 		//std::vector<Skin*> skins;
 
-		std::vector<Texture> textures;
+		std::vector<std::unique_ptr<Texture>> textures; // Null until loaded while streaming
 		std::vector<Material> materials;
 		//std::vector<Animation> animations;
 
@@ -206,27 +357,71 @@ namespace Scene
 			float radius;
 		} dimensions;
 
+		// Vertex shader's per-object block (set 1). Skins aren't loaded, so nothing fills the joint palette.
+		struct TransformBlock
+		{
+			glm::mat4 matrix;
+			glm::mat4 jointMatrix[64];
+			float jointcount;
+		};
+
+		// Mesh world matrices, one slot per mesh in a single host visible buffer, bound through one descriptor set
+		// with a dynamic offset per mesh. Slots are only a matrix apart, rounded up to the offset alignment; the
+		// descriptor range spans a whole TransformBlock and overlaps the following slots, which the shader never
+		// reads past the matrix of. The buffer is padded for the last slot's range. Slots follow hierarchy order,
+		// so the meshes of a changed range of nodes are written as one contiguous range of the buffer.
+		struct Transforms
+		{
+			VkBuffer buffer = VK_NULL_HANDLE;
+			Memory::Allocation memory;
+			VkDeviceSize stride = 0;
+			VkDeviceSize range = 0;
+			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		} transforms;
+		std::vector<glm::mat4*> nodeTransforms; // Per hierarchy node, its mesh's slot in the mapped buffer or nullptr
+
 		bool metallicRoughnessWorkflow = true;
 		bool buffersBound = false;
 		std::string path;
 
-		Model(const std::string filename, const VkPhysicalDevice& pd, const VkDevice& d, const VkCommandPool& commandPool, const VkQueue& transferQueue, const float scale);
+		// Loading work is spread over the job system. Given an upload context for streaming, the constructor returns
+		// once geometry is uploaded, with materials bound to a placeholder texture. Images then load on a background
+		// thread, uploading through that context.
+		Model(const std::string filename, const VkPhysicalDevice& pd, const VkDevice& d, Upload::UploadContext& uploads, Jobs::JobSystem& jobs, const float scale, const VertexLayout vertexLayout, Upload::UploadContext* streamUploads = nullptr);
 		~Model();
 
-		void LoadNode(Node* parent, const tinygltf::Node& node, uint32_t nodeIndex, const tinygltf::Model& model, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer, float globalscale);
+		// Points frameIndex's material descriptor sets to the textures streamed in so far. Call from the thread
+		// recording draws, after the frame's previous submission has completed.
+		void UpdateStreamedTextures(uint32_t frameIndex);
+		const uint32_t GetLoadedTextureCount() const { return streamedCount_.load(); }
+		const uint32_t GetTextureCount() const { return static_cast<uint32_t>(textures.size()); }
+
+		void LoadNode(Node* parent, const tinygltf::Node& node, uint32_t nodeIndex, const tinygltf::Model& model, std::vector<PrimitiveLoad>& primitiveLoads, float globalscale);
 		//void LoadSkins(Model& gltfModel);
-		void LoadImages(tinygltf::Model& gltfModel);
+		// Decodes images on the job system and uploads them as they're decoded, handing each to loaded once its
+		// upload has completed. An image failing to decode or upload is passed to failed & skipped, or without
+		// failed ends loading with an exception. Stops early once stopStreaming_ is set.
+		void LoadImages(std::vector<tinygltf::Image>& images, Jobs::JobSystem& jobs, Upload::UploadContext& uploads, const std::function<void(uint32_t, std::unique_ptr<Texture>)>& loaded, const std::function<void(uint32_t, const std::string&)>& failed = nullptr);
 		void LoadMaterials(tinygltf::Model& gltfModel);
 		//void LoadAnimations(Model& gltfModel);
+		// Binds every vertex stream of the layout & the index buffer's 16-bit region
 		void BindBuffers(VkCommandBuffer commandBuffer);
-		void DrawNode(Node* node, VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1);
-		void Draw(VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1);
+		void BindIndexRegion(VkCommandBuffer commandBuffer, VkIndexType indexType);
+		void DrawNode(Node* node, VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1, uint32_t frameIndex = 0);
+		void Draw(VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1, uint32_t frameIndex = 0);
+		// Records drawItems [begin, end) including the buffer binds, e.g. into one of several secondary command buffers
+		void DrawRange(VkCommandBuffer commandBuffer, uint32_t begin, uint32_t end, VkPipelineLayout pipelineLayout, uint32_t frameIndex = 0);
 		//void GetNodeDimensions(Node* node, glm::vec3& min, glm::vec3& max);
 		//void GetSceneDimensions();
 		//void UpdateAnimation(uint32_t index, float time);
 		Node* FindNode(Node* parent, uint32_t index);
 		Node* NodeFromIndex(uint32_t index);
-		void PrepareNodeDescriptor(Node* node, VkDescriptorSetLayout descriptorSetLayout);
+		// Assigns each mesh of linearNodes a transform slot
+		void CreateTransformBuffer();
+		// Propagates the hierarchy & writes the world matrices that changed into the transform buffer, returns the
+		// nodes written. The buffer isn't per frame in flight: only call once frames reading it have completed.
+		const TransformHierarchy::Range UpdateTransforms();
+		const uint32_t TransformOffset(const Mesh* mesh) const { return static_cast<uint32_t>(mesh->transformIndex * transforms.stride); }
 	};
 
 }
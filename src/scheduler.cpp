@@ -0,0 +1,166 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <timeapi.h>
+#endif
+
+#include "profiler.hpp"
+
+namespace Scheduler
+{
+    // Spin at least this long before a deadline, and at most this long however coarse the OS timer is
+    constexpr uint64_t MIN_SPIN_WINDOW_NS = 300'000;
+    constexpr uint64_t MAX_SPIN_WINDOW_NS = 4'000'000;
+    // Per-sleep decay of the overshoot peak, so one late wake-up doesn't widen the spin window for good
+    constexpr float OVERSHOOT_PEAK_DECAY = 0.99f;
+
+    // Slot counting must agree with the deadlines exactly, also where a deadline falls on a fractional nanosecond
+    constexpr bool GridIsConsistent(uint64_t epochNs, int rate)
+    {
+        for (uint64_t index = 0; index < 3ull * rate + 2; index++)
+        {
+            const uint64_t deadlineNs = GridDeadline(epochNs, rate, index);
+            if (GridSlotsUntil(epochNs, rate, deadlineNs) != index + 1) return false;
+            if (deadlineNs > epochNs && GridSlotsUntil(epochNs, rate, deadlineNs - 1) != index) return false;
+        }
+        return true;
+    }
+    static_assert(GridIsConsistent(0, 3) && GridIsConsistent(0, 7) && GridIsConsistent(0, 90));
+    static_assert(GridIsConsistent(1'234'567'890'123'456ull, 3) && GridIsConsistent(1'234'567'890'123'456ull, 7));
+
+    FrameScheduler::FrameScheduler(uint32_t historySize)
+        : sleep_([](uint64_t durationNs) { std::this_thread::sleep_for(std::chrono::nanoseconds(durationNs)); })
+        , sleepOvershoot_(historySize)
+        , spinWindowNs_(MIN_SPIN_WINDOW_NS)
+    {
+        for (StreamState& stream : streams_)
+        {
+            stream.lateness = RollingStats(historySize);
+        }
+
+#ifdef _WIN32
+        // Default timer resolution is ~15.6 ms, far coarser than a warp interval
+        timeBeginPeriod(1);
+#endif
+    }
+
+    FrameScheduler::~FrameScheduler()
+    {
+#ifdef _WIN32
+        timeEndPeriod(1);
+#endif
+    }
+
+    void FrameScheduler::SetRate(Stream stream, int framesPerSecond)
+    {
+        StreamState& state = streams_[stream];
+        framesPerSecond = std::max(framesPerSecond, 0);
+        if (state.rate == framesPerSecond) return;
+
+        state.rate = framesPerSecond;
+        state.intervalNs = framesPerSecond ? 1'000'000'000ull / framesPerSecond : 0;
+
+        RestartGrid(stream, Profiler::CpuProfiler::Now());
+    }
+
+    void FrameScheduler::SetPhaseAlignment(bool aligned, float warpPhase)
+    {
+        warpPhase = std::clamp(warpPhase, 0.0f, 1.0f);
+        if (phaseAligned_ == aligned && warpPhase_ == warpPhase) return;
+
+        phaseAligned_ = aligned;
+        warpPhase_ = warpPhase;
+        RestartGrid(Warp, Profiler::CpuProfiler::Now());
+    }
+
+    void FrameScheduler::RestartGrid(Stream stream, uint64_t nowNs)
+    {
+        StreamState& state = streams_[stream];
+        state.epochNs = 0;
+        if (stream == Warp) state.epochNs = phaseAligned_ ? static_cast<uint64_t>(warpPhase_ * state.intervalNs) : nowNs;
+
+        // Pick up at the first deadline from now, the render grid and an aligned warp grid run from the clock origin
+        state.slot = state.intervalNs ? state.SlotsUntil(nowNs) : 0;
+    }
+
+    const Tick FrameScheduler::WaitForNextDeadline()
+    {
+        Tick tick = {};
+
+        uint64_t deadlineNs = std::numeric_limits<uint64_t>::max();
+        for (const StreamState& stream : streams_)
+        {
+            if (stream.intervalNs) deadlineNs = std::min(deadlineNs, stream.NextDeadline());
+        }
+        if (deadlineNs == std::numeric_limits<uint64_t>::max())
+        {
+            // Nothing scheduled, don't spin on an empty loop either
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return tick;
+        }
+
+        uint64_t nowNs = Profiler::CpuProfiler::Now();
+        if (deadlineNs > nowNs + spinWindowNs_)
+        {
+            PROFILE_ZONE("sleep");
+            const uint64_t wakeNs = deadlineNs - spinWindowNs_;
+            do
+            {
+                sleep_(wakeNs - nowNs);
+            }
+            while ((nowNs = Profiler::CpuProfiler::Now()) < wakeNs);
+
+            const uint64_t overshootNs = nowNs > wakeNs ? nowNs - wakeNs : 0;
+            sleepOvershoot_.Add(overshootNs / 1e6f);
+            overshootPeakNs_ = std::max(overshootNs, static_cast<uint64_t>(overshootPeakNs_ * OVERSHOOT_PEAK_DECAY));
+            spinWindowNs_ = std::clamp(overshootPeakNs_ + MIN_SPIN_WINDOW_NS, MIN_SPIN_WINDOW_NS, MAX_SPIN_WINDOW_NS);
+        }
+        if (nowNs < deadlineNs)
+        {
+            PROFILE_ZONE("spin");
+            // Yield rather than pause, the driver threads the warp depends on may share this core
+            while ((nowNs = Profiler::CpuProfiler::Now()) < deadlineNs) std::this_thread::yield();
+        }
+
+        for (uint32_t s = 0; s < StreamCount; s++)
+        {
+            StreamState& stream = streams_[s];
+            if (stream.intervalNs == 0 || stream.NextDeadline() > nowNs) continue;
+
+            const uint64_t lateNs = nowNs - stream.NextDeadline();
+            const uint64_t passed = stream.SlotsUntil(nowNs);
+            // Clamped for safety, the due deadline itself is always among the passed ones
+            const uint64_t missed = passed > stream.slot ? passed - stream.slot - 1 : 0;
+            stream.slot = passed;
+            stream.missedDeadlines += missed;
+            stream.lateness.Add(lateNs / 1e6f);
+
+            tick.due[s] = true;
+            tick.deadlineNs[s] = stream.Deadline(passed - 1);
+            tick.lateMs[s] = lateNs / 1e6f;
+            tick.missedSlots[s] = static_cast<uint32_t>(missed);
+        }
+        return tick;
+    }
+
+    const StreamPacing FrameScheduler::GetPacing(Stream stream) const
+    {
+        const StreamState& state = streams_[stream];
+        return StreamPacing
+        {
+            .averageMs = state.lateness.GetAverage(),
+            .p99Ms = state.lateness.GetPercentile(99.0f),
+            .maxMs = state.lateness.GetMax(),
+            .missedDeadlines = state.missedDeadlines,
+        };
+    }
+}
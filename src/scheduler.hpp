@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+#include "stats.hpp"
+
+namespace Scheduler
+{
+    enum Stream
+    {
+        Render = 0,
+        Warp,
+        StreamCount,
+    };
+
+    struct Tick
+    {
+        std::array<bool, StreamCount> due;
+        std::array<uint64_t, StreamCount> deadlineNs; // Latest deadline that came due, on the profiler clock
+        std::array<float, StreamCount> lateMs; // Wake-up time past the deadline
+        std::array<uint32_t, StreamCount> missedSlots; // Whole intervals skipped since the last due deadline
+    };
+
+    // Deadline lateness summary for display
+    struct StreamPacing
+    {
+        float averageMs;
+        float p99Ms;
+        float maxMs;
+        uint64_t missedDeadlines;
+    };
+
+    // Deadline of a grid slot. Scaled from the rate rather than the rounded interval, so grids of multiple rates stay
+    // exactly aligned. The render grid runs from the clock origin, typically boot, so whole seconds are split off before
+    // scaling; the product would overflow 64 bits otherwise. Same result as the plain expression.
+    constexpr uint64_t GridDeadline(uint64_t epochNs, int rate, uint64_t index)
+    {
+        return epochNs + index / rate * 1'000'000'000ull + index % rate * 1'000'000'000ull / rate;
+    }
+
+    // Number of grid deadlines at or before timeNs, the exact inverse of GridDeadline. Deadline i is at or before
+    // elapsed e while i * 1e9 / rate < e + 1, so the count is the ceiling of (e + 1) * rate / 1e9, split like above.
+    constexpr uint64_t GridSlotsUntil(uint64_t epochNs, int rate, uint64_t timeNs)
+    {
+        if (timeNs < epochNs) return 0;
+        const uint64_t elapsedNs = timeNs - epochNs + 1;
+        return elapsedNs / 1'000'000'000ull * rate + (elapsedNs % 1'000'000'000ull * rate + 999'999'999ull) / 1'000'000'000ull;
+    }
+
+    // Sleeps until shortly before the next render or warp deadline, then spins for the remainder.
+    // Deadlines sit on a fixed grid from an epoch rather than accumulating frame intervals, so they don't
+    // drift; a stream that falls whole intervals behind skips the missed slots instead of bursting to catch up.
+    // Grids are anchored on the profiler clock, so schedulers on different threads agree on where deadlines fall.
+    class FrameScheduler
+    {
+    public:
+        FrameScheduler(uint32_t historySize = 200);
+        ~FrameScheduler();
+
+        FrameScheduler(const FrameScheduler&) = delete;
+        FrameScheduler& operator=(const FrameScheduler&) = delete;
+
+        // Frames per second, 0 disables the stream
+        void SetRate(Stream stream, int framesPerSecond);
+        // Aligned, the warp grid is offset from the render grid by a fraction of the warp interval. With the warp
+        // rate a multiple of the render rate, every render deadline then coincides with a warp deadline. Unaligned,
+        // the warp grid starts whenever the rate or alignment last changed.
+        void SetPhaseAlignment(bool aligned, float warpPhase);
+        // Replaces the plain thread sleep, e.g. with one that handles window events meanwhile. May return early.
+        void SetSleepFunction(std::function<void(uint64_t durationNs)> sleep) { sleep_ = sleep; }
+
+        const Tick WaitForNextDeadline();
+
+        const uint64_t GetMissedDeadlines(Stream stream) const { return streams_[stream].missedDeadlines; }
+        // Wake-up time past each deadline in ms, i.e. the scheduler's drift
+        const RollingStats& GetLateness(Stream stream) const { return streams_[stream].lateness; }
+        const StreamPacing GetPacing(Stream stream) const;
+        const RollingStats& GetSleepOvershoot() const { return sleepOvershoot_; }
+        const float GetSpinWindowMs() const { return spinWindowNs_ / 1e6f; }
+
+    private:
+        struct StreamState
+        {
+            int rate = 0;
+            uint64_t intervalNs = 0;
+            uint64_t epochNs = 0;
+            uint64_t slot = 0;
+            uint64_t missedDeadlines = 0;
+            RollingStats lateness;
+
+            const uint64_t Deadline(uint64_t index) const { return GridDeadline(epochNs, rate, index); }
+            const uint64_t NextDeadline() const { return Deadline(slot); }
+            const uint64_t SlotsUntil(uint64_t timeNs) const { return GridSlotsUntil(epochNs, rate, timeNs); }
+        };
+
+        void RestartGrid(Stream stream, uint64_t nowNs);
+
+        std::array<StreamState, StreamCount> streams_;
+        bool phaseAligned_ = false;
+        float warpPhase_ = 0.0f;
+        std::function<void(uint64_t)> sleep_;
+
+        // Sleep wake-ups can be late by the OS timer granularity, the spin window adapts to the recent worst case
+        RollingStats sleepOvershoot_;
+        uint64_t overshootPeakNs_ = 0;
+        uint64_t spinWindowNs_;
+    };
+}
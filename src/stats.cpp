@@ -1,106 +1,466 @@
 #include "stats.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <stdexcept>
 #include <iostream>
 
-void DeviceOpTimer::Init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t maxFramesInFlight, uint32_t historySize)
+#include "profiler.hpp"
+
+RollingStats::RollingStats(uint32_t historySize)
+    : values_(historySize, 0)
+    , offset_(historySize - 1)
+{
+    sorted_.reserve(historySize);
+}
+
+void RollingStats::Add(float value)
+{
+    offset_ = (offset_ + 1) % values_.size();
+    sum_ -= values_[offset_];
+    sum_ += value;
+    values_[offset_] = value;
+    count_ = std::min<uint32_t>(count_ + 1, values_.size());
+
+    totalCount_++;
+    totalSum_ += value;
+    totalMin_ = std::min(totalMin_, value);
+    totalMax_ = std::max(totalMax_, value);
+}
+
+const float RollingStats::GetMin() const
+{
+    if (count_ == 0) return 0.0f;
+    // Until the window fills up the unwritten tail is zero, only look at written samples
+    return *std::min_element(values_.begin(), values_.begin() + count_);
+}
+
+const float RollingStats::GetMax() const
+{
+    if (count_ == 0) return 0.0f;
+    return *std::max_element(values_.begin(), values_.begin() + count_);
+}
+
+const float RollingStats::GetPercentile(float percentile) const
+{
+    if (count_ == 0) return 0.0f;
+
+    sorted_.assign(values_.begin(), values_.begin() + count_);
+    const size_t rank = std::clamp<size_t>(static_cast<size_t>(std::ceil(percentile / 100.0f * count_)), 1, count_) - 1;
+    std::nth_element(sorted_.begin(), sorted_.begin() + rank, sorted_.end());
+    return sorted_[rank];
+}
+
+void DeviceOpTimer::Init(VkDevice device, VkPhysicalDevice physicalDevice, const char* name, bool hostQueryReset, uint32_t maxFramesInFlight, uint32_t historySize, uint32_t maxScopesPerFrame)
 {
     device_ = device;
+    hostQueryReset_ = hostQueryReset;
     maxFramesInFlight_ = maxFramesInFlight;
-    lastStampedRenderFrameIndex_ = maxFramesInFlight - 1;
+    maxQueriesPerFrame_ = maxScopesPerFrame * 2; // 2 timestamps (begin & end) per scope
+    historySize_ = historySize;
+    currentSlot_ = maxFramesInFlight - 1;
+
+    slots_ = std::vector<FrameSlot>(maxFramesInFlight);
+    for (FrameSlot& slot : slots_)
+    {
+        slot.records.reserve(maxScopesPerFrame);
+    }
+    openScopes_.reserve(maxScopesPerFrame);
+    results_ = std::vector<uint64_t>(maxQueriesPerFrame_, 0);
 
-    renderTimes_ = std::vector<float>(historySize, 0);
-    awaitingTiming_ = std::vector<bool>(maxFramesInFlight, false);
+    scopes_.clear();
+    scopes_.push_back(Scope
+    {
+        .name = name,
+        .parent = 0,
+        .depth = 0,
+        .times = RollingStats(historySize),
+    });
 
     VkPhysicalDeviceProperties deviceProperties;
     vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
     timestampPeriodNs_ = deviceProperties.limits.timestampPeriod;
 
-    VkQueryPoolCreateInfo renderQueryPoolInfo =
+    traceTrack_ = Profiler::CpuProfiler::RegisterGpuTrack(name);
+
+    VkQueryPoolCreateInfo queryPoolInfo =
     {
         .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
         .pNext = nullptr,
         .flags = 0,
         .queryType = VK_QUERY_TYPE_TIMESTAMP,
-        .queryCount = maxFramesInFlight_ * 2, // 2 timestamps (before & after) for each pass
+        .queryCount = maxFramesInFlight_ * maxQueriesPerFrame_,
     };
-    if (vkCreateQueryPool(device_, &renderQueryPoolInfo, nullptr, &renderQueryPool_) != VK_SUCCESS)
+    if (vkCreateQueryPool(device_, &queryPoolInfo, nullptr, &queryPool_) != VK_SUCCESS)
     {
-        throw std::runtime_error("failed to create create render query pool");
+        throw std::runtime_error("failed to create timer query pool");
     }
+    if (hostQueryReset_) vkResetQueryPool(device_, queryPool_, 0, queryPoolInfo.queryCount);
+}
+
+void DeviceOpTimer::Destroy()
+{
+    vkDestroyQueryPool(device_, queryPool_, nullptr);
+    queryPool_ = VK_NULL_HANDLE;
+}
 
-    VkQueryPoolCreateInfo warpQueryPoolInfo =
+void DeviceOpTimer::RecordStartTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage, VkFence fence, uint64_t frameId)
+{
+    uint32_t slotIndex = (currentSlot_ + 1) % maxFramesInFlight_;
+    FrameSlot& slot = slots_[slotIndex];
+    if (slot.awaitingTiming)
     {
-        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-        .pNext = nullptr,
-        .flags = 0,
-        .queryType = VK_QUERY_TYPE_TIMESTAMP,
-        .queryCount = 2,
-    };
-    if (vkCreateQueryPool(device_, &warpQueryPoolInfo, nullptr, &warpQueryPool_) != VK_SUCCESS)
+        // The caller has waited on the slot's submission, though its fence may have been reset since.
+        // Unavailable results mean the slot was never submitted, drop them rather than stall.
+        if (!ReadSlot(slotIndex)) droppedFrames_++;
+        slot.awaitingTiming = false;
+    }
+
+    if (hostQueryReset_)
+    {
+        vkResetQueryPool(device_, queryPool_, slotIndex * maxQueriesPerFrame_, maxQueriesPerFrame_);
+    }
+    else
+    {
+        vkCmdResetQueryPool(commandBuffer, queryPool_, slotIndex * maxQueriesPerFrame_, maxQueriesPerFrame_);
+    }
+    vkCmdWriteTimestamp(commandBuffer, stage, queryPool_, slotIndex * maxQueriesPerFrame_);
+
+    slot.frameId = frameId;
+    slot.fence = fence;
+    slot.records.clear();
+    slot.records.push_back(ScopeRecord { .scope = 0, .startQuery = 0, .endQuery = 1 });
+    slot.queryCount = 2;
+
+    openScopes_.clear();
+    openScopes_.push_back(0);
+    currentSlot_ = slotIndex;
+}
+
+void DeviceOpTimer::RecordEndTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage)
+{
+    FrameSlot& slot = slots_[currentSlot_];
+    if (openScopes_.size() != 1)
     {
-        
-        throw std::runtime_error("failed to create create warp query pool");
+        throw std::runtime_error(std::string("unbalanced timer scopes in ") + scopes_[0].name);
     }
+
+    vkCmdWriteTimestamp(commandBuffer, stage, queryPool_, currentSlot_ * maxQueriesPerFrame_ + 1);
+
+    openScopes_.clear();
+    slot.awaitingTiming = true;
 }
 
-void DeviceOpTimer::RecordStartTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage)
+void DeviceOpTimer::BeginScope(VkCommandBuffer commandBuffer, const char* name, VkPipelineStageFlagBits stage)
 {
-    uint32_t frameIndex = (lastStampedRenderFrameIndex_ + 1) % maxFramesInFlight_;
-    if (awaitingTiming_[frameIndex]) Update();
-    if (awaitingTiming_[frameIndex])
+    FrameSlot& slot = slots_[currentSlot_];
+    if (slot.queryCount + 2 > maxQueriesPerFrame_)
     {
-        throw std::runtime_error("render timing queue overflow");
+        // Out of queries for this frame, the scope goes untimed
+        openScopes_.push_back(UINT32_MAX);
+        return;
     }
-    
-    vkCmdResetQueryPool(commandBuffer, renderQueryPool_, frameIndex * 2, 2);
-    vkCmdWriteTimestamp(commandBuffer, stage, renderQueryPool_, frameIndex * 2 + 0);
 
-    lastStampedRenderFrameIndex_ = frameIndex;
-    awaitingTiming_[frameIndex] = true;
+    const uint32_t parentRecord = openScopes_.back();
+    const uint32_t parent = parentRecord == UINT32_MAX ? 0 : slot.records[parentRecord].scope;
+
+    vkCmdWriteTimestamp(commandBuffer, stage, queryPool_, currentSlot_ * maxQueriesPerFrame_ + slot.queryCount);
+
+    openScopes_.push_back(slot.records.size());
+    slot.records.push_back(ScopeRecord
+    {
+        .scope = FindOrAddScope(name, parent),
+        .startQuery = slot.queryCount,
+        .endQuery = slot.queryCount + 1,
+    });
+    slot.queryCount += 2;
 }
 
-void DeviceOpTimer::RecordEndTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage)
+void DeviceOpTimer::EndScope(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage)
 {
-    vkCmdWriteTimestamp(commandBuffer, stage, renderQueryPool_, lastStampedRenderFrameIndex_ * 2 + 1);
+    if (openScopes_.size() < 2)
+    {
+        throw std::runtime_error(std::string("timer scope ended without a matching begin in ") + scopes_[0].name);
+    }
+
+    const uint32_t record = openScopes_.back();
+    openScopes_.pop_back();
+    if (record == UINT32_MAX) return;
+
+    const FrameSlot& slot = slots_[currentSlot_];
+    vkCmdWriteTimestamp(commandBuffer, stage, queryPool_, currentSlot_ * maxQueriesPerFrame_ + slot.records[record].endQuery);
 }
 
 void DeviceOpTimer::Update()
 {
-    // Render pass
-    {
-        std::vector<uint64_t> results(maxFramesInFlight_ * 2 * 2, 0);
-        VkResult result = vkGetQueryPoolResults(
-            device_,
-            renderQueryPool_,
-            0,
-            maxFramesInFlight_ * 2, // 2 queries/timestamps per frame (start & end)
-            results.size() * sizeof(uint64_t), // 2 uint64_t entries per query/timestamp (result & availability value)
-            results.data(),
-            2 * sizeof(uint64_t),
-            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
-        );
-        if (result != VK_SUCCESS && result != VK_NOT_READY)
+    for (uint32_t i = 0; i < maxFramesInFlight_; i++)
+    {
+        FrameSlot& slot = slots_[i];
+        if (!slot.awaitingTiming || vkGetFenceStatus(device_, slot.fence) != VK_SUCCESS) continue;
+
+        ReadSlot(i);
+        slot.awaitingTiming = false;
+    }
+}
+
+const bool DeviceOpTimer::ReadSlot(uint32_t slotIndex)
+{
+    const FrameSlot& slot = slots_[slotIndex];
+
+    // The submission has completed, so without VK_QUERY_RESULT_WAIT_BIT this returns immediately
+    VkResult result = vkGetQueryPoolResults(
+        device_,
+        queryPool_,
+        slotIndex * maxQueriesPerFrame_,
+        slot.queryCount,
+        slot.queryCount * sizeof(uint64_t),
+        results_.data(),
+        sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT
+    );
+    if (result == VK_NOT_READY) return false;
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to get timer query pool results");
+    }
+
+    for (const ScopeRecord& record : slot.records)
+    {
+        uint64_t startTimeStamp = results_[record.startQuery];
+        uint64_t endTimeStamp = results_[record.endQuery];
+        float timeMs = (endTimeStamp - startTimeStamp) * 0.000001f * timestampPeriodNs_;
+        scopes_[record.scope].times.Add(timeMs);
+
+        if (calibrated_)
         {
-            throw std::runtime_error("failed to get render query pool results");
+            Profiler::CpuProfiler::RecordGpu(traceTrack_, scopes_[record.scope].name, ToHostNs(startTimeStamp), ToHostNs(endTimeStamp));
         }
+    }
 
-        for (int i = 0; i < maxFramesInFlight_; i++)
-        {
-            if (!awaitingTiming_[i]) continue;
-            if (results[4 * i + 1] == 0) continue; // Start stamp availability
-            if (results[4 * i + 3] == 0) continue; // End stamp availability
+    if (frameCompleted_)
+    {
+        const uint64_t startTimeStamp = results_[slot.records[0].startQuery];
+        const uint64_t endTimeStamp = results_[slot.records[0].endQuery];
+        frameCompleted_(slot.frameId, (endTimeStamp - startTimeStamp) * 0.000001f * timestampPeriodNs_, calibrated_ ? ToHostNs(endTimeStamp) : 0);
+    }
+    return true;
+}
+
+const uint32_t DeviceOpTimer::FindOrAddScope(const char* name, uint32_t parent)
+{
+    for (uint32_t i = 1; i < scopes_.size(); i++)
+    {
+        if (scopes_[i].parent == parent && std::strcmp(scopes_[i].name, name) == 0) return i;
+    }
 
-            uint64_t startTimeStamp = results[4 * i + 0];
-            uint64_t endTimeStamp = results[4 * i + 2];
-            float timeMs = (endTimeStamp - startTimeStamp) * 0.000001f * timestampPeriodNs_ ;
+    // Keep children next to their parent so the list reads as a tree
+    uint32_t insertAt = parent + 1;
+    while (insertAt < scopes_.size() && scopes_[insertAt].depth > scopes_[parent].depth) insertAt++;
 
-            renderTimesOffset_ = (renderTimesOffset_ + 1) % renderTimes_.size();
-            sum_ -= renderTimes_[renderTimesOffset_];
-            sum_ += timeMs;
-            renderTimes_[renderTimesOffset_] = timeMs;
+    scopes_.insert(scopes_.begin() + insertAt, Scope
+    {
+        .name = name,
+        .parent = parent,
+        .depth = scopes_[parent].depth + 1,
+        .times = RollingStats(historySize_),
+    });
 
-            awaitingTiming_[i] = false;
+    // Inserting shifts later scopes, fix up references to them
+    for (Scope& scope : scopes_)
+    {
+        if (scope.parent >= insertAt) scope.parent++;
+    }
+    for (FrameSlot& slot : slots_)
+    {
+        for (ScopeRecord& record : slot.records)
+        {
+            if (record.scope >= insertAt) record.scope++;
         }
     }
+    return insertAt;
+}
+
+const uint64_t DeviceOpTimer::ToHostNs(uint64_t deviceTimestamp) const
+{
+    const double deltaNs = static_cast<int64_t>(deviceTimestamp - calibrationDeviceTimestamp_) * static_cast<double>(timestampPeriodNs_);
+    return static_cast<uint64_t>(static_cast<int64_t>(calibrationHostNs_) + static_cast<int64_t>(deltaNs));
+}
+
+void DeviceOpTimer::SetHostClockCalibration(uint64_t deviceTimestamp, uint64_t hostNs)
+{
+    calibrationDeviceTimestamp_ = deviceTimestamp;
+    calibrationHostNs_ = hostNs;
+    calibrated_ = true;
+}
+
+void PipelineStatsQuery::Init(VkDevice device, bool supported, bool hostQueryReset, uint32_t maxFramesInFlight, uint32_t historySize)
+{
+    device_ = device;
+    supported_ = supported;
+    hostQueryReset_ = hostQueryReset;
+    maxFramesInFlight_ = maxFramesInFlight;
+    currentSlot_ = maxFramesInFlight - 1;
+    slots_ = std::vector<FrameSlot>(maxFramesInFlight);
+    for (RollingStats& counter : counters_)
+    {
+        counter = RollingStats(historySize);
+    }
+
+    if (!supported_) return;
+
+    VkQueryPoolCreateInfo queryPoolInfo =
+    {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+        .queryCount = maxFramesInFlight_,
+        .pipelineStatistics = STATISTIC_FLAGS,
+    };
+    if (vkCreateQueryPool(device_, &queryPoolInfo, nullptr, &queryPool_) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create pipeline statistics query pool");
+    }
+    if (hostQueryReset_) vkResetQueryPool(device_, queryPool_, 0, maxFramesInFlight_);
+}
+
+void PipelineStatsQuery::Destroy()
+{
+    if (queryPool_ != VK_NULL_HANDLE) vkDestroyQueryPool(device_, queryPool_, nullptr);
+    queryPool_ = VK_NULL_HANDLE;
+}
+
+void PipelineStatsQuery::BeginFrame(VkCommandBuffer commandBuffer, VkFence fence, uint64_t frameId)
+{
+    if (!supported_) return;
+
+    uint32_t slotIndex = (currentSlot_ + 1) % maxFramesInFlight_;
+    FrameSlot& slot = slots_[slotIndex];
+    if (slot.awaitingResults) ReadSlot(slotIndex);
+    slot.awaitingResults = false;
+
+    if (hostQueryReset_)
+    {
+        vkResetQueryPool(device_, queryPool_, slotIndex, 1);
+    }
+    else
+    {
+        vkCmdResetQueryPool(commandBuffer, queryPool_, slotIndex, 1);
+    }
+    slot.frameId = frameId;
+    slot.fence = fence;
+    currentSlot_ = slotIndex;
+}
+
+void PipelineStatsQuery::Begin(VkCommandBuffer commandBuffer)
+{
+    if (!supported_) return;
+    vkCmdBeginQuery(commandBuffer, queryPool_, currentSlot_, 0);
+}
+
+void PipelineStatsQuery::End(VkCommandBuffer commandBuffer)
+{
+    if (!supported_) return;
+    vkCmdEndQuery(commandBuffer, queryPool_, currentSlot_);
+    slots_[currentSlot_].awaitingResults = true;
+}
+
+void PipelineStatsQuery::Update()
+{
+    if (!supported_) return;
+
+    for (uint32_t i = 0; i < maxFramesInFlight_; i++)
+    {
+        FrameSlot& slot = slots_[i];
+        if (!slot.awaitingResults || vkGetFenceStatus(device_, slot.fence) != VK_SUCCESS) continue;
+
+        ReadSlot(i);
+        slot.awaitingResults = false;
+    }
+}
+
+void PipelineStatsQuery::ReadSlot(uint32_t slotIndex)
+{
+    std::array<uint64_t, CounterCount> counters;
+    VkResult result = vkGetQueryPoolResults(
+        device_,
+        queryPool_,
+        slotIndex,
+        1,
+        sizeof(counters),
+        counters.data(),
+        sizeof(counters),
+        VK_QUERY_RESULT_64_BIT
+    );
+    if (result == VK_NOT_READY) return;
+    if (result != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to get pipeline statistics query results");
+    }
+
+    for (uint32_t c = 0; c < CounterCount; c++)
+    {
+        counters_[c].Add(static_cast<float>(counters[c]));
+    }
+    if (frameCompleted_) frameCompleted_(slots_[slotIndex].frameId, counters);
+}
+
+LatencyTracker::LatencyTracker(uint32_t historySize)
+    : inputToSubmit_(historySize)
+    , inputToGpuDone_(historySize)
+    , inputToPresent_(historySize)
+{
+}
+
+const float LatencyTracker::FrameSubmitted(uint64_t frameId, uint64_t inputNs, uint64_t submitNs)
+{
+    pending_[frameId % pending_.size()] = PendingFrame
+    {
+        .id = frameId,
+        .inputNs = inputNs,
+        .gpuDone = false,
+        .presented = false,
+    };
+    const float latencyMs = (submitNs - inputNs) * 0.000001f;
+    inputToSubmit_.Add(latencyMs);
+    return latencyMs;
+}
+
+const float LatencyTracker::FrameGpuDone(uint64_t frameId, uint64_t gpuDoneNs)
+{
+    PendingFrame& frame = pending_[frameId % pending_.size()];
+    if (frame.id != frameId || frame.gpuDone || gpuDoneNs == 0) return -1.0f;
+
+    const float latencyMs = (static_cast<int64_t>(gpuDoneNs - frame.inputNs)) * 0.000001f;
+    inputToGpuDone_.Add(latencyMs);
+    frame.gpuDone = true;
+    return latencyMs;
+}
+
+const float LatencyTracker::FramePresented(uint64_t frameId, uint64_t presentNs)
+{
+    PendingFrame& frame = pending_[frameId % pending_.size()];
+    if (frame.id != frameId || frame.presented) return -1.0f;
+
+    const float latencyMs = (presentNs - frame.inputNs) * 0.000001f;
+    inputToPresent_.Add(latencyMs);
+    frame.presented = true;
+    return latencyMs;
+}
+
+void LatencyTracker::ClearPendingPresents()
+{
+    for (PendingFrame& frame : pending_)
+    {
+        frame.presented = true;
+    }
+}
+
+const uint64_t LatencyTracker::GetOldestUnpresentedFrame() const
+{
+    uint64_t oldest = 0;
+    for (const PendingFrame& frame : pending_)
+    {
+        if (!frame.presented && (oldest == 0 || frame.id < oldest)) oldest = frame.id;
+    }
+    return oldest;
 }
@@ -1,42 +1,254 @@
 #pragma once
 
+#include <array>
+#include <functional>
+#include <limits>
+#include <string>
 #include <vector>
 
 #include <vulkan/vulkan.h>
 
+// Rolling window of samples with percentile queries, plus totals since creation
+class RollingStats
+{
+public:
+    RollingStats(uint32_t historySize = 200);
+
+    void Add(float value);
+
+    const float *GetValues() const { return values_.data(); }
+    const uint32_t GetValuesCount() const { return values_.size(); }
+    const uint32_t GetValuesOffset() const { return offset_; }
+
+    const float GetLast() const { return values_[offset_]; }
+    const float GetAverage() const { return count_ ? sum_ / count_ : 0.0f; }
+    const float GetMin() const;
+    const float GetMax() const;
+    const float GetPercentile(float percentile) const;
+
+    // Totals over all samples since creation, not limited to the history window
+    const uint64_t GetTotalCount() const { return totalCount_; }
+    const float GetTotalAverage() const { return totalCount_ ? static_cast<float>(totalSum_ / totalCount_) : 0.0f; }
+    const float GetTotalMin() const { return totalCount_ ? totalMin_ : 0.0f; }
+    const float GetTotalMax() const { return totalMax_; }
+
+private:
+    std::vector<float> values_;
+    uint32_t offset_ = 0;
+    uint32_t count_ = 0;
+    float sum_ = 0;
+
+    // Percentile queries sort a copy of the window, kept around to avoid reallocating
+    mutable std::vector<float> sorted_;
+
+    uint64_t totalCount_ = 0;
+    double totalSum_ = 0;
+    float totalMin_ = std::numeric_limits<float>::max();
+    float totalMax_ = 0;
+};
+
+// GPU timer for a sequence of command buffer submissions, with nested named scopes.
+// Each frame in flight owns a slice of the query pool; a slice is read back only once the fence
+// of the submission it went into has signalled, so readback never waits on the GPU. With host
+// query reset the slice is reset from the CPU right before reuse instead of in the command buffer.
 class DeviceOpTimer
 {
 public:
+    struct Scope
+    {
+        const char* name; // Must outlive the timer, in practice a string literal
+        uint32_t parent; // Index of the enclosing scope, root scope is its own parent
+        uint32_t depth;
+        RollingStats times;
+    };
+
     DeviceOpTimer() {}
 
-    void Init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t maxFramesInFlight, uint32_t historySize);
+    void Init(VkDevice device, VkPhysicalDevice physicalDevice, const char* name, bool hostQueryReset, uint32_t maxFramesInFlight, uint32_t historySize, uint32_t maxScopesPerFrame = 16);
+    void Destroy();
 
-    void RecordStartTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage);
+    // Root scope, brackets everything recorded for one frame. Must be recorded outside a render pass unless
+    // host query reset is enabled. fence is the one the command buffer will be submitted with; the submission
+    // that last used the reused slice, maxFramesInFlight frames ago, must already have been waited on.
+    void RecordStartTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage, VkFence fence, uint64_t frameId = 0);
     void RecordEndTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage);
 
-    const float *GetRenderTimes() const { return renderTimes_.data(); }
-    const uint32_t GetRenderTimesCount() const { return renderTimes_.size(); }
-    const uint32_t GetRenderTimesOffset() const { return renderTimesOffset_; }
-    const float GetRenderTimesAverage() const { return sum_ / renderTimes_.size(); }
-
-    // const VkQueryPool GetWarpQueryPool() const;
+    // Nested scopes, between the root start & end timestamps
+    void BeginScope(VkCommandBuffer commandBuffer, const char* name, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    void EndScope(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 
     void Update();
 
+    // Pairs a device timestamp with the profiler host clock, so scopes show up on the CPU trace timeline
+    void SetHostClockCalibration(uint64_t deviceTimestamp, uint64_t hostNs);
+    // Host time of the last calibration, 0 if never calibrated
+    const uint64_t GetCalibrationHostNs() const { return calibrationHostNs_; }
+
+    // Called from Update for each frame whose results came back, with the root scope duration and its end
+    // on the host clock (0 until calibrated)
+    void SetFrameCompletedCallback(std::function<void(uint64_t frameId, float timeMs, uint64_t endHostNs)> callback) { frameCompleted_ = callback; }
+
+    // Scopes in first-recorded order, parents before children; scope 0 is the root
+    const std::vector<Scope>& GetScopes() const { return scopes_; }
+    const RollingStats& GetFrameTimes() const { return scopes_[0].times; }
+    const uint64_t GetDroppedFrames() const { return droppedFrames_; }
+
 private:
-    // Query pools
-    VkQueryPool renderQueryPool_;
-    VkQueryPool warpQueryPool_;
+    struct ScopeRecord
+    {
+        uint32_t scope;
+        uint32_t startQuery;
+        uint32_t endQuery;
+    };
+
+    struct FrameSlot
+    {
+        uint64_t frameId = 0;
+        VkFence fence = VK_NULL_HANDLE;
+        std::vector<ScopeRecord> records;
+        uint32_t queryCount = 0;
+        bool awaitingTiming = false;
+    };
+
+    // False if the slot's results weren't available
+    const bool ReadSlot(uint32_t slotIndex);
+    const uint32_t FindOrAddScope(const char* name, uint32_t parent);
+    const uint64_t ToHostNs(uint64_t deviceTimestamp) const;
+
+    VkQueryPool queryPool_ = VK_NULL_HANDLE;
 
     VkDevice device_;
+    bool hostQueryReset_;
     uint32_t maxFramesInFlight_;
+    uint32_t maxQueriesPerFrame_;
+    uint32_t historySize_;
 
     float timestampPeriodNs_;
 
-    uint32_t lastStampedRenderFrameIndex_;
+    uint32_t traceTrack_;
+    bool calibrated_ = false;
+    uint64_t calibrationDeviceTimestamp_ = 0;
+    uint64_t calibrationHostNs_ = 0;
+    std::function<void(uint64_t, float, uint64_t)> frameCompleted_;
 
-    std::vector<bool> awaitingTiming_;
-    std::vector<float> renderTimes_;
-    uint32_t renderTimesOffset_;
-    float sum_ = 0;
+    uint32_t currentSlot_;
+    std::vector<FrameSlot> slots_;
+    std::vector<uint32_t> openScopes_; // Indices into the current slot's records
+    std::vector<uint64_t> results_; // Preallocated readback storage for one slot
+
+    std::vector<Scope> scopes_;
+    uint64_t droppedFrames_ = 0;
+};
+
+// Pipeline statistics for one bracketed region per frame, e.g. a pass's main draws. Each frame in
+// flight owns one query, read back once its submission's fence has signalled like DeviceOpTimer.
+// Inert if the device lacks the pipelineStatisticsQuery feature.
+class PipelineStatsQuery
+{
+public:
+    enum Counter
+    {
+        VertexInvocations = 0,
+        ClippingInvocations,
+        ClippingPrimitives,
+        FragmentInvocations,
+        CounterCount,
+    };
+    static constexpr std::array<const char*, CounterCount> CounterNames =
+    {
+        "vertex invocations",
+        "clipping invocations",
+        "clipping primitives",
+        "fragment invocations",
+    };
+
+    // Results come back in bit order, which matches the Counter enum
+    static constexpr VkQueryPipelineStatisticFlags STATISTIC_FLAGS =
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+    PipelineStatsQuery() {}
+
+    void Init(VkDevice device, bool supported, bool hostQueryReset, uint32_t maxFramesInFlight, uint32_t historySize);
+    void Destroy();
+
+    // Starts a frame's query, with the same fence contract as DeviceOpTimer::RecordStartTimestamp. Must be
+    // recorded outside a render pass unless host query reset is enabled. Begin/End either both outside or
+    // within one subpass.
+    void BeginFrame(VkCommandBuffer commandBuffer, VkFence fence, uint64_t frameId = 0);
+    void Begin(VkCommandBuffer commandBuffer);
+    void End(VkCommandBuffer commandBuffer);
+
+    void Update();
+
+    // Called from Update for each frame whose results came back
+    void SetFrameCompletedCallback(std::function<void(uint64_t frameId, const std::array<uint64_t, CounterCount>& counters)> callback) { frameCompleted_ = callback; }
+
+    const bool IsSupported() const { return supported_; }
+    // For VkCommandBufferInheritanceInfo of secondary command buffers run while the query is active
+    const VkQueryPipelineStatisticFlags GetStatisticFlags() const { return supported_ ? STATISTIC_FLAGS : 0; }
+    const RollingStats& GetCounter(Counter counter) const { return counters_[counter]; }
+
+private:
+    struct FrameSlot
+    {
+        uint64_t frameId = 0;
+        VkFence fence = VK_NULL_HANDLE;
+        bool awaitingResults = false;
+    };
+
+    void ReadSlot(uint32_t slotIndex);
+
+    VkDevice device_;
+    VkQueryPool queryPool_ = VK_NULL_HANDLE;
+    bool supported_ = false;
+    bool hostQueryReset_ = false;
+    uint32_t maxFramesInFlight_ = 0;
+
+    uint32_t currentSlot_ = 0;
+    std::vector<FrameSlot> slots_;
+    std::array<RollingStats, CounterCount> counters_;
+    std::function<void(uint64_t, const std::array<uint64_t, CounterCount>&)> frameCompleted_;
+};
+
+// Per-frame latency from the oldest input that fed a frame's pose to its submit, GPU completion and present.
+// All times are on the profiler host clock.
+class LatencyTracker
+{
+public:
+    LatencyTracker(uint32_t historySize = 200);
+
+    // Returns the input to submit latency in ms
+    const float FrameSubmitted(uint64_t frameId, uint64_t inputNs, uint64_t submitNs);
+    // Returns the input to GPU done latency in ms, negative if the frame is unknown
+    const float FrameGpuDone(uint64_t frameId, uint64_t gpuDoneNs);
+    // Returns the input to present latency in ms, negative if the frame is unknown
+    const float FramePresented(uint64_t frameId, uint64_t presentNs);
+
+    // Forget frames whose present will never be reported, e.g. after swapchain recreation
+    void ClearPendingPresents();
+    // Oldest submitted frame not yet presented, 0 if none
+    const uint64_t GetOldestUnpresentedFrame() const;
+
+    const RollingStats& GetInputToSubmit() const { return inputToSubmit_; }
+    const RollingStats& GetInputToGpuDone() const { return inputToGpuDone_; }
+    const RollingStats& GetInputToPresent() const { return inputToPresent_; }
+
+private:
+    struct PendingFrame
+    {
+        uint64_t id = 0;
+        uint64_t inputNs = 0;
+        bool gpuDone = true;
+        bool presented = true;
+    };
+
+    // Frames only stay pending for a few warp intervals, older entries are overwritten
+    std::array<PendingFrame, 16> pending_;
+
+    RollingStats inputToSubmit_;
+    RollingStats inputToGpuDone_;
+    RollingStats inputToPresent_;
 };
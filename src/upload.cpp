@@ -0,0 +1,388 @@
+#include "upload.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#include "util.hpp"
+
+namespace Upload
+{
+    // Staging ring per context, the most a batch stages before it's submitted, & the most a single copy stages.
+    // A batch takes at most half the ring, so the next one records while it's in flight.
+    constexpr VkDeviceSize RING_SIZE = 64ull << 20;
+    constexpr VkDeviceSize BATCH_STAGING_SIZE = RING_SIZE / 2;
+    constexpr VkDeviceSize CHUNK_SIZE = RING_SIZE / 8;
+
+    namespace
+    {
+        VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        VkDeviceSize TexelSize(VkFormat format)
+        {
+            switch (format)
+            {
+            case VK_FORMAT_R8_UINT:
+            case VK_FORMAT_R8_UNORM:
+                return 1;
+            case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_R8G8B8A8_SRGB:
+            case VK_FORMAT_B8G8R8A8_UNORM:
+            case VK_FORMAT_B8G8R8A8_SRGB:
+                return 4;
+            default:
+                throw std::invalid_argument("unsupported upload image format");
+            }
+        }
+    }
+
+    UploadContext::UploadContext(const VkPhysicalDevice& physicalDevice, const VkDevice& device, Memory::Allocator& allocator, VkQueue graphicsQueue, uint32_t graphicsFamily, VkQueue transferQueue, uint32_t transferFamily)
+        : physicalDevice_(physicalDevice)
+        , device_(device)
+        , allocator_(allocator)
+        , graphicsQueue_(graphicsQueue)
+        , graphicsFamily_(graphicsFamily)
+        , transferQueue_(transferFamily != graphicsFamily ? transferQueue : VK_NULL_HANDLE)
+        , transferFamily_(transferFamily)
+    {
+        VkCommandPoolCreateInfo poolInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = graphicsFamily_,
+        };
+        if (vkCreateCommandPool(device_, &poolInfo, nullptr, &graphicsCommandPool_) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create upload command pool");
+        }
+        if (transferQueue_ != VK_NULL_HANDLE)
+        {
+            poolInfo.queueFamilyIndex = transferFamily_;
+            if (vkCreateCommandPool(device_, &poolInfo, nullptr, &transferCommandPool_) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create upload command pool");
+            }
+        }
+
+        VkSemaphoreTypeCreateInfo timelineCreateInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0,
+        };
+        VkSemaphoreCreateInfo semaphoreInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &timelineCreateInfo,
+        };
+        if (vkCreateSemaphore(device_, &semaphoreInfo, nullptr, &timeline_) != VK_SUCCESS ||
+            vkCreateSemaphore(device_, &semaphoreInfo, nullptr, &copyTimeline_) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create upload semaphore");
+        }
+
+        // Copy offsets into the ring stay aligned for any texel size & the device's preferred copy alignment
+        VkPhysicalDeviceProperties properties{};
+        vkGetPhysicalDeviceProperties(physicalDevice_, &properties);
+        ringAlignment_ = std::max<VkDeviceSize>(ringAlignment_, properties.limits.optimalBufferCopyOffsetAlignment);
+        Util::CreateBuffer(allocator_, device_, RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, Memory::Staging, ring_, ringMemory_);
+    }
+
+    UploadContext::~UploadContext()
+    {
+        if (!submitted_.empty()) Wait(submittedSerial_);
+        Release(recording_);
+
+        vkDestroyBuffer(device_, ring_, nullptr);
+        Memory::Free(ringMemory_);
+        vkDestroySemaphore(device_, timeline_, nullptr);
+        vkDestroySemaphore(device_, copyTimeline_, nullptr);
+        vkDestroyCommandPool(device_, graphicsCommandPool_, nullptr);
+        if (transferCommandPool_ != VK_NULL_HANDLE) vkDestroyCommandPool(device_, transferCommandPool_, nullptr);
+    }
+
+    void UploadContext::UploadBuffer(VkBuffer dst, const void* data, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, VkDeviceSize dstOffset)
+    {
+        // Chunks may land in different batches, the barriers below come after all of them in submission order
+        for (VkDeviceSize offset = 0; offset < size; offset += CHUNK_SIZE)
+        {
+            const VkDeviceSize chunkSize = std::min(CHUNK_SIZE, size - offset);
+            const VkBufferCopy region
+            {
+                .srcOffset = Stage(static_cast<const uint8_t*>(data) + offset, chunkSize),
+                .dstOffset = dstOffset + offset,
+                .size = chunkSize,
+            };
+            vkCmdCopyBuffer(CopyCommands(), ring_, dst, 1, &region);
+        }
+
+        VkBufferMemoryBarrier barrier
+        {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = dstAccess,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = dst,
+            .offset = dstOffset,
+            .size = size,
+        };
+        if (transferQueue_ == VK_NULL_HANDLE)
+        {
+            vkCmdPipelineBarrier(GraphicsCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+            return;
+        }
+
+        // Release from the transfer family, then the matching acquire on the graphics family
+        barrier.srcQueueFamilyIndex = transferFamily_;
+        barrier.dstQueueFamilyIndex = graphicsFamily_;
+        barrier.dstAccessMask = 0;
+        vkCmdPipelineBarrier(CopyCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(GraphicsCommands(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    void UploadContext::UploadImage(VkImage image, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, const void* data, VkDeviceSize size, VkImageLayout finalLayout)
+    {
+        const VkDeviceSize rowSize = width * TexelSize(format);
+        if (rowSize * height > size)
+        {
+            throw std::invalid_argument("image upload data smaller than mip 0");
+        }
+
+        Util::TransitionImageLayout(device_, VK_NULL_HANDLE, VK_NULL_HANDLE, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, CopyCommands());
+
+        // Whole rows per chunk, a single row larger than a chunk still goes through in one
+        const uint32_t chunkRows = static_cast<uint32_t>(std::clamp<VkDeviceSize>(CHUNK_SIZE / rowSize, 1, height));
+        for (uint32_t row = 0; row < height; row += chunkRows)
+        {
+            const uint32_t rows = std::min(chunkRows, height - row);
+            const VkBufferImageCopy region
+            {
+                .bufferOffset = Stage(static_cast<const uint8_t*>(data) + row * rowSize, rows * rowSize),
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = VkImageSubresourceLayers
+                {
+                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .mipLevel = 0,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+                .imageOffset = { 0, static_cast<int32_t>(row), 0 },
+                .imageExtent = { width, rows, 1 },
+            };
+            vkCmdCopyBufferToImage(CopyCommands(), ring_, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        }
+
+        const VkCommandBuffer copyCommands = CopyCommands();
+        if (transferQueue_ != VK_NULL_HANDLE)
+        {
+            // Every mip stays a transfer destination across the handover, the graphics family blits into them
+            VkImageMemoryBarrier barrier
+            {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = 0,
+                .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                .srcQueueFamilyIndex = transferFamily_,
+                .dstQueueFamilyIndex = graphicsFamily_,
+                .image = image,
+                .subresourceRange = VkImageSubresourceRange
+                {
+                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .baseMipLevel = 0,
+                    .levelCount = mipLevels,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+            };
+            vkCmdPipelineBarrier(copyCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+            vkCmdPipelineBarrier(GraphicsCommands(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        }
+
+        if (mipLevels == 1)
+        {
+            Util::TransitionImageLayout(device_, VK_NULL_HANDLE, VK_NULL_HANDLE, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout, 1, GraphicsCommands());
+            return;
+        }
+        Util::GenerateMipmaps(physicalDevice_, device_, VK_NULL_HANDLE, VK_NULL_HANDLE, image, format, width, height, mipLevels, GraphicsCommands());
+    }
+
+    const uint64_t UploadContext::Flush()
+    {
+        if (recording_.graphicsCommands == VK_NULL_HANDLE && recording_.transferCommands == VK_NULL_HANDLE) return submittedSerial_;
+
+        const uint64_t serial = submittedSerial_ + 1;
+
+        // The graphics submit always runs, even just to signal completion
+        GraphicsCommands();
+        if (recording_.transferCommands != VK_NULL_HANDLE)
+        {
+            VK_CHECK_RESULT(vkEndCommandBuffer(recording_.transferCommands));
+
+            VkTimelineSemaphoreSubmitInfo timelineSubmitInfo
+            {
+                .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                .signalSemaphoreValueCount = 1,
+                .pSignalSemaphoreValues = &serial,
+            };
+            VkSubmitInfo submitInfo
+            {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .pNext = &timelineSubmitInfo,
+                .commandBufferCount = 1,
+                .pCommandBuffers = &recording_.transferCommands,
+                .signalSemaphoreCount = 1,
+                .pSignalSemaphores = &copyTimeline_,
+            };
+            if (vkQueueSubmit(transferQueue_, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to submit upload transfer commands");
+            }
+        }
+        VK_CHECK_RESULT(vkEndCommandBuffer(recording_.graphicsCommands));
+
+        const bool waitForCopies = recording_.transferCommands != VK_NULL_HANDLE;
+        const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkTimelineSemaphoreSubmitInfo timelineSubmitInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = waitForCopies ? 1u : 0u,
+            .pWaitSemaphoreValues = &serial,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &serial,
+        };
+        VkSubmitInfo submitInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &timelineSubmitInfo,
+            .waitSemaphoreCount = waitForCopies ? 1u : 0u,
+            .pWaitSemaphores = &copyTimeline_,
+            .pWaitDstStageMask = &waitStage,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &recording_.graphicsCommands,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &timeline_,
+        };
+        if (vkQueueSubmit(graphicsQueue_, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to submit upload commands");
+        }
+
+        recording_.serial = serial;
+        submittedSerial_ = serial;
+        submitted_.push_back(std::move(recording_));
+        recording_ = {};
+        return serial;
+    }
+
+    const bool UploadContext::IsComplete(uint64_t serial)
+    {
+        Collect();
+        return submitted_.empty() || submitted_.front().serial > serial;
+    }
+
+    void UploadContext::Wait(uint64_t serial)
+    {
+        if (serial == 0 || IsComplete(serial)) return;
+
+        VkSemaphoreWaitInfo waitInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .semaphoreCount = 1,
+            .pSemaphores = &timeline_,
+            .pValues = &serial,
+        };
+        VK_CHECK_RESULT(vkWaitSemaphores(device_, &waitInfo, std::numeric_limits<uint64_t>::max()));
+        Collect();
+    }
+
+    const VkDeviceSize UploadContext::Stage(const void* data, VkDeviceSize size)
+    {
+        if (recording_.stagingSize > 0 && recording_.stagingSize + size > BATCH_STAGING_SIZE) Flush();
+
+        VkDeviceSize start = AlignUp(ringHead_, ringAlignment_);
+        if (start % RING_SIZE + size > RING_SIZE) start = AlignUp(start, RING_SIZE);
+        while (start + size - ringTail_ > RING_SIZE)
+        {
+            // Space held by the batch recording is only freed once it's submitted too
+            if (submitted_.empty()) Flush();
+            if (submitted_.empty())
+            {
+                throw std::logic_error("upload staging larger than the ring");
+            }
+            Wait(submitted_.front().serial);
+        }
+
+        const VkDeviceSize offset = start % RING_SIZE;
+        memcpy(static_cast<uint8_t*>(ringMemory_.mapped) + offset, data, static_cast<size_t>(size));
+
+        recording_.stagingSize += start + size - ringHead_;
+        recording_.stagingEnd = start + size;
+        ringHead_ = start + size;
+        return offset;
+    }
+
+    const VkCommandBuffer UploadContext::CopyCommands()
+    {
+        if (transferQueue_ == VK_NULL_HANDLE) return GraphicsCommands();
+        if (recording_.transferCommands == VK_NULL_HANDLE) recording_.transferCommands = BeginCommands(transferCommandPool_);
+        return recording_.transferCommands;
+    }
+
+    const VkCommandBuffer UploadContext::GraphicsCommands()
+    {
+        if (recording_.graphicsCommands == VK_NULL_HANDLE) recording_.graphicsCommands = BeginCommands(graphicsCommandPool_);
+        return recording_.graphicsCommands;
+    }
+
+    const VkCommandBuffer UploadContext::BeginCommands(VkCommandPool commandPool)
+    {
+        VkCommandBufferAllocateInfo allocInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = commandPool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        VkCommandBuffer commandBuffer;
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(device_, &allocInfo, &commandBuffer));
+
+        VkCommandBufferBeginInfo beginInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        return commandBuffer;
+    }
+
+    void UploadContext::Collect()
+    {
+        uint64_t completedValue = 0;
+        vkGetSemaphoreCounterValue(device_, timeline_, &completedValue);
+        while (!submitted_.empty() && submitted_.front().serial <= completedValue)
+        {
+            ringTail_ = std::max(ringTail_, submitted_.front().stagingEnd);
+            Release(submitted_.front());
+            submitted_.pop_front();
+        }
+    }
+
+    void UploadContext::Release(Batch& batch)
+    {
+        if (batch.transferCommands != VK_NULL_HANDLE) vkFreeCommandBuffers(device_, transferCommandPool_, 1, &batch.transferCommands);
+        if (batch.graphicsCommands != VK_NULL_HANDLE) vkFreeCommandBuffers(device_, graphicsCommandPool_, 1, &batch.graphicsCommands);
+        batch = {};
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+#include "memory.hpp"
+
+namespace Upload
+{
+    // Records buffer & image uploads into one command buffer per batch, instead of a submit & queue wait each.
+    // A batch is submitted on Flush, or once its staging memory passes a threshold, and signals a timeline
+    // semaphore when done. Data is staged in a persistently mapped ring buffer: staging is a pointer bump &
+    // memcpy, and the ring space a batch used is reclaimed once its timeline value is seen. Uploads larger than
+    // a chunk are split, waiting on older batches when the ring is full. Given a queue of a dedicated transfer
+    // family, copies run on it and ownership is handed over to the graphics family, which generates mipmaps.
+    // Not thread safe, each loading thread uses a context of its own.
+    class UploadContext
+    {
+    public:
+        UploadContext(const VkPhysicalDevice& physicalDevice, const VkDevice& device, Memory::Allocator& allocator, VkQueue graphicsQueue, uint32_t graphicsFamily, VkQueue transferQueue = VK_NULL_HANDLE, uint32_t transferFamily = VK_QUEUE_FAMILY_IGNORED);
+        // Waits for submitted batches, drops an unsubmitted one
+        ~UploadContext();
+
+        UploadContext(const UploadContext&) = delete;
+        UploadContext& operator=(const UploadContext&) = delete;
+
+        // Copies data to dst at dstOffset, after which it's available to dstAccess in dstStage
+        void UploadBuffer(VkBuffer dst, const void* data, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess, VkDeviceSize dstOffset = 0);
+        // Copies tightly packed texels to mip 0 of an image in VK_IMAGE_LAYOUT_UNDEFINED & blits the other mips from
+        // it, leaving every mip in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. Data past mip 0 is ignored. A single
+        // mip image is left in finalLayout instead.
+        void UploadImage(VkImage image, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, const void* data, VkDeviceSize size, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        // Submits what's recorded, returns the serial the batch completes with. With nothing recorded, the serial
+        // of the last batch submitted.
+        const uint64_t Flush();
+        const bool IsComplete(uint64_t serial);
+        void Wait(uint64_t serial);
+        // Flush & wait for everything
+        void Finish() { Wait(Flush()); }
+
+        // Where the resources uploaded to are allocated from too
+        Memory::Allocator& GetAllocator() const { return allocator_; }
+        const bool HasTransferQueue() const { return transferQueue_ != VK_NULL_HANDLE; }
+        const uint64_t GetSubmittedBatchCount() const { return submittedSerial_; }
+
+    private:
+        struct Batch
+        {
+            uint64_t serial = 0;
+            VkCommandBuffer transferCommands = VK_NULL_HANDLE; // Dedicated transfer queue only
+            VkCommandBuffer graphicsCommands = VK_NULL_HANDLE;
+            VkDeviceSize stagingSize = 0; // Ring space taken, alignment & wrap padding included
+            VkDeviceSize stagingEnd = 0; // Ring position past the batch's last staged data
+        };
+
+        // Copies data of at most a chunk into the ring for the current batch, returns its offset in the ring
+        // buffer. Flushes first if the batch has staged enough, & waits on older batches for the space.
+        const VkDeviceSize Stage(const void* data, VkDeviceSize size);
+        // Command buffers of the current batch, begun on first use. Copies go to the transfer queue if there is one.
+        const VkCommandBuffer CopyCommands();
+        const VkCommandBuffer GraphicsCommands();
+        const VkCommandBuffer BeginCommands(VkCommandPool commandPool);
+        // Frees the batches that have completed & the ring space they staged in
+        void Collect();
+        void Release(Batch& batch);
+
+
+        const VkPhysicalDevice physicalDevice_;
+        const VkDevice device_;
+        Memory::Allocator& allocator_;
+        const VkQueue graphicsQueue_;
+        const uint32_t graphicsFamily_;
+        const VkQueue transferQueue_;
+        const uint32_t transferFamily_;
+
+        VkCommandPool graphicsCommandPool_ = VK_NULL_HANDLE;
+        VkCommandPool transferCommandPool_ = VK_NULL_HANDLE;
+        // Timelines signalled with the batch serial. The queues run ahead of each other, a dedicated transfer
+        // queue may finish a batch's copies before the previous batch's graphics work, so each has its own.
+        VkSemaphore timeline_ = VK_NULL_HANDLE; // Batch done, by the graphics submit
+        VkSemaphore copyTimeline_ = VK_NULL_HANDLE; // Copies done, by a dedicated transfer submit
+
+        // Positions grow monotonically, taken modulo the ring size. Staged data never wraps around the end.
+        VkBuffer ring_ = VK_NULL_HANDLE;
+        Memory::Allocation ringMemory_;
+        VkDeviceSize ringAlignment_ = 16;
+        VkDeviceSize ringHead_ = 0; // Next free position
+        VkDeviceSize ringTail_ = 0; // Oldest position still read by a pending batch
+
+        Batch recording_;
+        std::deque<Batch> submitted_;
+        uint64_t submittedSerial_ = 0;
+    };
+}
@@ -4,6 +4,8 @@
 #include <fstream>
 #include <iostream>
 
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/euler_angles.hpp>
 #include <glm/gtx/projection.hpp>
 
 namespace Util
@@ -50,7 +52,7 @@ namespace Util
         throw std::runtime_error("no suitable memory on physical device");
     }
 
-    void CreateBuffer(const VkPhysicalDevice& physicalDevice, const VkDevice& device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+    void CreateBuffer(Memory::Allocator& allocator, const VkDevice& device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, Memory::Category category, VkBuffer& buffer, Memory::Allocation& bufferMemory)
     {
         VkBufferCreateInfo bufferInfo
         {
@@ -65,15 +67,8 @@ namespace Util
         VkMemoryRequirements memRequirements;
         vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo
-        {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .allocationSize = memRequirements.size,
-            .memoryTypeIndex = FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties),
-        };
-
-        VK_CHECK_RESULT(vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory))
-        VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, bufferMemory, 0));
+        bufferMemory = allocator.Allocate(memRequirements, properties, Memory::Tiling::Linear, category);
+        VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset));
     }
 
     void CopyBuffer(const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
@@ -87,7 +82,7 @@ namespace Util
         EndSingleTimeCommands(device, commandPool, queue, commandBuffer);
     }
 
-    void CreateImage(const VkPhysicalDevice& physicalDevice, const VkDevice& device, uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+    void CreateImage(Memory::Allocator& allocator, const VkDevice& device, uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, Memory::Category category, VkImage& image, Memory::Allocation& imageMemory)
     {
         VkImageCreateInfo imageInfo
         {
@@ -117,19 +112,9 @@ namespace Util
         VkMemoryRequirements memRequirements;
         vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo
-        {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .allocationSize = memRequirements.size,
-            .memoryTypeIndex = FindMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties),
-        };
-
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to allocate image memory");
-        }
-
-        VK_CHECK_RESULT(vkBindImageMemory(device, image, imageMemory, 0));
+        const Memory::Tiling memoryTiling = tiling == VK_IMAGE_TILING_LINEAR ? Memory::Tiling::Linear : Memory::Tiling::Optimal;
+        imageMemory = allocator.Allocate(memRequirements, properties, memoryTiling, category);
+        VK_CHECK_RESULT(vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset));
     }
 
     const VkImageView CreateImageView(const VkDevice& device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
@@ -258,7 +243,7 @@ namespace Util
         if (createdCommandBuffer) EndSingleTimeCommands(device, commandPool, queue, commandBuffer);
     }
     
-    void CopyBufferToImage(const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+    void CopyBufferToImage(const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, VkCommandBuffer commandBuffer)
     {
         VkBufferImageCopy region
         {
@@ -276,7 +261,13 @@ namespace Util
             .imageExtent = { width, height, 1 },
         };
 
-        VkCommandBuffer commandBuffer = BeginSingleTimeCommands(device, commandPool);
+        bool createdCommandBuffer = false;
+        if (!commandBuffer)
+        {
+            commandBuffer = BeginSingleTimeCommands(device, commandPool);
+            createdCommandBuffer = true;
+        }
+
         vkCmdCopyBufferToImage(
             commandBuffer,
             buffer,
@@ -285,10 +276,10 @@ namespace Util
             1,
             &region
         );
-        EndSingleTimeCommands(device, commandPool, queue, commandBuffer);
+        if (createdCommandBuffer) EndSingleTimeCommands(device, commandPool, queue, commandBuffer);
     }
 
-    void GenerateMipmaps(const VkPhysicalDevice& physicalDevice, const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+    void GenerateMipmaps(const VkPhysicalDevice& physicalDevice, const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels, VkCommandBuffer commandBuffer)
     {
         // Check if image format supports linear blitting
         VkFormatProperties formatProperties;
@@ -321,7 +312,13 @@ namespace Util
         int32_t mipWidth = texWidth;
         int32_t mipHeight = texHeight;
 
-        VkCommandBuffer commandBuffer = BeginSingleTimeCommands(device, commandPool);
+        bool createdCommandBuffer = false;
+        if (!commandBuffer)
+        {
+            commandBuffer = BeginSingleTimeCommands(device, commandPool);
+            createdCommandBuffer = true;
+        }
+
         for (uint32_t i = 1; i < mipLevels; i++)
         {
             barrier.subresourceRange.baseMipLevel = i - 1;
@@ -401,7 +398,7 @@ namespace Util
             1, &barrier
         );
 
-        EndSingleTimeCommands(device, commandPool, queue, commandBuffer);
+        if (createdCommandBuffer) EndSingleTimeCommands(device, commandPool, queue, commandBuffer);
     }
 
     void CopyImageToImage(const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkImage src, VkImageLayout srcLayout, VkImage dst, VkImageLayout dstLayout, uint32_t width, uint32_t height, VkCommandBuffer commandBuffer)
@@ -479,6 +476,46 @@ namespace Util
         vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
     }
 
+    void FillShadingRateMap(uint8_t* data, uint32_t width, uint32_t height, float visibleRatio, uint8_t outsideRate, uint8_t insideRate)
+    {
+        float outsideWidth = (width - width * visibleRatio) * 0.5f;
+        float outsideHeight = (height - height * visibleRatio) * 0.5f;
+
+        uint8_t* cursor = data;
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                const bool outside = x < outsideWidth || x > width - outsideWidth || y < outsideHeight || y > height - outsideHeight;
+                *cursor = outside ? outsideRate : insideRate;
+                cursor++;
+            }
+        }
+    }
+
+    const ViewProjection ComputeViewProjection(const glm::vec3& renderPosition, const glm::vec2& renderRotation, const glm::vec3& warpPosition, const glm::vec2& warpRotation, float fovDegrees, float aspect)
+    {
+        ViewProjection result;
+        result.renderRotation = glm::eulerAngleYX(renderRotation.y, renderRotation.x);
+        glm::mat4 warpRotationMatrix = glm::eulerAngleYX(warpRotation.y, warpRotation.x);
+
+        result.renderView = glm::lookAt(
+            renderPosition,
+            renderPosition + glm::vec3(result.renderRotation * glm::vec4(0, 0, -1, 0)),
+            glm::vec3(0.0f, 1.0f, 0.0f)
+        );
+        result.warpView = glm::lookAt(
+            warpPosition,
+            warpPosition + glm::vec3(warpRotationMatrix * glm::vec4(0, 0, -1, 0)),
+            glm::vec3(0.0f, 1.0f, 0.0f)
+        );
+
+        // Explicitly zero to one depth, independent of GLM_FORCE_DEPTH_ZERO_TO_ONE in this translation unit
+        result.proj = glm::perspectiveRH_ZO(glm::radians(fovDegrees), aspect, 0.01f, 100.0f);
+        result.proj[1][1] *= -1; // Compensate for inverted clip Y axis on OpenGL
+        result.inverseProj = glm::inverse(result.proj);
+        return result;
+    }
 
     void ApplyStyle(ImGuiStyle& style)
     {
@@ -9,6 +9,8 @@
 #include <glm/gtc/quaternion.hpp>
 #include <imgui.h>
 
+#include "memory.hpp"
+
 #define VK_CHECK_RESULT(f)																				\
 {																										\
 	VkResult res = (f);																					\
@@ -26,13 +28,14 @@ namespace Util
 
 	const uint32_t FindMemoryType(const VkPhysicalDevice& physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
-	void CreateBuffer(const VkPhysicalDevice& physicalDevice, const VkDevice& device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+	// Memory comes from the allocator & is bound at the allocation's offset
+	void CreateBuffer(Memory::Allocator& allocator, const VkDevice& device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, Memory::Category category, VkBuffer& buffer, Memory::Allocation& bufferMemory);
 	void CopyBuffer(const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-	void CreateImage(const VkPhysicalDevice& physicalDevice, const VkDevice& device, uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+	void CreateImage(Memory::Allocator& allocator, const VkDevice& device, uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, Memory::Category category, VkImage& image, Memory::Allocation& imageMemory);
 	const VkImageView CreateImageView(const VkDevice& device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
 	void TransitionImageLayout(const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels, VkCommandBuffer commandBuffer = nullptr);
-	void CopyBufferToImage(const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
-	void GenerateMipmaps(const VkPhysicalDevice& physicalDevice, const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
+	void CopyBufferToImage(const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, VkCommandBuffer commandBuffer = nullptr);
+	void GenerateMipmaps(const VkPhysicalDevice& physicalDevice, const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels, VkCommandBuffer commandBuffer = nullptr);
 	void CopyImageToImage(const VkDevice& device, const VkCommandPool& commandPool, const VkQueue& queue, VkImage src, VkImageLayout srcLayout, VkImage dst, VkImageLayout dstLayout, uint32_t width, uint32_t height, VkCommandBuffer commandBuffer = nullptr);
 
 	const VkCommandBuffer BeginSingleTimeCommands(const VkDevice& device, const VkCommandPool& commandPool);	
@@ -40,5 +43,19 @@ namespace Util
 
 	void ApplyStyle(ImGuiStyle& style);
 
+	// Marks shading rate map texels outside the centered visible region with outsideRate, the rest with insideRate
+	void FillShadingRateMap(uint8_t* data, uint32_t width, uint32_t height, float visibleRatio, uint8_t outsideRate, uint8_t insideRate = 0);
+
+	struct ViewProjection
+	{
+		glm::mat4 renderRotation;
+		glm::mat4 renderView;
+		glm::mat4 warpView;
+		glm::mat4 proj; // Vulkan clip space, Y flipped & depth zero to one
+		glm::mat4 inverseProj;
+	};
+	// Rotations are pitch (x) & yaw (y) in radians
+	const ViewProjection ComputeViewProjection(const glm::vec3& renderPosition, const glm::vec2& renderRotation, const glm::vec3& warpPosition, const glm::vec2& warpRotation, float fovDegrees, float aspect);
+
 	/*glm::quat TwistDecompose(glm::quat rotation, glm::vec3 direction)*/;
 }